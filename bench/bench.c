@@ -0,0 +1,348 @@
+/* Throughput benchmark for ook.  Usage (e.g.):
+ *    ./ookbench -x 256 -b 32,64 -t u8,f -c 1 -j 1,4 -d /scratch
+ * For every combination of brick size, type, component count and backend, a
+ * synthetic volume is written brick by brick ('ookwrite'), and then read
+ * back ('ookbrick') with every requested number of threads.  Each thread
+ * opens its own ookfile and reads every N'th brick.
+ * Results go to stdout, one JSON object per line.  Progress goes to stderr. */
+#define _POSIX_C_SOURCE 200112L
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include "ook.h"
+
+#define MAXLIST 16
+
+struct backend {
+  const char* name;
+  struct io* io;
+  size_t align; /* if nonzero, use 'ookalign' with this block size. */
+};
+
+/* edge length of the (cubic) synthetic volume, in voxels. */
+static uint64_t edge = 128;
+/* directory to create scratch files in. */
+static const char* scratchdir = ".";
+/* sweep parameters.  sizes of 0 terminate the lists. */
+static size_t bricks[MAXLIST] = { 16, 32, 64, 128 };
+static enum OOKTYPE types[MAXLIST] = { OOK_U8, OOK_U16, OOK_FLOAT, OOK_DOUBLE };
+static size_t ntypes = 4;
+static size_t comps[MAXLIST] = { 1, 3 };
+static size_t threads[MAXLIST] = { 1, 2, 4 };
+static size_t repeats = 1;
+static struct backend backends[] = {
+  { "StdCIO", &StdCIO, 0 },
+  { "DirectIO", &DirectIO, 4096 },
+};
+
+static const char* typenames[] = {
+  "i8", "u8", "i16", "u16", "i32", "u32", "i64", "u64", "f", "d"
+};
+
+static size_t
+bytewidth(const enum OOKTYPE t)
+{
+  switch(t) {
+    case OOK_I8: case OOK_U8: return 1;
+    case OOK_I16: case OOK_U16: return 2;
+    case OOK_I32: case OOK_U32: case OOK_FLOAT: return 4;
+    case OOK_I64: case OOK_U64: case OOK_DOUBLE: return 8;
+  }
+  assert(false);
+  return 0;
+}
+
+static double
+now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* parses a comma-separated list of sizes.  returns the number found. */
+static size_t
+sizelist(const char* str, size_t* out)
+{
+  size_t n = 0;
+  char* end;
+  do {
+    out[n++] = (size_t) strtoull(str, &end, 10);
+    str = end + 1;
+  } while(*end == ',' && n < MAXLIST-1);
+  out[n] = 0;
+  return n;
+}
+
+static size_t
+typelist(const char* str, enum OOKTYPE* out)
+{
+  size_t n = 0;
+  char tmp[256];
+  strncpy(tmp, str, sizeof(tmp)-1);
+  tmp[sizeof(tmp)-1] = '\0';
+  for(char* tok = strtok(tmp, ","); tok && n < MAXLIST; tok = strtok(NULL, ",")) {
+    bool found = false;
+    for(size_t t=0; t < sizeof(typenames)/sizeof(typenames[0]); ++t) {
+      if(strcasecmp(tok, typenames[t]) == 0) {
+        out[n++] = (enum OOKTYPE)t;
+        found = true;
+      }
+    }
+    if(!found) {
+      fprintf(stderr, "Invalid type '%s'\n", tok);
+      exit(EXIT_FAILURE);
+    }
+  }
+  return n;
+}
+
+static void
+usage(const char* progname)
+{
+  fprintf(stderr,
+"Usage: %s [-x edge] [-b sizes] [-t types] [-c comps] [-j threads] [-r n] "
+"[-d dir]\n\n"
+"\t-x  edge length of the cubic test volume, in voxels [default=%"PRIu64"]\n"
+"\t-b  comma-separated brick edge lengths to sweep\n"
+"\t-t  comma-separated types to sweep: i8,u8,i16,u16,i32,u32,i64,u64,f,d\n"
+"\t-c  comma-separated component counts to sweep\n"
+"\t-j  comma-separated thread counts to sweep (reads only)\n"
+"\t-r  number of times to repeat each measurement\n"
+"\t-d  directory to create scratch files in [default=.]\n",
+  progname, edge);
+}
+
+static void
+parseopt(int argc, char* const argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "x:b:t:c:j:r:d:h")) != -1) {
+    switch(opt) {
+      case 'x': edge = (uint64_t)atoll(optarg); break;
+      case 'b': sizelist(optarg, bricks); break;
+      case 't': ntypes = typelist(optarg, types); break;
+      case 'c': sizelist(optarg, comps); break;
+      case 'j': sizelist(optarg, threads); break;
+      case 'r': repeats = (size_t)atoll(optarg); break;
+      case 'd': scratchdir = optarg; break;
+      case 'h': /* FALL-THROUGH */
+      default:
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+}
+
+/* the parameters of one measurement. */
+struct config {
+  const struct backend* be;
+  const char* filename;
+  enum OOKTYPE type;
+  size_t components;
+  size_t bsize[3];
+  size_t nthreads;
+};
+
+static void
+report(const struct config* cfg, const char* op, size_t nthreads,
+       uint64_t bytes, size_t nbricks, double seconds)
+{
+  printf("{\"op\":\"%s\",\"backend\":\"%s\",\"type\":\"%s\","
+         "\"components\":%zu,\"volume\":[%"PRIu64",%"PRIu64",%"PRIu64"],"
+         "\"brick\":[%zu,%zu,%zu],\"threads\":%zu,\"bytes\":%"PRIu64","
+         "\"bricks\":%zu,\"seconds\":%.6f,\"MBps\":%.3f,"
+         "\"bricks_per_s\":%.3f}\n",
+         op, cfg->be->name, typenames[cfg->type], cfg->components,
+         edge, edge, edge, cfg->bsize[0], cfg->bsize[1], cfg->bsize[2],
+         nthreads, bytes, nbricks, seconds, bytes / seconds / 1e6,
+         nbricks / seconds);
+  fflush(stdout);
+}
+
+/* tell the OS we won't need this file's pages again, so that reads actually
+ * hit the storage instead of the page cache. */
+static void
+dropcache(const char* fn)
+{
+  const int fd = open(fn, O_RDONLY);
+  if(fd == -1) { return; }
+  (void) fdatasync(fd);
+  (void) posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+}
+
+static void
+fill(void* data, size_t bytes, size_t seed)
+{
+  uint32_t* d = (uint32_t*) data;
+  for(size_t i=0; i < bytes/sizeof(uint32_t); ++i) {
+    d[i] = (uint32_t)((i + seed) * 2654435761U);
+  }
+}
+
+static struct ookfile*
+open_volume(const struct config* cfg, bool create)
+{
+  const uint64_t vol[3] = { edge, edge, edge };
+  struct ookfile* of = create ?
+    ookcreate(*cfg->be->io, cfg->filename, vol, cfg->bsize, cfg->type,
+              cfg->components) :
+    ookread(*cfg->be->io, cfg->filename, vol, cfg->bsize, cfg->type,
+            cfg->components);
+  if(of != NULL && cfg->be->align != 0) {
+    const int err = ookalign(of, cfg->be->align);
+    if(err != 0) {
+      ookclose(of);
+      errno = err;
+      return NULL;
+    }
+  }
+  return of;
+}
+
+/* writes the whole volume and counts its bricks in 'nbricks'; returns the
+ * time it took, or negative (with errno set) on error. */
+static double
+bench_write(const struct config* cfg, size_t* nbricks)
+{
+  const double start = now();
+  struct ookfile* of = open_volume(cfg, true);
+  if(of == NULL) { return -1.0; }
+  void* data = ookalloc(of);
+  if(data == NULL) { ookclose(of); errno = ENOMEM; return -1.0; }
+  *nbricks = ookbricks(of);
+  int err = 0;
+  for(size_t b=0; b < *nbricks && err == 0; ++b) {
+    size_t bs[3];
+    ookbricksize(of, b, bs);
+    fill(data, bs[0]*bs[1]*bs[2]*cfg->components*bytewidth(cfg->type), b);
+    errno = 0;
+    ookwrite(of, b, data);
+    err = errno;
+  }
+  ookfree(data);
+  /* the first error is the interesting one; closing mustn't hide it. */
+  const int cerr = ookclose(of);
+  if(err == 0) { err = cerr; }
+  if(err != 0) { errno = err; return -1.0; }
+  return now() - start;
+}
+
+struct reader {
+  const struct config* cfg;
+  size_t rank;
+  int err;
+};
+
+static void*
+read_bricks(void* arg)
+{
+  struct reader* rd = (struct reader*) arg;
+  struct ookfile* of = open_volume(rd->cfg, false);
+  if(of == NULL) { rd->err = errno ? errno : EINVAL; return NULL; }
+  void* data = ookalloc(of);
+  if(data == NULL) { rd->err = ENOMEM; ookclose(of); return NULL; }
+  const size_t nbricks = ookbricks(of);
+  for(size_t b=rd->rank; b < nbricks && rd->err == 0;
+      b += rd->cfg->nthreads) {
+    rd->err = ookbrick(of, b, data);
+  }
+  ookfree(data);
+  ookclose(of);
+  return NULL;
+}
+
+/* reads the whole volume with 'cfg->nthreads' threads. */
+static double
+bench_read(const struct config* cfg)
+{
+  dropcache(cfg->filename);
+  pthread_t thr[cfg->nthreads];
+  struct reader rd[cfg->nthreads];
+  const double start = now();
+  for(size_t t=0; t < cfg->nthreads; ++t) {
+    rd[t].cfg = cfg;
+    rd[t].rank = t;
+    rd[t].err = 0;
+    if(pthread_create(&thr[t], NULL, read_bricks, &rd[t]) != 0) {
+      rd[t].err = EAGAIN;
+      thr[t] = pthread_self();
+    }
+  }
+  int err = 0;
+  for(size_t t=0; t < cfg->nthreads; ++t) {
+    if(!pthread_equal(thr[t], pthread_self())) { pthread_join(thr[t], NULL); }
+    if(rd[t].err != 0) { err = rd[t].err; }
+  }
+  if(err != 0) { return -1.0; }
+  return now() - start;
+}
+
+int
+main(int argc, char* const argv[])
+{
+  parseopt(argc, argv);
+  if(!ookinit()) {
+    fprintf(stderr, "Initialization failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  char filename[4096];
+  snprintf(filename, sizeof(filename), "%s/.ookbench-%ld", scratchdir,
+           (long)getpid());
+
+  for(size_t t=0; t < ntypes; ++t) {
+    for(size_t c=0; comps[c] != 0; ++c) {
+      for(size_t b=0; bricks[b] != 0; ++b) {
+        for(size_t be=0; be < sizeof(backends)/sizeof(backends[0]); ++be) {
+          struct config cfg = {
+            .be = &backends[be], .filename = filename, .type = types[t],
+            .components = comps[c], .nthreads = 1
+          };
+          const size_t bs = bricks[b] < edge ? bricks[b] : (size_t)edge;
+          cfg.bsize[0] = cfg.bsize[1] = cfg.bsize[2] = bs;
+          /* padding tiny scanlines out to a whole block would mostly
+           * measure the padding. */
+          const size_t scanline = bs * comps[c] * bytewidth(types[t]);
+          if(cfg.be->align != 0 && scanline*4 < cfg.be->align) { continue; }
+
+          const uint64_t bytes = edge*edge*edge * comps[c] *
+                                 bytewidth(types[t]);
+          size_t nbricks = 0;
+
+          fprintf(stderr, "[bench] %s %s x%zu brick %zu\n", cfg.be->name,
+                  typenames[types[t]], comps[c], bs);
+          for(size_t r=0; r < repeats; ++r) {
+            const double wsec = bench_write(&cfg, &nbricks);
+            if(wsec < 0.0) {
+              const int err = errno;
+              fprintf(stderr, "[bench] write failed: %s\n", strerror(err));
+              break;
+            }
+            report(&cfg, "write", 1, bytes, nbricks, wsec);
+            for(size_t j=0; threads[j] != 0; ++j) {
+              cfg.nthreads = threads[j];
+              const double rsec = bench_read(&cfg);
+              if(rsec < 0.0) {
+                fprintf(stderr, "[bench] read failed\n");
+                continue;
+              }
+              report(&cfg, "read", threads[j], bytes, nbricks, rsec);
+            }
+          }
+          remove(filename);
+        }
+      }
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,504 @@
+#define _XOPEN_SOURCE 700 /* for realpath */
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "blockcache.h"
+
+#define DEFAULT_BLOCK (256*1024)
+#define DEFAULT_CAPACITY (UINT64_C(256)*1024*1024)
+
+/* the blocks of one file (by path) we have cached.  Kept after the file is
+ * closed, so that opening it again finds them. */
+struct file {
+  char* path;
+  size_t refs; /* open descriptors. */
+  uint64_t gen; /* bumped by every write; see 'fill'. */
+  bool known; /* whether the stat fields below are valid. */
+  uint64_t size, mtime, mtimens, dev, ino;
+  struct file* next;
+};
+
+struct block {
+  const struct file* file;
+  uint64_t index; /* which block of the file. */
+  char* data;
+  struct block* hnext; /* next in its hash bucket. */
+  struct block* prev; /* LRU list; 'prev' is more recently used. */
+  struct block* next;
+};
+
+struct bc {
+  struct io inner;
+  size_t bsize;
+  size_t max; /* blocks we may keep. */
+  size_t count;
+  struct block** bucket;
+  size_t nbuckets; /* a power of 2. */
+  struct block* mru;
+  struct block* lru;
+  struct file* files;
+  uint64_t hits, misses;
+  pthread_mutex_t lock;
+};
+
+/* what 'open' gives us: a descriptor of the wrapped interface, plus which
+ * shared cache and file it belongs to. */
+struct bfd {
+  struct bc* bc;
+  struct file* file;
+  void* fd;
+};
+
+static size_t
+hash(const struct bc* bc, const struct file* f, const uint64_t index)
+{
+  uint64_t h = (uint64_t)(uintptr_t)f ^ (index * UINT64_C(0x9e3779b97f4a7c15));
+  h ^= h >> 29;
+  return (size_t)(h & (bc->nbuckets-1));
+}
+
+static void
+unlink_lru(struct bc* bc, struct block* b)
+{
+  if(b->prev != NULL) { b->prev->next = b->next; } else { bc->mru = b->next; }
+  if(b->next != NULL) { b->next->prev = b->prev; } else { bc->lru = b->prev; }
+  b->prev = b->next = NULL;
+}
+
+static void
+push_mru(struct bc* bc, struct block* b)
+{
+  b->prev = NULL;
+  b->next = bc->mru;
+  if(bc->mru != NULL) { bc->mru->prev = b; }
+  bc->mru = b;
+  if(bc->lru == NULL) { bc->lru = b; }
+}
+
+static struct block*
+lookup(struct bc* bc, const struct file* f, const uint64_t index)
+{
+  for(struct block* b=bc->bucket[hash(bc, f, index)]; b != NULL; b=b->hnext) {
+    if(b->file == f && b->index == index) { return b; }
+  }
+  return NULL;
+}
+
+static void
+drop(struct bc* bc, struct block* b)
+{
+  struct block** p = &bc->bucket[hash(bc, b->file, b->index)];
+  while(*p != b) { p = &(*p)->hnext; }
+  *p = b->hnext;
+  unlink_lru(bc, b);
+  free(b->data);
+  free(b);
+  --bc->count;
+}
+
+/* gives the cache a block read from the file; it takes ownership of 'data'.
+ * The least recently used block makes room if need be. */
+static void
+insert(struct bc* bc, const struct file* f, const uint64_t index, char* data)
+{
+  if(lookup(bc, f, index) != NULL) { free(data); return; }
+  if(bc->count >= bc->max) { drop(bc, bc->lru); }
+  struct block* b = malloc(sizeof(struct block));
+  if(b == NULL) { free(data); return; }
+  b->file = f;
+  b->index = index;
+  b->data = data;
+  const size_t h = hash(bc, f, index);
+  b->hnext = bc->bucket[h];
+  bc->bucket[h] = b;
+  push_mru(bc, b);
+  ++bc->count;
+}
+
+/* drops every cached block of 'f'. */
+static void
+forget(struct bc* bc, const struct file* f)
+{
+  for(struct block* b=bc->mru; b != NULL; ) {
+    struct block* next = b->next;
+    if(b->file == f) { drop(bc, b); }
+    b = next;
+  }
+}
+
+static int
+cmpu64(const void* a, const void* b)
+{
+  const uint64_t x = *(const uint64_t*)a;
+  const uint64_t y = *(const uint64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+/* the part of piece 'p' which falls in block 'index', as an offset into the
+ * block, an offset into the piece, and a length. */
+static void
+overlap(const struct ookiov* p, const uint64_t index, const size_t bsize,
+        size_t* inblock, size_t* inpiece, size_t* len)
+{
+  const uint64_t bstart = index * bsize;
+  const uint64_t start = (uint64_t)p->offset > bstart ? (uint64_t)p->offset
+                                                       : bstart;
+  const uint64_t pend = (uint64_t)p->offset + p->len;
+  const uint64_t end = pend < bstart+bsize ? pend : bstart+bsize;
+  *inblock = (size_t)(start - bstart);
+  *inpiece = (size_t)(start - (uint64_t)p->offset);
+  *len = (size_t)(end - start);
+}
+
+/* reads every piece: whatever is cached is copied out, and the blocks which
+ * aren't are read all together (vectored, if the wrapped interface can) and
+ * added to the cache.  A block which can't be read whole (at the end of the
+ * file, say) isn't cached; just the part which was asked for is read.
+ * A write while we were reading would make what we read stale, so nothing is
+ * added unless the file's 'gen' is unchanged. */
+static int
+fill(struct bfd* bf, const struct ookiov* iov, const size_t n)
+{
+  struct bc* bc = bf->bc;
+  const size_t B = bc->bsize;
+  size_t nblocks = 0;
+  for(size_t i=0; i < n; ++i) {
+    if(iov[i].len == 0) { continue; }
+    nblocks += (iov[i].offset + iov[i].len - 1) / B - iov[i].offset / B + 1;
+  }
+  uint64_t* missing = malloc(sizeof(uint64_t)*(nblocks+1));
+  if(missing == NULL) { return ENOMEM; }
+  size_t nmiss = 0;
+
+  pthread_mutex_lock(&bc->lock);
+  const uint64_t gen = bf->file->gen;
+  for(size_t i=0; i < n; ++i) {
+    if(iov[i].len == 0) { continue; }
+    const uint64_t last = (iov[i].offset + iov[i].len - 1) / B;
+    for(uint64_t x=iov[i].offset / B; x <= last; ++x) {
+      struct block* b = lookup(bc, bf->file, x);
+      if(b == NULL) {
+        if(nmiss == 0 || missing[nmiss-1] != x) { missing[nmiss++] = x; }
+        continue;
+      }
+      size_t inblock, inpiece, len;
+      overlap(&iov[i], x, B, &inblock, &inpiece, &len);
+      memcpy((char*)iov[i].buf + inpiece, b->data + inblock, len);
+      unlink_lru(bc, b);
+      push_mru(bc, b);
+      ++bc->hits;
+    }
+  }
+  pthread_mutex_unlock(&bc->lock);
+  if(nmiss == 0) { free(missing); return 0; }
+
+  qsort(missing, nmiss, sizeof(uint64_t), cmpu64);
+  size_t u = 0;
+  for(size_t i=0; i < nmiss; ++i) {
+    if(u == 0 || missing[u-1] != missing[i]) { missing[u++] = missing[i]; }
+  }
+  nmiss = u;
+  struct ookiov* fetch = calloc(nmiss, sizeof(struct ookiov));
+  bool* ok = calloc(nmiss, sizeof(bool));
+  if(fetch == NULL || ok == NULL) {
+    free(ok); free(fetch); free(missing);
+    return ENOMEM;
+  }
+  int err = 0;
+  for(size_t i=0; i < nmiss && err == 0; ++i) {
+    fetch[i].offset = (off_t)(missing[i] * B);
+    fetch[i].len = B;
+    fetch[i].buf = malloc(B);
+    if(fetch[i].buf == NULL) { err = ENOMEM; }
+  }
+  const struct io* in = &bc->inner;
+  if(err == 0 && in->vread != NULL && in->vread(bf->fd, fetch, nmiss) == 0) {
+    for(size_t i=0; i < nmiss; ++i) { ok[i] = true; }
+  } else if(err == 0) {
+    for(size_t i=0; i < nmiss; ++i) {
+      ok[i] = in->read(bf->fd, fetch[i].offset, B, fetch[i].buf) == 0;
+    }
+  }
+
+  /* copy out what we read; read directly whatever we couldn't. */
+  for(size_t i=0; i < n && err == 0; ++i) {
+    if(iov[i].len == 0) { continue; }
+    const uint64_t last = (iov[i].offset + iov[i].len - 1) / B;
+    for(uint64_t x=iov[i].offset / B; x <= last && err == 0; ++x) {
+      const uint64_t* m = bsearch(&x, missing, nmiss, sizeof(uint64_t),
+                                  cmpu64);
+      if(m == NULL) { continue; } /* was cached. */
+      const size_t k = (size_t)(m - missing);
+      size_t inblock, inpiece, len;
+      overlap(&iov[i], x, B, &inblock, &inpiece, &len);
+      char* to = (char*)iov[i].buf + inpiece;
+      if(ok[k]) {
+        memcpy(to, (const char*)fetch[k].buf + inblock, len);
+      } else {
+        err = in->read(bf->fd, fetch[k].offset + (off_t)inblock, len, to);
+      }
+    }
+  }
+
+  pthread_mutex_lock(&bc->lock);
+  bc->misses += nmiss;
+  for(size_t i=0; i < nmiss; ++i) {
+    if(err == 0 && ok[i] && bf->file->gen == gen) {
+      insert(bc, bf->file, missing[i], fetch[i].buf);
+    } else {
+      free(fetch[i].buf);
+    }
+  }
+  pthread_mutex_unlock(&bc->lock);
+  free(ok);
+  free(fetch);
+  free(missing);
+  return err;
+}
+
+static int
+bc_vread(void* fd, const struct ookiov* iov, const size_t n)
+{
+  return fill((struct bfd*) fd, iov, n);
+}
+
+static int
+bc_read(void* fd, const off_t offset, const size_t len, void* buf)
+{
+  const struct ookiov iov = { offset, len, buf };
+  return fill((struct bfd*) fd, &iov, 1);
+}
+
+/* brings cached blocks up to date with pieces just written.  If the write
+ * failed we can't know what the file holds, so the blocks are dropped. */
+static void
+update(struct bfd* bf, const struct ookiov* iov, const size_t n,
+       const bool written)
+{
+  struct bc* bc = bf->bc;
+  const size_t B = bc->bsize;
+  pthread_mutex_lock(&bc->lock);
+  ++bf->file->gen;
+  for(size_t i=0; i < n; ++i) {
+    if(iov[i].len == 0) { continue; }
+    const uint64_t last = (iov[i].offset + iov[i].len - 1) / B;
+    for(uint64_t x=iov[i].offset / B; x <= last; ++x) {
+      struct block* b = lookup(bc, bf->file, x);
+      if(b == NULL) { continue; }
+      if(!written) { drop(bc, b); continue; }
+      size_t inblock, inpiece, len;
+      overlap(&iov[i], x, B, &inblock, &inpiece, &len);
+      memcpy(b->data + inblock, (const char*)iov[i].buf + inpiece, len);
+    }
+  }
+  pthread_mutex_unlock(&bc->lock);
+}
+
+static int
+bc_write(void* fd, const off_t offset, const size_t len, const void* buf)
+{
+  struct bfd* bf = (struct bfd*) fd;
+  const int err = bf->bc->inner.write(bf->fd, offset, len, buf);
+  const struct ookiov iov = { offset, len, (void*)buf };
+  update(bf, &iov, 1, err == 0);
+  return err;
+}
+
+static int
+bc_vwrite(void* fd, const struct ookiov* iov, const size_t n)
+{
+  struct bfd* bf = (struct bfd*) fd;
+  const int err = bf->bc->inner.vwrite(bf->fd, iov, n);
+  update(bf, iov, n, err == 0);
+  return err;
+}
+
+/* a punched range reads back as zeroes; simplest to just forget it. */
+static int
+bc_punch(void* fd, const off_t offset, const size_t len)
+{
+  struct bfd* bf = (struct bfd*) fd;
+  const int err = bf->bc->inner.punch(bf->fd, offset, len);
+  const struct ookiov iov = { offset, len, NULL };
+  update(bf, &iov, 1, false);
+  return err;
+}
+
+static int
+bc_hole(void* fd, const off_t offset, const size_t len)
+{
+  struct bfd* bf = (struct bfd*) fd;
+  return bf->bc->inner.hole(bf->fd, offset, len);
+}
+
+static void
+bc_preallocate(void* fd, off_t len)
+{
+  struct bfd* bf = (struct bfd*) fd;
+  bf->bc->inner.preallocate(bf->fd, len);
+}
+
+static int
+bc_close(void* fd)
+{
+  struct bfd* bf = (struct bfd*) fd;
+  const int err = bf->bc->inner.close(bf->fd);
+  pthread_mutex_lock(&bf->bc->lock);
+  --bf->file->refs;
+  pthread_mutex_unlock(&bf->bc->lock);
+  free(bf);
+  return err;
+}
+
+/* finds (or makes) the record for 'fn'.  Its blocks are dropped if the file
+ * is being created, or has changed since we last saw it; the stat is only a
+ * hint, since some interfaces' 'filename's are not files at all. */
+static struct file*
+getfile(struct bc* bc, const char* fn, const enum OOKMODE mode)
+{
+  char real[PATH_MAX];
+  const char* path = realpath(fn, real) != NULL ? real : fn;
+  struct file* f = bc->files;
+  while(f != NULL && strcmp(f->path, path) != 0) { f = f->next; }
+  if(f == NULL) {
+    f = calloc(1, sizeof(struct file));
+    if(f == NULL) { return NULL; }
+    f->path = strdup(path);
+    if(f->path == NULL) { free(f); return NULL; }
+    f->next = bc->files;
+    bc->files = f;
+  }
+  struct stat st;
+  const bool known = stat(path, &st) == 0;
+  bool same = known && f->known;
+  if(same) {
+    same = f->size == (uint64_t)st.st_size &&
+           f->mtime == (uint64_t)st.st_mtime &&
+#ifdef __APPLE__
+           f->mtimens == (uint64_t)st.st_mtimespec.tv_nsec &&
+#else
+           f->mtimens == (uint64_t)st.st_mtim.tv_nsec &&
+#endif
+           f->dev == (uint64_t)st.st_dev && f->ino == (uint64_t)st.st_ino;
+  }
+  if(mode == OOK_RDWR || (f->refs == 0 && !same)) {
+    forget(bc, f);
+    ++f->gen;
+  }
+  f->known = known;
+  if(known) {
+    f->size = (uint64_t)st.st_size;
+    f->mtime = (uint64_t)st.st_mtime;
+#ifdef __APPLE__
+    f->mtimens = (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+    f->mtimens = (uint64_t)st.st_mtim.tv_nsec;
+#endif
+    f->dev = (uint64_t)st.st_dev;
+    f->ino = (uint64_t)st.st_ino;
+  }
+  return f;
+}
+
+static void*
+bc_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  struct bc* bc = (struct bc*) state;
+  if(bc == NULL || fn == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  struct bfd* bf = calloc(1, sizeof(struct bfd));
+  if(bf == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  bf->bc = bc;
+  bf->fd = bc->inner.open(fn, mode, bc->inner.state);
+  if(bf->fd == NULL) {
+    free(bf);
+    return NULL; /* inner open set errno. */
+  }
+  pthread_mutex_lock(&bc->lock);
+  bf->file = getfile(bc, fn, mode);
+  if(bf->file != NULL) { ++bf->file->refs; }
+  pthread_mutex_unlock(&bc->lock);
+  if(bf->file == NULL) {
+    bc->inner.close(bf->fd);
+    free(bf);
+    errno = ENOMEM;
+    return NULL;
+  }
+  return bf;
+}
+
+struct io*
+blockcache_io(struct io inner, size_t blocksize, uint64_t capacity)
+{
+  struct io* io = calloc(1, sizeof(struct io));
+  struct bc* bc = calloc(1, sizeof(struct bc));
+  if(io == NULL || bc == NULL) {
+    free(bc);
+    free(io);
+    errno = ENOMEM;
+    return NULL;
+  }
+  bc->inner = inner;
+  bc->bsize = blocksize == 0 ? DEFAULT_BLOCK : blocksize;
+  capacity = capacity == 0 ? DEFAULT_CAPACITY : capacity;
+  bc->max = capacity / bc->bsize > 0 ? (size_t)(capacity / bc->bsize) : 1;
+  for(bc->nbuckets=1; bc->nbuckets < 2*bc->max; bc->nbuckets *= 2) { ; }
+  bc->bucket = calloc(bc->nbuckets, sizeof(struct block*));
+  if(bc->bucket == NULL) {
+    free(bc);
+    free(io);
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&bc->lock, NULL);
+  io->open = bc_open;
+  io->read = bc_read;
+  io->write = bc_write;
+  io->close = bc_close;
+  io->preallocate = inner.preallocate != NULL ? bc_preallocate : NULL;
+  io->punch = inner.punch != NULL ? bc_punch : NULL;
+  io->hole = inner.hole != NULL ? bc_hole : NULL;
+  io->vread = bc_vread;
+  io->vwrite = inner.vwrite != NULL ? bc_vwrite : NULL;
+  io->state = bc;
+  return io;
+}
+
+void
+blockcache_destroy(struct io* io)
+{
+  if(io == NULL) { return; }
+  struct bc* bc = (struct bc*) io->state;
+  while(bc->mru != NULL) { drop(bc, bc->mru); }
+  for(struct file* f=bc->files; f != NULL; ) {
+    struct file* next = f->next;
+    free(f->path);
+    free(f);
+    f = next;
+  }
+  pthread_mutex_destroy(&bc->lock);
+  free(bc->bucket);
+  free(bc);
+  free(io);
+}
+
+void
+blockcache_stats(const struct io* io, uint64_t* hits, uint64_t* misses)
+{
+  struct bc* bc = (struct bc*) io->state;
+  pthread_mutex_lock(&bc->lock);
+  if(hits != NULL) { *hits = bc->hits; }
+  if(misses != NULL) { *misses = bc->misses; }
+  pthread_mutex_unlock(&bc->lock);
+}
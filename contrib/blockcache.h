@@ -0,0 +1,36 @@
+#ifndef OOKCONTRIB_BLOCKCACHE_IO_H
+#define OOKCONTRIB_BLOCKCACHE_IO_H
+/* BlockCache is an IO interface which wraps another, keeping the most
+ * recently used fixed-size, aligned blocks of the files it reads in memory.
+ * A small read (such as one scanline of a narrow brick) brings in its whole
+ * block, and later reads from the same block are served from memory.  This is
+ * a page cache of our own, for interfaces which bypass the kernel's (DirectIO,
+ * remote stores) or whose reads are expensive.
+ *
+ * Every ookfile opened through the same interface shares one cache, and files
+ * opened by the same path share their blocks, so a tool which makes several
+ * passes over a file, or opens it more than once, reads it only once.
+ * Writes go through to the wrapped interface, and update any cached blocks
+ * they touch.  Cached blocks of a file are dropped when it is opened again
+ * and has changed since (by its size and modification time), or is
+ * created. */
+#include "io-interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** wraps 'inner' with a cache of 'capacity' bytes (0: 256 MiB) in blocks of
+ * 'blocksize' bytes (0: 256 KiB).  Release it with 'blockcache_destroy',
+ * after every file opened through it is closed. */
+struct io* blockcache_io(struct io inner, size_t blocksize, uint64_t capacity);
+void blockcache_destroy(struct io*);
+
+/** how many times a read found its block in the cache, and how many blocks
+ * had to be read from the wrapped interface. */
+void blockcache_stats(const struct io*, uint64_t* hits, uint64_t* misses);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -198,7 +198,8 @@ main(int argc, char* const argv[])
   }
 
   printf("\n");
-  for(size_t brick=0; brick < ookbricks(fin); ++brick) {
+  const size_t nbricks = ookbricks(fin);
+  for(size_t brick=0; brick < nbricks; ++brick) {
     size_t bs[3];
     ookbricksize(fin, brick, bs);
     assert(bs[0] > 0 && bs[1] > 0 && bs[2] > 0);
@@ -206,7 +207,7 @@ main(int argc, char* const argv[])
     ookbrick(fin, brick, data);
     fqn(data, odata, bs[0]*bs[1]*bs[2]);
     ookwrite(fout, brick, odata);
-    printf("\rProcessed brick %5zu / %5zu...", brick, ookbricks(fin));
+    printf("\rProcessed brick %5zu / %5zu...", brick, nbricks);
   }
   printf("\n");
 
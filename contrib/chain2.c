@@ -86,6 +86,10 @@ chain2(struct io first, struct io second)
   chain->write = ch2_write;
   chain->close = ch2_close;
   chain->preallocate = ch2_preallocate;
+  chain->punch = NULL;
+  chain->hole = NULL;
+  chain->vread = NULL;
+  chain->vwrite = NULL;
   struct func* funcs = malloc(sizeof(struct func));
   funcs->f = first;
   funcs->g = second;
@@ -8,8 +8,10 @@
  * something in between 'ookbrick' and 'ookwrite'. */
 #define _POSIX_C_SOURCE 200112L
 #include <assert.h>
+#include <errno.h>
 #include <float.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -32,6 +34,8 @@ static enum OOKTYPE itype = OOK_I8;
 static uint16_t verbose = 0U;
 /* threshold to utilize */
 static double threshold[2] = { -FLT_MAX, FLT_MAX };
+/* threads decoding slices.  1 reads brick by brick, through StackIO. */
+static size_t jobs = 1;
 
 /* allocation that succeeds or dies. */
 static void* xmalloc(const size_t bytes);
@@ -53,6 +57,8 @@ usage(const char* progname)
 "\t-z  ditto, for Z dimension\n"
 "\t-m  minimum value to threshold with [default=%f]\n"
 "\t-M  maximum value to threshold with [default=%f]\n"
+"\t-j  number of threads decoding slices [default=1].  With more than one,\n"
+"\t    a whole slab of slices is decoded at once, then split into bricks.\n"
 "\t-o  output volume to create.  always creates a raw uint8 volume.\n\n"
 "Type names are generally 'i' for integer, 'u' for unsigned integer, "
 "followed by the byte width of the type.  The special types 'f' and 'd' "
@@ -66,7 +72,7 @@ static void
 parseopt(int argc, char* const argv[])
 {
   int opt;
-  while((opt = getopt(argc, argv, "i:o:t:x:y:z:m:M:vh")) != -1) {
+  while((opt = getopt(argc, argv, "i:o:t:x:y:z:m:M:j:vh")) != -1) {
     switch(opt) {
       case 'i':
         if(input != NULL) { free(input); input = NULL; }
@@ -84,6 +90,7 @@ parseopt(int argc, char* const argv[])
       case 'z': vol[2] = (uint64_t)atoll(optarg); break;
       case 'm': threshold[0] = (double)atof(optarg); break;
       case 'M': threshold[1] = (double)atof(optarg); break;
+      case 'j': jobs = (size_t)atoll(optarg); break;
       case 'v':
         verbose++;
         break;
@@ -103,6 +110,133 @@ parseopt(int argc, char* const argv[])
     usage(argv[0]);
     exit(EXIT_FAILURE);
   }
+  if(jobs == 0) {
+    fprintf(stderr, "Need at least one thread.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+/* Parallel ingest.  Worker threads decode whole slices into one of two slabs,
+ * each a brick tall.  While the workers fill the next slab, the main thread
+ * cuts the finished one up into bricks and writes them out. */
+struct ingest {
+  void* stack; /* StackIO descriptor; its reads are thread-safe. */
+  size_t slice; /* bytes in one slice. */
+  size_t nz; /* slices in the volume. */
+  size_t bz; /* slices per slab: the brick depth. */
+  char* slab[2];
+  size_t next; /* next slice to hand out. */
+  size_t done[2]; /* slices decoded into each slab. */
+  size_t emitted; /* slabs written out so far. */
+  int err;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+};
+
+static void*
+decoder(void* arg)
+{
+  struct ingest* in = (struct ingest*) arg;
+  pthread_mutex_lock(&in->lock);
+  for(;;) {
+    /* don't run more than a slab ahead of the writer. */
+    while(in->err == 0 && in->next < in->nz &&
+          in->next / in->bz >= in->emitted + 2) {
+      pthread_cond_wait(&in->changed, &in->lock);
+    }
+    if(in->err != 0 || in->next >= in->nz) { break; }
+    const size_t z = in->next++;
+    pthread_mutex_unlock(&in->lock);
+    char* dst = in->slab[(z / in->bz) % 2] + (z % in->bz) * in->slice;
+    const int err = StackIO.read(in->stack, (off_t)(z * in->slice), in->slice,
+                                 dst);
+    pthread_mutex_lock(&in->lock);
+    if(err != 0 && in->err == 0) { in->err = err; }
+    in->done[(z / in->bz) % 2]++;
+    pthread_cond_broadcast(&in->changed);
+  }
+  pthread_mutex_unlock(&in->lock);
+  return NULL;
+}
+
+/* copies brick 'id' out of the slab that holds its Z range. */
+static void
+cutbrick(const struct ookfile* of, const size_t id, const char* slab,
+         const size_t w, void* data)
+{
+  size_t layout[3], bs[3];
+  ooklayout(of, layout);
+  ookbricksize(of, id, bs);
+  size_t maxbs[3];
+  ookmaxbricksize(of, maxbs);
+  const size_t x0 = (id % layout[0]) * maxbs[0];
+  const size_t y0 = ((id / layout[0]) % layout[1]) * maxbs[1];
+  char* out = (char*)data;
+  for(size_t z=0; z < bs[2]; ++z) {
+    for(size_t y=0; y < bs[1]; ++y) {
+      const size_t src = ((z*vol[1] + y0+y)*vol[0] + x0) * w;
+      memcpy(out, slab + src, bs[0]*w);
+      out += bs[0]*w;
+    }
+  }
+}
+
+static int
+ingest(const struct metadata* md, struct ookfile* fin, struct ookfile* fout,
+       void* data)
+{
+  size_t bsize[3], layout[3];
+  ookmaxbricksize(fin, bsize);
+  ooklayout(fin, layout);
+  const size_t w = md->width * md->components;
+  struct ingest in;
+  memset(&in, 0, sizeof(in));
+  in.slice = vol[0]*vol[1]*w;
+  in.nz = vol[2];
+  in.bz = bsize[2];
+  in.stack = StackIO.open(input, OOK_RDONLY, md);
+  if(in.stack == NULL) { return errno; }
+  in.slab[0] = xmalloc(in.slice*in.bz);
+  in.slab[1] = xmalloc(in.slice*in.bz);
+  pthread_mutex_init(&in.lock, NULL);
+  pthread_cond_init(&in.changed, NULL);
+  pthread_t* threads = xmalloc(sizeof(pthread_t)*jobs);
+  size_t started = 0;
+  for(; started < jobs; ++started) {
+    if(pthread_create(&threads[started], NULL, decoder, &in) != 0) { break; }
+  }
+  if(started == 0) { decoder(&in); } /* no threads?  do it all up front. */
+
+  const size_t perslab = layout[0]*layout[1];
+  for(size_t k=0; k < layout[2]; ++k) {
+    const size_t height = vol[2] - k*in.bz < in.bz ? vol[2] - k*in.bz : in.bz;
+    pthread_mutex_lock(&in.lock);
+    while(in.err == 0 && in.done[k%2] < height) {
+      pthread_cond_wait(&in.changed, &in.lock);
+    }
+    const int err = in.err;
+    pthread_mutex_unlock(&in.lock);
+    if(err != 0) { break; }
+    for(size_t b=k*perslab; b < (k+1)*perslab; ++b) {
+      cutbrick(fin, b, in.slab[k%2], w, data);
+      ookwrite(fout, b, data);
+      printf("\rProcessed brick %5zu / %5zu...", b, ookbricks(fin));
+      fflush(stdout);
+    }
+    pthread_mutex_lock(&in.lock);
+    in.done[k%2] = 0;
+    in.emitted++;
+    pthread_cond_broadcast(&in.changed);
+    pthread_mutex_unlock(&in.lock);
+  }
+  for(size_t i=0; i < started; ++i) { pthread_join(threads[i], NULL); }
+  free(threads);
+  pthread_cond_destroy(&in.changed);
+  pthread_mutex_destroy(&in.lock);
+  free(in.slab[0]);
+  free(in.slab[1]);
+  StackIO.close(in.stack);
+  return in.err;
 }
 
 int
@@ -114,9 +248,26 @@ main(int argc, char* const argv[])
     fprintf(stderr, "Initialization failed.\n");
     exit(EXIT_FAILURE);
   }
-  const uint64_t bricksize[3] = { 64, 64, 64 };
+  size_t bricksize[3];
+  if(ookautobricksize(vol, itype, 1, NULL, bricksize) != 0) {
+    fprintf(stderr, "Invalid volume dimensions.\n");
+    exit(EXIT_FAILURE);
+  }
 
-  struct ookfile* fin = ookread(StackIO, input, vol, bricksize, itype, 1);
+  struct metadata md;
+  memset(&md, 0, sizeof(md));
+  memcpy(md.voxels, vol, sizeof(uint64_t)*3);
+  md.components = 1;
+  md.width = bytewidth(itype);
+  /* a brick reads from all of its slices; keep them all open. */
+  const size_t keep = jobs*2 > bricksize[2] ? jobs*2 : bricksize[2];
+  md.maxopen = keep > 64 ? keep : 0;
+  md.prefetch = jobs == 1 ? 2 : 0;
+  /* brick by brick, a slab of bricks reads every row of its slices. */
+  md.whole = jobs == 1;
+  struct io stack = StackIO;
+  stack.state = &md;
+  struct ookfile* fin = ookread(stack, input, vol, bricksize, itype, 1);
   if(!fin) { perror("open"); exit(EXIT_FAILURE); }
 
   size_t bsize[3];
@@ -140,14 +291,19 @@ main(int argc, char* const argv[])
   }
 
   printf("\n");
-  for(size_t brick=0; brick < ookbricks(fin); ++brick) {
+  const size_t nbricks = ookbricks(fin);
+  if(jobs > 1) {
+    const int err = ingest(&md, fin, fout, data);
+    if(err != 0) { fprintf(stderr, "\rFailed read: %s\n", strerror(err)); }
+  }
+  for(size_t brick=0; jobs == 1 && brick < nbricks; ++brick) {
     size_t bs[3];
     ookbricksize(fin, brick, bs);
     if(ookbrick(fin, brick, data) != 0) {
       fprintf(stderr, "\rFailed read.\n"); break;
     }
     ookwrite(fout, brick, data);
-    printf("\rProcessed brick %5zu / %5zu...", brick, ookbricks(fin));
+    printf("\rProcessed brick %5zu / %5zu...", brick, nbricks);
     fflush(stdout);
   }
   printf("\n");
@@ -207,8 +363,8 @@ bytewidth(const enum OOKTYPE basictype)
     case OOK_I16: case OOK_U16: return 2;
     case OOK_I32: case OOK_U32: return 4;
     case OOK_I64: case OOK_U64: return 8;
-    case OOK_FLOAT: return 32;
-    case OOK_DOUBLE: return 32;
+    case OOK_FLOAT: return 4;
+    case OOK_DOUBLE: return 8;
   }
   assert(false);
   return 0;
@@ -0,0 +1,387 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "fanout.h"
+
+/* with FANOUT_FASTEST, one read in this many goes to another replica, so
+ * that we notice when it has become faster. */
+#define PROBE_INTERVAL 32
+/* with FANOUT_STRIPE, a single read is only split if each replica would
+ * get at least this much of it. */
+#define STRIPE_MIN 65536
+
+struct cfg {
+  struct io* replicas;
+  const char* const* files; /* NULL: all use the name given to open. */
+  size_t n;
+  enum FANOUT_READ policy;
+};
+
+struct replica {
+  struct io io;
+  void* fd; /* NULL if it failed to open. */
+  bool healthy;
+  double nspb; /* recent nanoseconds per byte read; 0 if unknown. */
+};
+
+struct fan {
+  struct replica* r;
+  size_t n;
+  enum FANOUT_READ policy;
+  uint64_t reads;
+  pthread_mutex_t lock; /* protects 'healthy', 'nspb' and 'reads'. */
+};
+
+/* the part of a request one replica will do. */
+struct task {
+  const struct replica* r;
+  bool writing;
+  const struct ookiov* iov;
+  size_t n;
+  int err;
+  uint64_t ns;
+};
+
+static uint64_t
+clocknow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+/* does a whole list of pieces on one replica, vectored if it can. */
+static int
+rvio(const struct replica* r, const struct ookiov* iov, size_t n, bool writing)
+{
+  if(writing && r->io.vwrite != NULL) { return r->io.vwrite(r->fd, iov, n); }
+  if(!writing && r->io.vread != NULL) { return r->io.vread(r->fd, iov, n); }
+  for(size_t i=0; i < n; ++i) {
+    const int err = writing ?
+      r->io.write(r->fd, iov[i].offset, iov[i].len, iov[i].buf) :
+      r->io.read(r->fd, iov[i].offset, iov[i].len, iov[i].buf);
+    if(err != 0) { return err; }
+  }
+  return 0;
+}
+
+static void*
+runtask(void* arg)
+{
+  struct task* t = (struct task*) arg;
+  const uint64_t start = clocknow();
+  t->err = rvio(t->r, t->iov, t->n, t->writing);
+  t->ns = clocknow() - start;
+  return NULL;
+}
+
+/* runs every task at once: one thread each, except for the last task, which
+ * the calling thread does itself. */
+static void
+runall(struct task* t, const size_t n)
+{
+  pthread_t* threads = calloc(n, sizeof(pthread_t));
+  bool* started = calloc(n, sizeof(bool));
+  for(size_t i=0; i+1 < n; ++i) {
+    /* if we can't get a thread, just do the work ourselves. */
+    if(threads != NULL && started != NULL) {
+      started[i] = pthread_create(&threads[i], NULL, runtask, &t[i]) == 0;
+    }
+    if(started == NULL || !started[i]) { runtask(&t[i]); }
+  }
+  if(n > 0) { runtask(&t[n-1]); }
+  for(size_t i=0; started != NULL && i < n; ++i) {
+    if(started[i]) { pthread_join(threads[i], NULL); }
+  }
+  free(started);
+  free(threads);
+}
+
+static uint64_t
+iovbytes(const struct ookiov* iov, const size_t n)
+{
+  uint64_t bytes = 0;
+  for(size_t i=0; i < n; ++i) { bytes += iov[i].len; }
+  return bytes;
+}
+
+/* records how an operation on replica 'i' went. */
+static void
+note(struct fan* f, const size_t i, const int err, const uint64_t ns,
+     const uint64_t bytes, const bool writing)
+{
+  pthread_mutex_lock(&f->lock);
+  if(err != 0) {
+    f->r[i].healthy = false;
+  } else if(!writing && bytes > 0) {
+    const double s = (double)ns / bytes;
+    f->r[i].nspb = f->r[i].nspb == 0.0 ? s : 0.75*f->r[i].nspb + 0.25*s;
+  }
+  pthread_mutex_unlock(&f->lock);
+}
+
+/* @return the replica a read should go to, or SIZE_MAX if none are healthy.
+ * Replicas we know nothing about yet count as the fastest, so that each gets
+ * measured. */
+static size_t
+pick(struct fan* f)
+{
+  size_t best = SIZE_MAX;
+  pthread_mutex_lock(&f->lock);
+  const uint64_t nth = f->reads++;
+  for(size_t i=0; i < f->n; ++i) {
+    if(!f->r[i].healthy) { continue; }
+    if(best == SIZE_MAX) { best = i; }
+    if(f->policy != FANOUT_FASTEST) { break; }
+    if(f->r[i].nspb < f->r[best].nspb) { best = i; }
+  }
+  if(f->policy == FANOUT_FASTEST && best != SIZE_MAX &&
+     nth % PROBE_INTERVAL == PROBE_INTERVAL-1) {
+    /* try the next healthy replica after the best, for a change. */
+    for(size_t j=1; j < f->n; ++j) {
+      const size_t i = (best + j) % f->n;
+      if(f->r[i].healthy) { best = i; break; }
+    }
+  }
+  pthread_mutex_unlock(&f->lock);
+  return best;
+}
+
+/* reads from one replica, moving on to the next if it fails. */
+static int
+readany(struct fan* f, const struct ookiov* iov, const size_t n)
+{
+  int err = EIO;
+  for(size_t i=pick(f); i != SIZE_MAX; i=pick(f)) {
+    const uint64_t start = clocknow();
+    err = rvio(&f->r[i], iov, n, false);
+    note(f, i, err, clocknow() - start, iovbytes(iov, n), false);
+    if(err == 0) { return 0; }
+  }
+  return err;
+}
+
+/* deals the pieces out to the healthy replicas round-robin, and reads them
+ * all at once.  Any replica's share which fails is read again elsewhere. */
+static int
+readstripe(struct fan* f, const struct ookiov* iov, const size_t n)
+{
+  size_t* healthy = malloc(sizeof(size_t)*f->n);
+  if(healthy == NULL) { return readany(f, iov, n); }
+  size_t nh = 0;
+  pthread_mutex_lock(&f->lock);
+  for(size_t i=0; i < f->n; ++i) {
+    if(f->r[i].healthy) { healthy[nh++] = i; }
+  }
+  pthread_mutex_unlock(&f->lock);
+  if(nh > n) { nh = n; }
+  if(nh <= 1) { free(healthy); return readany(f, iov, n); }
+
+  struct ookiov* dealt = malloc(sizeof(struct ookiov)*n);
+  struct task* t = calloc(nh, sizeof(struct task));
+  if(dealt == NULL || t == NULL) {
+    free(dealt); free(t); free(healthy);
+    return readany(f, iov, n);
+  }
+  /* replica k gets pieces k, k+nh, k+2nh, ...; lay them out contiguously. */
+  size_t at = 0;
+  for(size_t k=0; k < nh; ++k) {
+    t[k].r = &f->r[healthy[k]];
+    t[k].iov = &dealt[at];
+    for(size_t i=k; i < n; i += nh) { dealt[at++] = iov[i]; }
+    t[k].n = (size_t)(&dealt[at] - t[k].iov);
+  }
+  runall(t, nh);
+  int err = 0;
+  for(size_t k=0; k < nh; ++k) {
+    note(f, healthy[k], t[k].err, t[k].ns, iovbytes(t[k].iov, t[k].n), false);
+    if(t[k].err != 0) {
+      const int e = readany(f, t[k].iov, t[k].n);
+      if(err == 0) { err = e; }
+    }
+  }
+  free(t);
+  free(dealt);
+  free(healthy);
+  return err;
+}
+
+static int
+fan_vread(void* fd, const struct ookiov* iov, const size_t n)
+{
+  struct fan* f = (struct fan*) fd;
+  if(f->policy == FANOUT_STRIPE) { return readstripe(f, iov, n); }
+  return readany(f, iov, n);
+}
+
+static int
+fan_read(void* fd, const off_t offset, const size_t len, void* buf)
+{
+  struct fan* f = (struct fan*) fd;
+  if(f->policy != FANOUT_STRIPE || len < 2*STRIPE_MIN) {
+    const struct ookiov iov = { offset, len, buf };
+    return readany(f, &iov, 1);
+  }
+  /* one big read: cut it up so that every replica can help. */
+  size_t pieces = f->n < len / STRIPE_MIN ? f->n : len / STRIPE_MIN;
+  struct ookiov* iov = malloc(sizeof(struct ookiov)*pieces);
+  if(iov == NULL) {
+    const struct ookiov one = { offset, len, buf };
+    return readany(f, &one, 1);
+  }
+  const size_t each = len / pieces;
+  for(size_t i=0; i < pieces; ++i) {
+    iov[i].offset = offset + (off_t)(i*each);
+    iov[i].len = i+1 < pieces ? each : len - i*each;
+    iov[i].buf = (char*)buf + i*each;
+  }
+  const int err = readstripe(f, iov, pieces);
+  free(iov);
+  return err;
+}
+
+/* every replica gets every write, all at the same time. */
+static int
+fan_vwrite(void* fd, const struct ookiov* iov, const size_t n)
+{
+  struct fan* f = (struct fan*) fd;
+  struct task* t = calloc(f->n, sizeof(struct task));
+  if(t == NULL) { return ENOMEM; }
+  for(size_t i=0; i < f->n; ++i) {
+    t[i].r = &f->r[i];
+    t[i].writing = true;
+    t[i].iov = iov;
+    t[i].n = n;
+  }
+  runall(t, f->n);
+  int err = 0;
+  for(size_t i=0; i < f->n; ++i) {
+    note(f, i, t[i].err, t[i].ns, 0, true);
+    if(err == 0) { err = t[i].err; }
+  }
+  free(t);
+  return err;
+}
+
+static int
+fan_write(void* fd, const off_t offset, const size_t len, const void* buf)
+{
+  const struct ookiov iov = { offset, len, (void*)buf };
+  return fan_vwrite(fd, &iov, 1);
+}
+
+static int
+fan_close(void* fd)
+{
+  struct fan* f = (struct fan*) fd;
+  int err = 0;
+  for(size_t i=0; i < f->n; ++i) {
+    if(f->r[i].fd == NULL) { continue; }
+    const int e = f->r[i].io.close(f->r[i].fd);
+    if(err == 0) { err = e; }
+  }
+  pthread_mutex_destroy(&f->lock);
+  free(f->r);
+  free(f);
+  return err;
+}
+
+static void
+fan_preallocate(void* fd, off_t len)
+{
+  const struct fan* f = (const struct fan*) fd;
+  for(size_t i=0; i < f->n; ++i) {
+    if(f->r[i].io.preallocate != NULL) {
+      f->r[i].io.preallocate(f->r[i].fd, len);
+    }
+  }
+}
+
+/* a reader can do without replicas that won't open; a writer can't. */
+static void*
+fan_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  const struct cfg* cfg = (const struct cfg*) state;
+  if(cfg == NULL || cfg->n == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  struct fan* f = calloc(1, sizeof(struct fan));
+  if(f != NULL) { f->r = calloc(cfg->n, sizeof(struct replica)); }
+  if(f == NULL || f->r == NULL) {
+    if(f) { free(f); }
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&f->lock, NULL);
+  f->n = cfg->n;
+  f->policy = cfg->policy;
+  size_t opened = 0;
+  int err = 0;
+  for(size_t i=0; i < f->n; ++i) {
+    f->r[i].io = cfg->replicas[i];
+    const char* name = cfg->files != NULL ? cfg->files[i] : fn;
+    f->r[i].fd = f->r[i].io.open(name, mode, f->r[i].io.state);
+    f->r[i].healthy = f->r[i].fd != NULL;
+    if(f->r[i].fd != NULL) { ++opened; continue; }
+    if(err == 0) { err = errno == 0 ? EINVAL : errno; }
+  }
+  if(opened == 0 || (mode != OOK_RDONLY && opened < f->n)) {
+    fan_close(f);
+    errno = err;
+    return NULL;
+  }
+  return f;
+}
+
+struct io*
+fanout(const struct io* replicas, const char* const* files, size_t n,
+       enum FANOUT_READ policy)
+{
+  if(replicas == NULL || n == 0) { errno = EINVAL; return NULL; }
+  struct io* io = calloc(1, sizeof(struct io));
+  struct cfg* cfg = calloc(1, sizeof(struct cfg));
+  if(io != NULL && cfg != NULL) {
+    cfg->replicas = malloc(sizeof(struct io)*n);
+    if(files != NULL) { cfg->files = malloc(sizeof(const char*)*n); }
+  }
+  if(io == NULL || cfg == NULL || cfg->replicas == NULL ||
+     (files != NULL && cfg->files == NULL)) {
+    if(cfg != NULL) { free(cfg->replicas); free((void*)cfg->files); }
+    free(cfg);
+    free(io);
+    errno = ENOMEM;
+    return NULL;
+  }
+  memcpy(cfg->replicas, replicas, sizeof(struct io)*n);
+  if(files != NULL) { memcpy((void*)cfg->files, files, sizeof(char*)*n); }
+  cfg->n = n;
+  cfg->policy = policy;
+  io->open = fan_open;
+  io->read = fan_read;
+  io->write = fan_write;
+  io->close = fan_close;
+  io->preallocate = fan_preallocate;
+  io->punch = NULL;
+  io->hole = NULL;
+  io->vread = fan_vread;
+  io->vwrite = fan_vwrite;
+  io->state = cfg;
+  return io;
+}
+
+void
+fanout_destroy(struct io* io)
+{
+  if(io == NULL) { return; }
+  struct cfg* cfg = (struct cfg*) io->state;
+  if(cfg != NULL) { free(cfg->replicas); free((void*)cfg->files); }
+  free(cfg);
+  free(io);
+}
@@ -0,0 +1,32 @@
+#ifndef OOKCONTRIB_FANOUT_IO_H
+#define OOKCONTRIB_FANOUT_IO_H
+/* Fanout is an IO interface over several replicas of the same data, each
+ * behind an IO interface of its own.  Every write goes to all the replicas at
+ * once, and completes when they all have.  Reads are served according to a
+ * policy; a replica which fails is marked unhealthy and not read from again,
+ * and the read is retried on another. */
+#include "io-interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum FANOUT_READ {
+  FANOUT_FIRST,   /* the first healthy replica, in the order given. */
+  FANOUT_FASTEST, /* the one with the best recent throughput. */
+  FANOUT_STRIPE   /* spread each request across all healthy replicas. */
+};
+
+/** create an interface which replicates over the 'n' given interfaces.  Each
+ * keeps its own 'state'.  Replica i opens 'files[i]'; the strings must
+ * outlive the interface.  If 'files' is NULL, every replica is given the
+ * filename passed to open, for interfaces whose state says where the data
+ * are.  Release it with 'fanout_destroy'. */
+struct io* fanout(const struct io* replicas, const char* const* files,
+                  size_t n, enum FANOUT_READ);
+void fanout_destroy(struct io*);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -1,5 +1,7 @@
+#define _POSIX_C_SOURCE 200112L
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,10 +9,24 @@
 #include "io-interface.h"
 #include "imgio.h"
 
+/* one open image.  The region is created once and reused; 'have' is the
+ * part of the image it currently holds, so that the many scanline reads
+ * which fall within the same rows don't prepare it again. */
+struct img {
+  IMAGE* img;
+  REGION* reg;
+  VipsRect have;
+  bool whole; /* prepare the whole image on the first read. */
+  size_t pel; /* bytes per pixel */
+  size_t rowbytes;
+  pthread_mutex_t lock; /* regions may only be used by one thread at once. */
+};
+
 static int img_close(void*);
 
 static void*
-img_open(const char* fn, const enum OOKMODE mode, const void* state)
+img_openimpl(const char* fn, const enum OOKMODE mode, const void* state,
+             const bool whole)
 {
   if(state == NULL) {
     errno = EINVAL;
@@ -19,47 +35,154 @@ img_open(const char* fn, const enum OOKMODE mode, const void* state)
   const uint64_t* voxels = (const uint64_t*)state;
   const char* access = "rd";
   if(mode == OOK_RDWR) { access = "w"; }
-  IMAGE* img = im_open(fn, access);
-  if(NULL == img) {
+  struct img* im = calloc(1, sizeof(struct img));
+  if(im == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  pthread_mutex_init(&im->lock, NULL);
+  im->whole = whole;
+  im->img = im_open(fn, access);
+  if(NULL == im->img) {
+    img_close(im);
     errno = EINVAL;
     return NULL;
   }
-  if(voxels[0] != (uint64_t)img->Xsize ||
-     voxels[1] != (uint64_t)img->Ysize) {
-    img_close(img);
+  if(voxels[0] != (uint64_t)im->img->Xsize ||
+     voxels[1] != (uint64_t)im->img->Ysize) {
+    img_close(im);
     errno = EINVAL;
     return NULL;
   }
-  return img;
+  im->pel = VIPS_IMAGE_SIZEOF_PEL(im->img);
+  im->rowbytes = im->pel * im->img->Xsize;
+  return im;
+}
+
+static void*
+img_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  return img_openimpl(fn, mode, state, false);
 }
 
+static void*
+img_open_slice(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  return img_openimpl(fn, mode, state, true);
+}
+
+static bool
+contains(const VipsRect* outer, const VipsRect* inner)
+{
+  return outer->width > 0 && outer->height > 0 &&
+         inner->left >= outer->left && inner->top >= outer->top &&
+         inner->left + inner->width <= outer->left + outer->width &&
+         inner->top + inner->height <= outer->top + outer->height;
+}
+
+/* the offset is in bytes into the (row-major) image.  A read may cover part
+ * of one row, or run on over several. */
 static int
 img_read(void* fd, const off_t offset, const size_t len, void* buf)
 {
-  IMAGE* img = (IMAGE*)fd;
-  REGION* reg = vips_region_new(img);
-  if(NULL == reg) {
-    return ENOMEM;
-  }
+  struct img* im = (struct img*)fd;
+  if(len == 0) { return 0; }
+  const size_t width = im->img->Xsize;
+  const size_t y = offset / im->rowbytes;
+  const size_t xbytes = offset % im->rowbytes;
+  const size_t ylast = (offset + len - 1) / im->rowbytes;
+  if(ylast >= (size_t)im->img->Ysize) { return EINVAL; }
 
-  const size_t width = img->Xsize;
-  const size_t height = img->Ysize;
-  const size_t y = offset / width;
-  const size_t x = offset - y*width;
+  /* just the pixels we were asked for: part of a row, or whole rows. */
+  VipsRect want = { .left = 0, .top = y, .width = width,
+                    .height = ylast - y + 1 };
+  if(y == ylast) {
+    want.left = xbytes / im->pel;
+    want.width = (xbytes + len + im->pel-1) / im->pel - want.left;
+  }
+  if(im->whole) {
+    want.left = 0; want.top = 0;
+    want.width = width; want.height = im->img->Ysize;
+  }
 
-  VipsRect r = { .left = x, .top = y, .width = width, .height = height };
-  vips_region_prepare(reg, &r);
-  memcpy(buf, VIPS_REGION_ADDR(reg, x,y), len);
-  g_object_unref(reg);
-  return 0;
+  int err = 0;
+  pthread_mutex_lock(&im->lock);
+  if(im->reg == NULL) {
+    im->reg = vips_region_new(im->img);
+    if(im->reg == NULL) { err = ENOMEM; }
+  }
+  if(err == 0 && !contains(&im->have, &want)) {
+    if(vips_region_prepare(im->reg, &want) != 0) {
+      memset(&im->have, 0, sizeof(VipsRect));
+      err = EIO;
+    } else {
+      im->have = want;
+    }
+  }
+  /* copy out row by row; the region's rows need not be contiguous.  The
+   * first row starts 'skip' bytes in, which need not be a whole pixel; only
+   * pixels inside the region may be addressed. */
+  char* out = (char*)buf;
+  size_t left = len;
+  size_t skip = xbytes;
+  for(size_t row=y; err == 0 && left > 0; ++row) {
+    const size_t n = im->rowbytes - skip < left ? im->rowbytes - skip : left;
+    const char* src = (const char*)VIPS_REGION_ADDR(im->reg,
+                                                    (int)(skip / im->pel),
+                                                    (int)row) +
+                      skip % im->pel;
+    memcpy(out, src, n);
+    out += n;
+    left -= n;
+    skip = 0;
+  }
+  pthread_mutex_unlock(&im->lock);
+  return err;
 }
 
 static int
 img_close(void* fd)
 {
-  IMAGE* img = (IMAGE*)fd;
-  vips_image_invalidate_all(img);
-  return im_close(img);
+  struct img* im = (struct img*)fd;
+  int err = 0;
+  if(im->reg != NULL) { g_object_unref(im->reg); }
+  if(im->img != NULL) {
+    vips_image_invalidate_all(im->img);
+    err = im_close(im->img);
+  }
+  pthread_mutex_destroy(&im->lock);
+  free(im);
+  return err;
+}
+
+/* integers are taken as unsigned, since a width alone can't tell. */
+static int
+bandformat(const size_t width, const bool floating, VipsBandFormat* fmt)
+{
+  switch(width) {
+    case 1: *fmt = VIPS_FORMAT_UCHAR; return 0;
+    case 2: *fmt = VIPS_FORMAT_USHORT; return 0;
+    case 4: *fmt = floating ? VIPS_FORMAT_FLOAT : VIPS_FORMAT_UINT; return 0;
+    case 8: if(floating) { *fmt = VIPS_FORMAT_DOUBLE; return 0; } break;
+  }
+  return EINVAL;
+}
+
+int
+img_save(const char* fn, void* data, const uint64_t w, const uint64_t h,
+         const size_t components, const size_t width, const bool floating)
+{
+  VipsBandFormat fmt;
+  if(bandformat(width, floating, &fmt) != 0) { return EINVAL; }
+  IMAGE* in = im_image(data, (int)w, (int)h, (int)components, fmt);
+  if(in == NULL) { return ENOMEM; }
+  int err = 0;
+  IMAGE* out = im_open(fn, "w");
+  if(out == NULL) { err = EIO; }
+  if(err == 0 && im_copy(in, out) != 0) { err = EIO; }
+  if(out != NULL && im_close(out) != 0 && err == 0) { err = EIO; }
+  im_close(in);
+  return err;
 }
 
 struct io ImageIO = {
@@ -70,3 +193,12 @@ struct io ImageIO = {
   .preallocate = NULL,
   .state = NULL
 };
+
+struct io ImageIO_slice = {
+  .open = img_open_slice,
+  .read = img_read,
+  .write = NULL,
+  .close = img_close,
+  .preallocate = NULL,
+  .state = NULL
+};
@@ -2,6 +2,7 @@
 #define OOKCONTRIB_IMAGE_H
 /* ImageIO is an io-interface which pretends an image is a volume. */
 
+#include <stdbool.h>
 #include "io-interface.h"
 
 #ifdef __cplusplus
@@ -15,6 +16,17 @@ extern "C" {
  *   iio.state = voxels;
  *   struct ookfile* of = ookread(iio, "file", voxels, ...); */
 extern struct io ImageIO;
+/* the same, but the whole image is decoded on the first read and every later
+ * read is served from memory.  Best when all of an image will be read, as
+ * when bricking a stack of slices; costs one decoded image of memory. */
+extern struct io ImageIO_slice;
+
+/* encodes the 'w' x 'h' image in 'data' into 'fn'; the file's suffix picks
+ * the format.  Each pixel is 'components' values of 'width' bytes.  Integers
+ * are written as unsigned; set 'floating' for float and double data.
+ * @returns 0 on success, an error code on error. */
+int img_save(const char* fn, void* data, uint64_t w, uint64_t h,
+             size_t components, size_t width, bool floating);
 
 #ifdef __cplusplus
 }
@@ -146,7 +146,11 @@ main(int argc, char* const argv[])
     fprintf(stderr, "Initialization failed.\n");
     exit(EXIT_FAILURE);
   }
-  const uint64_t bricksize[3] = { 64, 64, 64 };
+  size_t bricksize[3];
+  if(ookautobricksize(vol, itype, 1, NULL, bricksize) != 0) {
+    fprintf(stderr, "Invalid volume dimensions.\n");
+    exit(EXIT_FAILURE);
+  }
   struct io* chained = chain2(DebugIO, StdCIO);
 
   struct ookfile* fin = ookread(StdCIO, input, vol, bricksize, itype, 1);
@@ -175,14 +179,15 @@ main(int argc, char* const argv[])
   printf("\n");
   minmax[0] = FLT_MAX;
   minmax[1] = -FLT_MAX;
-  for(size_t brick=0; brick < ookbricks(fin); ++brick) {
+  const size_t nbricks = ookbricks(fin);
+  for(size_t brick=0; brick < nbricks; ++brick) {
     size_t bs[3];
     ookbricksize(fin, brick, bs);
     assert(bs[0] > 0 && bs[1] > 0 && bs[2] > 0);
     ookbrick(fin, brick, data);
     fqn(data, minmax, bs[0]*bs[1]*bs[2]);
     printf("\rProcessed brick %5zu / %5zu... [%lf--%lf]", brick,
-           ookbricks(fin), minmax[0], minmax[1]);
+           nbricks, minmax[0], minmax[1]);
   }
   printf("\n");
   printf("Data range: %lf--%lf\n", minmax[0], minmax[1]);
@@ -0,0 +1,590 @@
+/* ookd: a brick server.  Clients (see OokdIO) connect over a Unix domain
+ * socket and have the server do their I/O.  Files are opened once, no matter
+ * how many clients use them, and reads are sent straight from the page cache
+ * with sendfile(2).  Optionally, the server keeps recently read ranges in a
+ * cache of its own, so that every client on the machine shares one warm copy
+ * of the hot bricks.  Usage:
+ *    ./ookd -s /tmp/ookd.sock -c 1024
+ * serves on '/tmp/ookd.sock' with a 1 GiB cache. */
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+#include "io-interface.h"
+#include "ookd.h"
+
+/* socket to listen on. */
+static const char* sockpath = OOKD_SOCKET;
+/* bytes of data the range cache may hold.  0 disables it. */
+static size_t capacity = 0;
+/* verbosity of output.  0 (the default) is terse. */
+static uint16_t verbose = 0U;
+/* set by the signal handler when we should shut down. */
+static volatile sig_atomic_t quit = 0;
+
+static void
+usage(const char* progname)
+{
+  printf(
+"Usage: %s [-s socket] [-c MiB] [-v]\n\n"
+"\t-s  path of the socket to serve on.  default: " OOKD_SOCKET "\n"
+"\t-c  size of the range cache, in MiB.  default: 0 (disabled).\n"
+"\t-v  print a line for every client.\n"
+"Without a cache, reads are served from the OS' page cache with zero "
+"copies.  With one, hot ranges are kept in the server's memory.\n",
+  progname);
+}
+
+/* ---- open files, shared between clients. ---- */
+
+struct file {
+  char* path;
+  int fd;
+  bool writable;
+  dev_t dev;
+  ino_t ino;
+  size_t refs;
+  uint64_t gen; /* bumped by every write; guarded by 'cachelock'. */
+  struct file* next;
+};
+static struct file* files = NULL;
+static pthread_mutex_t fileslock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cache_drop(dev_t dev, ino_t ino, uint64_t offset, uint64_t len);
+
+/* finds or opens 'path'.  Readers happily share a writer's descriptor.  A
+ * client creating a file needs it to itself: truncating it under another's
+ * feet would pull the data out from under their reads. */
+static struct file*
+acquire(const char* path, enum OOKMODE mode, int* err)
+{
+  const bool writing = mode != OOK_RDONLY;
+  pthread_mutex_lock(&fileslock);
+  struct file* f;
+  for(f=files; f != NULL; f=f->next) {
+    if(strcmp(f->path, path) != 0) { continue; }
+    if(mode == OOK_RDWR) {
+      *err = EBUSY;
+      pthread_mutex_unlock(&fileslock);
+      return NULL;
+    }
+    if(f->writable || !writing) { break; }
+  }
+  if(f != NULL) {
+    f->refs++;
+    *err = 0;
+    pthread_mutex_unlock(&fileslock);
+    return f;
+  }
+  int flags = O_RDONLY;
+  if(mode == OOK_RDWR) { flags = O_RDWR | O_CREAT | O_TRUNC; }
+  if(mode == OOK_UPDATE) { flags = O_RDWR; }
+  f = calloc(1, sizeof(struct file));
+  if(f == NULL) { *err = ENOMEM; goto done; }
+  f->path = malloc(strlen(path)+1);
+  if(f->path == NULL) { *err = ENOMEM; goto done; }
+  strcpy(f->path, path);
+  f->fd = open(path, flags, 0666);
+  struct stat st;
+  if(f->fd == -1 || fstat(f->fd, &st) != 0) { *err = errno; goto done; }
+  f->writable = writing;
+  f->dev = st.st_dev;
+  f->ino = st.st_ino;
+  f->refs = 1;
+  f->next = files;
+  files = f;
+  /* it may have changed since we last had it open. */
+  cache_drop(f->dev, f->ino, 0, UINT64_MAX);
+  *err = 0;
+done:
+  if(*err != 0 && f != NULL) {
+    if(f->path != NULL && f->fd != -1) { close(f->fd); }
+    free(f->path);
+    free(f);
+    f = NULL;
+  }
+  pthread_mutex_unlock(&fileslock);
+  return f;
+}
+
+static void
+release(struct file* f)
+{
+  pthread_mutex_lock(&fileslock);
+  if(--f->refs == 0) {
+    struct file** p = &files;
+    while(*p != f) { p = &(*p)->next; }
+    *p = f->next;
+    close(f->fd);
+    free(f->path);
+    free(f);
+  }
+  pthread_mutex_unlock(&fileslock);
+}
+
+/* ---- the range cache: LRU, with entries pinned while they are sent. ---- */
+
+struct entry {
+  dev_t dev;
+  ino_t ino;
+  uint64_t offset;
+  uint64_t len;
+  char* data;
+  size_t pins; /* clients currently sending this entry. */
+  bool dead; /* evicted; free it when the last pin goes. */
+  struct entry* prev; /* LRU list; head is most recent. */
+  struct entry* next;
+  struct entry* chain; /* hash bucket. */
+};
+
+#define NBUCKETS 4096
+static struct entry* buckets[NBUCKETS] = {NULL};
+static struct entry* lruhead = NULL;
+static struct entry* lrutail = NULL;
+static size_t used = 0;
+static pthread_mutex_t cachelock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t
+bucket(dev_t dev, ino_t ino, uint64_t offset)
+{
+  uint64_t h = (uint64_t)dev * UINT64_C(0x9e3779b97f4a7c15);
+  h ^= (uint64_t)ino + (h << 6) + (h >> 2);
+  h ^= offset + (h << 6) + (h >> 2);
+  return (size_t)(h % NBUCKETS);
+}
+
+/* unhooks an entry from the table and LRU list; the caller holds the lock. */
+static void
+unlink_entry(struct entry* e)
+{
+  struct entry** p = &buckets[bucket(e->dev, e->ino, e->offset)];
+  while(*p != e) { p = &(*p)->chain; }
+  *p = e->chain;
+  if(e->prev) { e->prev->next = e->next; } else { lruhead = e->next; }
+  if(e->next) { e->next->prev = e->prev; } else { lrutail = e->prev; }
+  used -= e->len;
+  e->dead = true;
+  if(e->pins == 0) {
+    free(e->data);
+    free(e);
+  }
+}
+
+/* the caller holds the lock. */
+static void
+drop(dev_t dev, ino_t ino, uint64_t offset, uint64_t len)
+{
+  const uint64_t end = len > UINT64_MAX - offset ? UINT64_MAX : offset+len;
+  for(struct entry* e=lruhead; e != NULL; ) {
+    struct entry* next = e->next;
+    if(e->dev == dev && e->ino == ino &&
+       e->offset < end && offset < e->offset + e->len) {
+      unlink_entry(e);
+    }
+    e = next;
+  }
+}
+
+static void
+cache_drop(dev_t dev, ino_t ino, uint64_t offset, uint64_t len)
+{
+  if(capacity == 0) { return; }
+  pthread_mutex_lock(&cachelock);
+  drop(dev, ino, offset, len);
+  pthread_mutex_unlock(&cachelock);
+}
+
+/* forgets a range which was just written.  The file may be open more than
+ * once (a reader's descriptor and a writer's), so every one of them gets
+ * the new generation: reads in flight on any of them then know that what
+ * they read may be stale. */
+static void
+cache_written(const struct file* f, uint64_t offset, uint64_t len)
+{
+  if(capacity == 0) { return; }
+  pthread_mutex_lock(&fileslock);
+  pthread_mutex_lock(&cachelock);
+  for(struct file* g=files; g != NULL; g=g->next) {
+    if(g->dev == f->dev && g->ino == f->ino) { g->gen++; }
+  }
+  drop(f->dev, f->ino, offset, len);
+  pthread_mutex_unlock(&cachelock);
+  pthread_mutex_unlock(&fileslock);
+}
+
+/* @return the file's current generation; snapshot it before reading. */
+static uint64_t
+cache_gen(const struct file* f)
+{
+  pthread_mutex_lock(&cachelock);
+  const uint64_t gen = f->gen;
+  pthread_mutex_unlock(&cachelock);
+  return gen;
+}
+
+/* @return the pinned entry for exactly this range, or NULL. */
+static struct entry*
+cache_get(const struct file* f, uint64_t offset, uint64_t len)
+{
+  if(capacity == 0) { return NULL; }
+  pthread_mutex_lock(&cachelock);
+  struct entry* e = buckets[bucket(f->dev, f->ino, offset)];
+  while(e != NULL && !(e->dev == f->dev && e->ino == f->ino &&
+                       e->offset == offset && e->len == len)) {
+    e = e->chain;
+  }
+  if(e != NULL) {
+    e->pins++;
+    /* move to the front. */
+    if(e != lruhead) {
+      e->prev->next = e->next;
+      if(e->next) { e->next->prev = e->prev; } else { lrutail = e->prev; }
+      e->prev = NULL;
+      e->next = lruhead;
+      lruhead->prev = e;
+      lruhead = e;
+    }
+  }
+  pthread_mutex_unlock(&cachelock);
+  return e;
+}
+
+static void
+cache_unpin(struct entry* e)
+{
+  pthread_mutex_lock(&cachelock);
+  if(--e->pins == 0 && e->dead) {
+    free(e->data);
+    free(e);
+  }
+  pthread_mutex_unlock(&cachelock);
+}
+
+/* takes ownership of 'data', which was read when the file was at
+ * generation 'gen'.  If it has been written since, 'data' may predate the
+ * write, and is thrown away.  So is a range another client just put. */
+static void
+cache_put(const struct file* f, uint64_t offset, uint64_t len, char* data,
+          uint64_t gen)
+{
+  struct entry* e = calloc(1, sizeof(struct entry));
+  if(e == NULL || len > capacity) { free(e); free(data); return; }
+  e->dev = f->dev;
+  e->ino = f->ino;
+  e->offset = offset;
+  e->len = len;
+  e->data = data;
+  const size_t b = bucket(e->dev, e->ino, e->offset);
+  pthread_mutex_lock(&cachelock);
+  const struct entry* dup = buckets[b];
+  while(dup != NULL && !(dup->dev == f->dev && dup->ino == f->ino &&
+                         dup->offset == offset && dup->len == len)) {
+    dup = dup->chain;
+  }
+  if(f->gen != gen || dup != NULL) {
+    pthread_mutex_unlock(&cachelock);
+    free(data);
+    free(e);
+    return;
+  }
+  while(used + len > capacity && lrutail != NULL) { unlink_entry(lrutail); }
+  e->chain = buckets[b];
+  buckets[b] = e;
+  e->next = lruhead;
+  if(lruhead) { lruhead->prev = e; } else { lrutail = e; }
+  lruhead = e;
+  used += len;
+  pthread_mutex_unlock(&cachelock);
+}
+
+/* ---- serving clients. ---- */
+
+static int
+sendall(int sock, const void* buf, size_t len)
+{
+  const char* b = (const char*) buf;
+  while(len > 0) {
+    const ssize_t s = send(sock, b, len, 0);
+    if(s < 0 && errno == EINTR) { continue; }
+    if(s < 0) { return errno; }
+    b += s; len -= (size_t)s;
+  }
+  return 0;
+}
+
+static int
+recvall(int sock, void* buf, size_t len)
+{
+  char* b = (char*) buf;
+  while(len > 0) {
+    const ssize_t r = recv(sock, b, len, 0);
+    if(r < 0 && errno == EINTR) { continue; }
+    if(r < 0) { return errno; }
+    if(r == 0) { return EPIPE; }
+    b += r; len -= (size_t)r;
+  }
+  return 0;
+}
+
+static int
+preadall(int fd, char* buf, size_t len, off_t offset)
+{
+  while(len > 0) {
+    const ssize_t r = pread(fd, buf, len, offset);
+    if(r < 0 && errno == EINTR) { continue; }
+    if(r < 0) { return errno; }
+    if(r == 0) { return EIO; }
+    buf += r; offset += r; len -= (size_t)r;
+  }
+  return 0;
+}
+
+/* copies a range of the file to the socket, without it passing through our
+ * memory if the OS can do that. */
+static int
+sendrange(int sock, int fd, off_t offset, size_t len)
+{
+#ifdef __linux__
+  while(len > 0) {
+    const ssize_t s = sendfile(sock, fd, &offset, len);
+    if(s < 0 && errno == EINTR) { continue; }
+    if(s < 0) { return errno; }
+    if(s == 0) { return EIO; }
+    len -= (size_t)s;
+  }
+  return 0;
+#else
+  char buf[65536];
+  while(len > 0) {
+    const size_t n = len < sizeof(buf) ? len : sizeof(buf);
+    int err = preadall(fd, buf, n, offset);
+    if(err == 0) { err = sendall(sock, buf, n); }
+    if(err != 0) { return err; }
+    offset += n; len -= n;
+  }
+  return 0;
+#endif
+}
+
+static int
+reply(int sock, int err, uint64_t len)
+{
+  const struct ookd_reply rp = { err, 0, err == 0 ? len : 0 };
+  return sendall(sock, &rp, sizeof(rp));
+}
+
+/* serves one OOKD_READ.  We check every piece lies within the file before
+ * promising the data, since once the header is out we can't take it back.
+ * @return nonzero if the connection is no longer usable. */
+static int
+serve_read(int sock, const struct file* f, const struct ookd_request* rq)
+{
+  if(rq->arg == 0 || rq->arg > OOKD_MAXPIECES) { return EPROTO; }
+  uint64_t* pieces = malloc(sizeof(uint64_t)*2*rq->arg);
+  if(pieces == NULL) { return ENOMEM; }
+  int err = recvall(sock, pieces, sizeof(uint64_t)*2*rq->arg);
+  if(err != 0) { free(pieces); return err; }
+  struct stat st;
+  int status = fstat(f->fd, &st) == 0 ? 0 : errno;
+  uint64_t total = 0;
+  for(size_t i=0; i < rq->arg && status == 0; ++i) {
+    const uint64_t off = pieces[i*2+0], len = pieces[i*2+1];
+    if(off > (uint64_t)st.st_size || len > (uint64_t)st.st_size - off) {
+      status = EIO; /* readers are atomic: no short reads. */
+    }
+    total += len;
+  }
+  err = reply(sock, status, total);
+  for(size_t i=0; i < rq->arg && status == 0 && err == 0; ++i) {
+    const uint64_t off = pieces[i*2+0], len = pieces[i*2+1];
+    struct entry* e = cache_get(f, off, len);
+    if(e != NULL) {
+      err = sendall(sock, e->data, len);
+      cache_unpin(e);
+      continue;
+    }
+    char* data = capacity > 0 && len <= capacity ? malloc(len) : NULL;
+    if(data == NULL) {
+      err = sendrange(sock, f->fd, (off_t)off, len);
+      continue;
+    }
+    const uint64_t gen = cache_gen(f);
+    err = preadall(f->fd, data, len, (off_t)off);
+    if(err == 0) { err = sendall(sock, data, len); }
+    if(err == 0) { cache_put(f, off, len, data, gen); } else { free(data); }
+  }
+  free(pieces);
+  return err;
+}
+
+static int
+serve_write(int sock, const struct file* f, const struct ookd_request* rq)
+{
+  if(rq->len > SIZE_MAX) { return EPROTO; }
+  char* data = malloc(rq->len);
+  if(data == NULL) { return ENOMEM; }
+  int err = recvall(sock, data, rq->len);
+  int status = 0;
+  if(err == 0 && !f->writable) { status = EBADF; }
+  for(uint64_t done=0; err == 0 && status == 0 && done < rq->len; ) {
+    const ssize_t w = pwrite(f->fd, data+done, rq->len-done,
+                             (off_t)(rq->offset+done));
+    if(w < 0 && errno == EINTR) { continue; }
+    if(w <= 0) { status = w < 0 ? errno : EIO; break; }
+    done += (uint64_t)w;
+  }
+  free(data);
+  if(err == 0) {
+    cache_written(f, rq->offset, rq->len);
+    err = reply(sock, status, 0);
+  }
+  return err;
+}
+
+static void*
+client(void* arg)
+{
+  const int sock = *(int*)arg;
+  free(arg);
+  struct file* f = NULL;
+  int err = 0;
+  while(err == 0) {
+    struct ookd_request rq;
+    if(recvall(sock, &rq, sizeof(rq)) != 0) { break; }
+    if(rq.op != OOKD_OPEN && f == NULL) { break; }
+    switch(rq.op) {
+      case OOKD_OPEN: {
+        if(f != NULL || rq.len == 0 || rq.len > 65536) { err = EPROTO; break; }
+        char* path = calloc(rq.len+1, 1);
+        if(path == NULL) { err = ENOMEM; break; }
+        err = recvall(sock, path, rq.len);
+        int status = 0;
+        if(err == 0) { f = acquire(path, (enum OOKMODE)rq.arg, &status); }
+        if(err == 0 && verbose) {
+          fprintf(stderr, "[ookd] %d: open %s: %s\n", sock, path,
+                  strerror(status));
+        }
+        free(path);
+        if(err == 0) { err = reply(sock, status, 0); }
+        break;
+      }
+      case OOKD_READ: err = serve_read(sock, f, &rq); break;
+      case OOKD_WRITE: err = serve_write(sock, f, &rq); break;
+      case OOKD_PREALLOC: {
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+        const int status = posix_fallocate(f->fd, 0, (off_t)rq.len);
+#else
+        const int status = ENOSYS; /* only a hint; the client ignores it. */
+#endif
+        err = reply(sock, status, 0);
+        break;
+      }
+      case OOKD_CLOSE:
+        reply(sock, 0, 0);
+        err = -1; /* done. */
+        break;
+      default: err = EPROTO; break;
+    }
+  }
+  if(verbose) { fprintf(stderr, "[ookd] %d: gone\n", sock); }
+  if(f != NULL) { release(f); }
+  close(sock);
+  return NULL;
+}
+
+static void
+stop(int sig)
+{
+  (void) sig;
+  quit = 1;
+}
+
+static void
+parseopts(int argc, char* argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "s:c:vh")) != -1) {
+    switch(opt) {
+      case 's': sockpath = optarg; break;
+      case 'c': capacity = (size_t)strtoull(optarg, NULL, 10) << 20; break;
+      case 'v': verbose++; break;
+      case 'h': usage(argv[0]); exit(EXIT_SUCCESS); break;
+      default: usage(argv[0]); exit(EXIT_FAILURE); break;
+    }
+  }
+}
+
+int
+main(int argc, char* argv[])
+{
+  parseopts(argc, argv);
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(sockpath) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path '%s' is too long.\n", sockpath);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(addr.sun_path, sockpath);
+
+  /* clients hanging up shouldn't take us down with them.  We don't set
+   * SA_RESTART, so that a signal gets us out of 'accept'. */
+  signal(SIGPIPE, SIG_IGN);
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = stop;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  const int lsock = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(lsock == -1) { perror("socket"); exit(EXIT_FAILURE); }
+  unlink(sockpath); /* left over from a previous run. */
+  /* we open files with our own privileges on behalf of whoever connects, so
+   * only our own user may; see ookd.h. */
+  const mode_t mask = umask(0177);
+  const int bound = bind(lsock, (struct sockaddr*)&addr, sizeof(addr));
+  umask(mask);
+  if(bound != 0 || chmod(sockpath, 0600) != 0 || listen(lsock, 64) != 0) {
+    perror("binding socket");
+    exit(EXIT_FAILURE);
+  }
+  if(verbose) {
+    fprintf(stderr, "[ookd] serving on %s, %zu MiB cache\n", sockpath,
+            capacity >> 20);
+  }
+  while(!quit) {
+    const int sock = accept(lsock, NULL, NULL);
+    if(sock == -1) {
+      if(errno != EINTR) { perror("accept"); }
+      continue;
+    }
+    int* arg = malloc(sizeof(int));
+    pthread_t thr;
+    if(arg == NULL) { close(sock); continue; }
+    *arg = sock;
+    if(pthread_create(&thr, NULL, client, arg) != 0) {
+      free(arg);
+      close(sock);
+      continue;
+    }
+    pthread_detach(thr);
+  }
+  close(lsock);
+  unlink(sockpath);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,44 @@
+#ifndef OOKCONTRIB_OOKD_H
+#define OOKCONTRIB_OOKD_H
+/* The protocol spoken between the 'ookd' brick server and OokdIO, over a
+ * Unix domain socket.  Each connection holds one open file.  The client
+ * sends a request header, possibly followed by a payload; the server answers
+ * each request with a reply header, possibly followed by data.  Everything is
+ * in host byte order, since both ends are always on the same machine.
+ *
+ * The server opens, creates and truncates whatever paths its clients name,
+ * with its own privileges; it does no checks of its own.  So a client is
+ * trusted with everything the server's user may do, and the socket is only
+ * accessible to that user (mode 0600).  Run one server per user.  An
+ * OOK_RDWR open fails with EBUSY while any client has the file open, rather
+ * than truncating it under them. */
+#include <inttypes.h>
+
+#define OOKD_SOCKET "/tmp/ookd.sock"
+
+enum OOKD_OP {
+  OOKD_OPEN=1, /* payload: 'len' bytes of absolute filename. 'arg': OOKMODE */
+  OOKD_READ,   /* payload: 'arg' (offset, length) pairs, as uint64_t.
+                  reply: the concatenation of every piece. */
+  OOKD_WRITE,  /* payload: 'len' bytes, to be written at 'offset'. */
+  OOKD_PREALLOC, /* 'len': the size to preallocate. */
+  OOKD_CLOSE
+};
+
+struct ookd_request {
+  uint32_t op;
+  uint32_t arg;
+  uint64_t offset;
+  uint64_t len;
+};
+
+struct ookd_reply {
+  int32_t err; /* 0, or an errno value.  On error, no data follow. */
+  uint32_t reserved_;
+  uint64_t len; /* bytes of data which follow. */
+};
+
+/* an upper limit on the pieces in one OOKD_READ. */
+#define OOKD_MAXPIECES (1U << 20)
+
+#endif
@@ -0,0 +1,186 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "ookd.h"
+#include "ookdio.h"
+
+#ifndef MSG_NOSIGNAL
+# define MSG_NOSIGNAL 0 /* we'll just have to hope nobody hangs up on us. */
+#endif
+
+struct conn {
+  int sock;
+};
+
+static int
+sendall(int sock, const void* buf, size_t len)
+{
+  const char* b = (const char*) buf;
+  while(len > 0) {
+    const ssize_t s = send(sock, b, len, MSG_NOSIGNAL);
+    if(s < 0 && errno == EINTR) { continue; }
+    if(s < 0) { return errno; }
+    b += s; len -= (size_t)s;
+  }
+  return 0;
+}
+
+/* the server hanging up early is an error, since readers must be atomic. */
+static int
+recvall(int sock, void* buf, size_t len)
+{
+  char* b = (char*) buf;
+  while(len > 0) {
+    const ssize_t r = recv(sock, b, len, 0);
+    if(r < 0 && errno == EINTR) { continue; }
+    if(r < 0) { return errno; }
+    if(r == 0) { return EIO; }
+    b += r; len -= (size_t)r;
+  }
+  return 0;
+}
+
+/* sends a request and its payload, and waits for the reply header. */
+static int
+request(int sock, uint32_t op, uint32_t arg, uint64_t offset, uint64_t len,
+        const void* payload, size_t plen, struct ookd_reply* rp)
+{
+  const struct ookd_request rq = { op, arg, offset, len };
+  int err = sendall(sock, &rq, sizeof(rq));
+  if(err == 0 && plen > 0) { err = sendall(sock, payload, plen); }
+  if(err == 0) { err = recvall(sock, rp, sizeof(struct ookd_reply)); }
+  if(err == 0 && rp->err != 0) { err = rp->err; }
+  return err;
+}
+
+static void*
+od_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  const char* path = state == NULL ? OOKD_SOCKET : (const char*) state;
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(addr.sun_path)) {
+    errno = ENAMETOOLONG;
+    return NULL;
+  }
+  strcpy(addr.sun_path, path);
+
+  /* the server doesn't share our working directory. */
+  char* abs;
+  if(fn[0] == '/') {
+    abs = malloc(strlen(fn)+1);
+    if(abs != NULL) { strcpy(abs, fn); }
+  } else {
+    char* cwd = getcwd(NULL, 0);
+    if(cwd == NULL) { return NULL; }
+    abs = malloc(strlen(cwd) + 1 + strlen(fn) + 1);
+    if(abs != NULL) { strcpy(abs, cwd); strcat(abs, "/"); strcat(abs, fn); }
+    free(cwd);
+  }
+  if(abs == NULL) { errno = ENOMEM; return NULL; }
+
+  struct conn* c = calloc(1, sizeof(struct conn));
+  if(c == NULL) { free(abs); errno = ENOMEM; return NULL; }
+  c->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  int err = c->sock == -1 ? errno : 0;
+  if(err == 0 && connect(c->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    err = errno;
+  }
+  struct ookd_reply rp;
+  if(err == 0) {
+    err = request(c->sock, OOKD_OPEN, (uint32_t)mode, 0, strlen(abs), abs,
+                  strlen(abs), &rp);
+  }
+  free(abs);
+  if(err != 0) {
+    if(c->sock != -1) { close(c->sock); }
+    free(c);
+    errno = err;
+    return NULL;
+  }
+  return c;
+}
+
+/* asks for every piece in one request; the server streams them all back in
+ * order, straight into the callers' buffers. */
+static int
+od_vread(void* fd, const struct ookiov* iov, const size_t n)
+{
+  const struct conn* c = (const struct conn*) fd;
+  for(size_t first=0; first < n; first += OOKD_MAXPIECES) {
+    const size_t count = n-first < OOKD_MAXPIECES ? n-first : OOKD_MAXPIECES;
+    uint64_t* pieces = malloc(sizeof(uint64_t)*2*count);
+    if(pieces == NULL) { return ENOMEM; }
+    uint64_t total = 0;
+    for(size_t i=0; i < count; ++i) {
+      pieces[i*2+0] = (uint64_t)iov[first+i].offset;
+      pieces[i*2+1] = iov[first+i].len;
+      total += iov[first+i].len;
+    }
+    struct ookd_reply rp;
+    int err = request(c->sock, OOKD_READ, (uint32_t)count, 0, total, pieces,
+                      sizeof(uint64_t)*2*count, &rp);
+    free(pieces);
+    if(err == 0 && rp.len != total) { err = EIO; }
+    for(size_t i=0; i < count && err == 0; ++i) {
+      err = recvall(c->sock, iov[first+i].buf, iov[first+i].len);
+    }
+    if(err != 0) { return err; }
+  }
+  return 0;
+}
+
+static int
+od_read(void* fd, const off_t offset, const size_t len, void* buf)
+{
+  const struct ookiov iov = { offset, len, buf };
+  return od_vread(fd, &iov, 1);
+}
+
+static int
+od_write(void* fd, const off_t offset, const size_t len, const void* buf)
+{
+  const struct conn* c = (const struct conn*) fd;
+  struct ookd_reply rp;
+  return request(c->sock, OOKD_WRITE, 0, (uint64_t)offset, len, buf, len, &rp);
+}
+
+static void
+od_prealloc(void* fd, off_t len)
+{
+  const struct conn* c = (const struct conn*) fd;
+  struct ookd_reply rp;
+  (void) request(c->sock, OOKD_PREALLOC, 0, 0, (uint64_t)len, NULL, 0, &rp);
+}
+
+static int
+od_close(void* fd)
+{
+  struct conn* c = (struct conn*) fd;
+  struct ookd_reply rp;
+  int err = request(c->sock, OOKD_CLOSE, 0, 0, 0, NULL, 0, &rp);
+  if(close(c->sock) != 0 && err == 0) { err = errno; }
+  free(c);
+  return err;
+}
+
+struct io OokdIO = {
+  .open = od_open,
+  .read = od_read,
+  .write = od_write,
+  .close = od_close,
+  .preallocate = od_prealloc,
+  .punch = NULL,
+  .hole = NULL,
+  .vread = od_vread,
+  .vwrite = NULL,
+  .state = NULL
+};
@@ -0,0 +1,17 @@
+#ifndef OOKCONTRIB_OOKDIO_IO_H
+#define OOKCONTRIB_OOKDIO_IO_H
+/* OokdIO forwards all I/O to an 'ookd' server, so that every process on the
+ * machine shares its open files and its cache.  Set the 'state' to the path
+ * of the server's socket, or leave it NULL for OOKD_SOCKET. */
+#include "io-interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern struct io OokdIO;
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,378 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "readahead.h"
+
+#define DEFAULT_DEPTH 8
+/* every background thread is another open of the file. */
+#define MAX_THREADS 8
+
+struct cfg {
+  struct io inner;
+  size_t depth;
+};
+
+enum SLOTSTATE { FREE, QUEUED, LOADING, READY };
+
+/* one predicted read. */
+struct slot {
+  enum SLOTSTATE st;
+  off_t offset;
+  size_t len;
+  char* buf;
+  size_t cap; /* bytes allocated for 'buf'. */
+  uint64_t seq; /* when it was predicted; older ones are fetched first. */
+};
+
+/* the pattern we think the reads follow: steps of 'stride', and after every
+ * 'runlen' of them (if known), one step of 'jump' instead. */
+struct pattern {
+  bool have; /* whether 'last' is valid. */
+  off_t last;
+  off_t stride;
+  size_t run; /* steps of 'stride' since the last jump. */
+  size_t runlen; /* 0 if unknown. */
+  off_t jump;
+};
+
+struct ra;
+struct worker {
+  struct ra* ra;
+  void* fd; /* its own open of the file. */
+  pthread_t thread;
+};
+
+struct ra {
+  struct io inner;
+  void* fd;
+  struct slot* s;
+  size_t nslots;
+  size_t depth;
+  struct worker* w;
+  size_t nw; /* workers actually running. */
+  struct pattern p;
+  uint64_t seq;
+  bool quit;
+  pthread_mutex_t lock; /* protects everything but 'inner', 'fd' and 'w'. */
+  pthread_cond_t work; /* a slot was queued, or we are quitting. */
+  pthread_cond_t done; /* a slot finished loading. */
+};
+
+static void*
+fetcher(void* arg)
+{
+  struct worker* w = (struct worker*) arg;
+  struct ra* ra = w->ra;
+  pthread_mutex_lock(&ra->lock);
+  while(!ra->quit) {
+    struct slot* next = NULL;
+    for(size_t i=0; i < ra->nslots; ++i) {
+      if(ra->s[i].st == QUEUED && (next == NULL || ra->s[i].seq < next->seq)) {
+        next = &ra->s[i];
+      }
+    }
+    if(next == NULL) {
+      pthread_cond_wait(&ra->work, &ra->lock);
+      continue;
+    }
+    next->st = LOADING;
+    pthread_mutex_unlock(&ra->lock);
+    const int err = ra->inner.read(w->fd, next->offset, next->len, next->buf);
+    pthread_mutex_lock(&ra->lock);
+    /* a failed prediction is just dropped: the read will be done again, for
+     * real, if it is ever asked for. */
+    next->st = err == 0 ? READY : FREE;
+    pthread_cond_broadcast(&ra->done);
+  }
+  pthread_mutex_unlock(&ra->lock);
+  return NULL;
+}
+
+/* updates the pattern with a read at 'offset'.  A step which breaks a run of
+ * strides is taken as the jump, if the run is as long as the last one (or we
+ * don't know yet); a run of a new length means the pattern changed.  Two
+ * breaks in a row mean a new stride. */
+static void
+observe(struct pattern* p, const off_t offset)
+{
+  if(!p->have) {
+    p->have = true;
+    p->last = offset;
+    return;
+  }
+  const off_t d = offset - p->last;
+  p->last = offset;
+  if(d == p->stride && d != 0) {
+    ++p->run;
+    if(p->runlen != 0 && p->run > p->runlen) { p->runlen = 0; }
+  } else if(p->run > 0) {
+    /* with the same run length but a different jump, this is a step of some
+     * outer loop (another brick, say); the inner pattern still holds. */
+    if(p->runlen != p->run) {
+      p->runlen = p->run;
+      p->jump = d;
+    }
+    p->run = 0;
+  } else {
+    p->stride = d;
+    p->run = 1;
+    p->runlen = 0;
+    p->jump = 0;
+  }
+}
+
+/* @return true if 'p' is known well enough to predict from. */
+static bool
+confident(const struct pattern* p)
+{
+  return p->stride != 0 && (p->run >= 2 || p->runlen != 0);
+}
+
+static struct slot*
+find(struct ra* ra, const off_t offset, const size_t len)
+{
+  for(size_t i=0; i < ra->nslots; ++i) {
+    const struct slot* s = &ra->s[i];
+    if(s->st != FREE && s->offset <= offset &&
+       offset + (off_t)len <= s->offset + (off_t)s->len) {
+      return &ra->s[i];
+    }
+  }
+  return NULL;
+}
+
+/* @return a slot for a new prediction: a free one, else the oldest
+ * prediction which has been read but never asked for.  NULL if every slot is
+ * busy. */
+static struct slot*
+claim(struct ra* ra)
+{
+  struct slot* old = NULL;
+  for(size_t i=0; i < ra->nslots; ++i) {
+    if(ra->s[i].st == FREE) { return &ra->s[i]; }
+    if(ra->s[i].st == READY && (old == NULL || ra->s[i].seq < old->seq)) {
+      old = &ra->s[i];
+    }
+  }
+  return old;
+}
+
+/* queues the next 'depth' reads we expect after one at 'offset'. */
+static void
+predict(struct ra* ra, const off_t offset, const size_t len)
+{
+  const struct pattern* p = &ra->p;
+  if(!confident(p)) { return; }
+  off_t at = offset;
+  size_t run = p->run;
+  for(size_t k=0; k < ra->depth; ++k) {
+    if(p->runlen != 0 && run == p->runlen) {
+      at += p->jump;
+      run = 0;
+    } else {
+      at += p->stride;
+      ++run;
+    }
+    if(at < 0) { return; }
+    if(find(ra, at, len) != NULL) { continue; }
+    struct slot* s = claim(ra);
+    if(s == NULL) { return; }
+    if(s->cap < len) {
+      char* buf = realloc(s->buf, len);
+      if(buf == NULL) { s->st = FREE; return; }
+      s->buf = buf;
+      s->cap = len;
+    }
+    s->offset = at;
+    s->len = len;
+    s->seq = ra->seq++;
+    s->st = QUEUED;
+    pthread_cond_signal(&ra->work);
+  }
+}
+
+/* predictions which haven't started yet are dropped when one misses: the
+ * pattern has changed, so they are probably wrong too. */
+static void
+cancel(struct ra* ra)
+{
+  for(size_t i=0; i < ra->nslots; ++i) {
+    if(ra->s[i].st == QUEUED) { ra->s[i].st = FREE; }
+  }
+}
+
+static int
+ra_read(void* fd, const off_t offset, const size_t len, void* buf)
+{
+  struct ra* ra = (struct ra*) fd;
+  if(ra->nw == 0) { return ra->inner.read(ra->fd, offset, len, buf); }
+  bool hit = false;
+  bool expected = false; /* predicted, but not started yet. */
+  pthread_mutex_lock(&ra->lock);
+  for(struct slot* s=find(ra, offset, len); s != NULL;
+      s=find(ra, offset, len)) {
+    if(s->st == LOADING) {
+      pthread_cond_wait(&ra->done, &ra->lock);
+      continue;
+    }
+    if(s->st == READY) {
+      memcpy(buf, s->buf + (offset - s->offset), len);
+      hit = true;
+    } else {
+      expected = true; /* quicker to read it ourselves than to wait. */
+    }
+    s->st = FREE;
+    break;
+  }
+  observe(&ra->p, offset);
+  if(!hit && !expected) { cancel(ra); }
+  predict(ra, offset, len);
+  pthread_mutex_unlock(&ra->lock);
+  if(hit) { return 0; }
+  return ra->inner.read(ra->fd, offset, len, buf);
+}
+
+static int
+ra_write(void* fd, const off_t offset, const size_t len, const void* buf)
+{
+  struct ra* ra = (struct ra*) fd;
+  return ra->inner.write(ra->fd, offset, len, buf);
+}
+
+static int
+ra_vwrite(void* fd, const struct ookiov* iov, const size_t n)
+{
+  struct ra* ra = (struct ra*) fd;
+  return ra->inner.vwrite(ra->fd, iov, n);
+}
+
+static int
+ra_punch(void* fd, const off_t offset, const size_t len)
+{
+  struct ra* ra = (struct ra*) fd;
+  return ra->inner.punch(ra->fd, offset, len);
+}
+
+static int
+ra_hole(void* fd, const off_t offset, const size_t len)
+{
+  struct ra* ra = (struct ra*) fd;
+  return ra->inner.hole(ra->fd, offset, len);
+}
+
+static void
+ra_preallocate(void* fd, off_t len)
+{
+  struct ra* ra = (struct ra*) fd;
+  ra->inner.preallocate(ra->fd, len);
+}
+
+static int
+ra_close(void* fd)
+{
+  struct ra* ra = (struct ra*) fd;
+  pthread_mutex_lock(&ra->lock);
+  ra->quit = true;
+  pthread_cond_broadcast(&ra->work);
+  pthread_mutex_unlock(&ra->lock);
+  for(size_t i=0; i < ra->nw; ++i) {
+    pthread_join(ra->w[i].thread, NULL);
+    ra->inner.close(ra->w[i].fd);
+  }
+  const int err = ra->inner.close(ra->fd);
+  for(size_t i=0; i < ra->nslots; ++i) { free(ra->s[i].buf); }
+  pthread_cond_destroy(&ra->done);
+  pthread_cond_destroy(&ra->work);
+  pthread_mutex_destroy(&ra->lock);
+  free(ra->s);
+  free(ra->w);
+  free(ra);
+  return err;
+}
+
+/* if the file won't open again, or a thread won't start, we read ahead with
+ * fewer threads: or none at all, passing everything through. */
+static void*
+ra_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  const struct cfg* cfg = (const struct cfg*) state;
+  if(cfg == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  struct ra* ra = calloc(1, sizeof(struct ra));
+  if(ra == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  ra->inner = cfg->inner;
+  ra->fd = ra->inner.open(fn, mode, ra->inner.state);
+  if(ra->fd == NULL) {
+    free(ra);
+    return NULL; /* inner open set errno. */
+  }
+  pthread_mutex_init(&ra->lock, NULL);
+  pthread_cond_init(&ra->work, NULL);
+  pthread_cond_init(&ra->done, NULL);
+  ra->depth = cfg->depth;
+  if(mode != OOK_RDONLY) { return ra; }
+
+  /* twice as many slots as predictions: one we stopped expecting keeps its
+   * slot until it has finished loading. */
+  const size_t nthreads = ra->depth < MAX_THREADS ? ra->depth : MAX_THREADS;
+  ra->s = calloc(2*ra->depth, sizeof(struct slot));
+  ra->w = calloc(nthreads, sizeof(struct worker));
+  if(ra->s == NULL || ra->w == NULL) { return ra; }
+  ra->nslots = 2*ra->depth;
+  for(size_t i=0; i < nthreads; ++i) {
+    struct worker* w = &ra->w[ra->nw];
+    w->ra = ra;
+    w->fd = ra->inner.open(fn, mode, ra->inner.state);
+    if(w->fd == NULL) { break; }
+    if(pthread_create(&w->thread, NULL, fetcher, w) != 0) {
+      ra->inner.close(w->fd);
+      break;
+    }
+    ++ra->nw;
+  }
+  return ra;
+}
+
+struct io*
+readahead_io(struct io inner, size_t depth)
+{
+  struct io* io = calloc(1, sizeof(struct io));
+  struct cfg* cfg = calloc(1, sizeof(struct cfg));
+  if(io == NULL || cfg == NULL) {
+    free(cfg);
+    free(io);
+    errno = ENOMEM;
+    return NULL;
+  }
+  cfg->inner = inner;
+  cfg->depth = depth == 0 ? DEFAULT_DEPTH : depth;
+  io->open = ra_open;
+  io->read = ra_read;
+  io->write = ra_write;
+  io->close = ra_close;
+  io->preallocate = inner.preallocate != NULL ? ra_preallocate : NULL;
+  io->punch = inner.punch != NULL ? ra_punch : NULL;
+  io->hole = inner.hole != NULL ? ra_hole : NULL;
+  io->vread = NULL;
+  io->vwrite = inner.vwrite != NULL ? ra_vwrite : NULL;
+  io->state = cfg;
+  return io;
+}
+
+void
+readahead_destroy(struct io* io)
+{
+  if(io == NULL) { return; }
+  free((void*)io->state);
+  free(io);
+}
@@ -0,0 +1,29 @@
+#ifndef OOKCONTRIB_READAHEAD_IO_H
+#define OOKCONTRIB_READAHEAD_IO_H
+/* ReadAhead is an IO interface which wraps another, watching the offsets it
+ * is asked to read.  Ook reads a brick one scanline at a time: a fixed stride
+ * from one scanline to the next, and a different jump at the end of each
+ * slice of the brick.  Once it has seen such a pattern, ReadAhead predicts
+ * the next few reads and issues them in the background, so that by the time
+ * they are asked for they are already in memory.
+ *
+ * Only files opened read-only are read ahead; anything else passes straight
+ * through.  Each background thread opens the file again for itself, so the
+ * wrapped interface need not support concurrent calls on one descriptor.
+ * ReadAhead hides the wrapped interface's vectored read, since that would
+ * hand it whole bricks and leave nothing to predict. */
+#include "io-interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** wraps 'inner', keeping up to 'depth' predicted reads in flight or waiting
+ * to be read (0: 8).  Release it with 'readahead_destroy'. */
+struct io* readahead_io(struct io inner, size_t depth);
+void readahead_destroy(struct io*);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
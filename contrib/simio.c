@@ -0,0 +1,243 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "simio.h"
+
+/* the simulated device.  Rather than modelling it with threads, every request
+ * reserves time on it up front: a slot, then its share of the link.  The
+ * caller then just sleeps until its reservation ends. */
+struct sim {
+  struct io inner;
+  struct simio cfg;
+  uint64_t* slot; /* when each of the 'depth' slots is next free. */
+  uint64_t link; /* when the link is next free. */
+  struct simstats st;
+  pthread_mutex_t lock;
+};
+
+struct sfd {
+  struct sim* sim;
+  void* fd;
+};
+
+static uint64_t
+clocknow()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec*UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+static void
+sleepuntil(const uint64_t when)
+{
+  for(uint64_t now=clocknow(); now < when; now=clocknow()) {
+    const uint64_t ns = when - now;
+    struct timespec ts;
+    ts.tv_sec = (time_t)(ns / UINT64_C(1000000000));
+    ts.tv_nsec = (long)(ns % UINT64_C(1000000000));
+    nanosleep(&ts, NULL);
+  }
+}
+
+/* books the 'n' pieces of a request submitted 'now' onto the device.
+ * @return when the last of them completes. */
+static uint64_t
+reserve(struct sim* s, const struct ookiov* iov, const size_t n,
+        const bool writing, const uint64_t now)
+{
+  uint64_t done = now;
+  pthread_mutex_lock(&s->lock);
+  for(size_t i=0; i < n; ++i) {
+    uint64_t start = now;
+    size_t k = 0;
+    if(s->cfg.depth > 0) { /* the slot which frees up first. */
+      for(size_t j=1; j < s->cfg.depth; ++j) {
+        if(s->slot[j] < s->slot[k]) { k = j; }
+      }
+      if(s->slot[k] > start) { start = s->slot[k]; }
+    }
+    uint64_t end = start + s->cfg.latency;
+    if(s->cfg.bandwidth > 0) {
+      if(s->link > end) { end = s->link; }
+      end += (uint64_t)((double)iov[i].len * 1e9 / s->cfg.bandwidth);
+      s->link = end;
+    }
+    if(s->cfg.depth > 0) { s->slot[k] = end; }
+    if(end > done) { done = end; }
+
+    if(writing) {
+      ++s->st.writes;
+      s->st.bytes_written += iov[i].len;
+    } else {
+      ++s->st.reads;
+      s->st.bytes_read += iov[i].len;
+    }
+    s->st.queued_ns += start - now;
+    s->st.service_ns += end - now;
+    if(end - now > s->st.max_ns) { s->st.max_ns = end - now; }
+  }
+  pthread_mutex_unlock(&s->lock);
+  return done;
+}
+
+static int
+sim_vread(void* fd, const struct ookiov* iov, const size_t n)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  const uint64_t done = reserve(sf->sim, iov, n, false, clocknow());
+  const struct io* in = &sf->sim->inner;
+  int err = 0;
+  if(in->vread != NULL) {
+    err = in->vread(sf->fd, iov, n);
+  } else {
+    for(size_t i=0; i < n && err == 0; ++i) {
+      err = in->read(sf->fd, iov[i].offset, iov[i].len, iov[i].buf);
+    }
+  }
+  sleepuntil(done);
+  return err;
+}
+
+static int
+sim_read(void* fd, const off_t offset, const size_t len, void* buf)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  const struct ookiov iov = { offset, len, buf };
+  const uint64_t done = reserve(sf->sim, &iov, 1, false, clocknow());
+  const int err = sf->sim->inner.read(sf->fd, offset, len, buf);
+  sleepuntil(done);
+  return err;
+}
+
+static int
+sim_vwrite(void* fd, const struct ookiov* iov, const size_t n)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  const uint64_t done = reserve(sf->sim, iov, n, true, clocknow());
+  const int err = sf->sim->inner.vwrite(sf->fd, iov, n);
+  sleepuntil(done);
+  return err;
+}
+
+static int
+sim_write(void* fd, const off_t offset, const size_t len, const void* buf)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  const struct ookiov iov = { offset, len, (void*)buf };
+  const uint64_t done = reserve(sf->sim, &iov, 1, true, clocknow());
+  const int err = sf->sim->inner.write(sf->fd, offset, len, buf);
+  sleepuntil(done);
+  return err;
+}
+
+static int
+sim_punch(void* fd, const off_t offset, const size_t len)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  return sf->sim->inner.punch(sf->fd, offset, len);
+}
+
+static int
+sim_hole(void* fd, const off_t offset, const size_t len)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  return sf->sim->inner.hole(sf->fd, offset, len);
+}
+
+static void
+sim_preallocate(void* fd, off_t len)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  sf->sim->inner.preallocate(sf->fd, len);
+}
+
+static int
+sim_close(void* fd)
+{
+  struct sfd* sf = (struct sfd*) fd;
+  const int err = sf->sim->inner.close(sf->fd);
+  free(sf);
+  return err;
+}
+
+static void*
+sim_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  struct sim* s = (struct sim*) state;
+  if(s == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+  struct sfd* sf = calloc(1, sizeof(struct sfd));
+  if(sf == NULL) {
+    errno = ENOMEM;
+    return NULL;
+  }
+  sf->sim = s;
+  sf->fd = s->inner.open(fn, mode, s->inner.state);
+  if(sf->fd == NULL) {
+    free(sf);
+    return NULL; /* inner open set errno. */
+  }
+  return sf;
+}
+
+struct io*
+simulated_io(struct io inner, const struct simio* cfg)
+{
+  if(cfg == NULL) { errno = EINVAL; return NULL; }
+  struct io* io = calloc(1, sizeof(struct io));
+  struct sim* s = calloc(1, sizeof(struct sim));
+  if(io != NULL && s != NULL && cfg->depth > 0) {
+    s->slot = calloc(cfg->depth, sizeof(uint64_t));
+  }
+  if(io == NULL || s == NULL || (cfg->depth > 0 && s->slot == NULL)) {
+    if(s != NULL) { free(s->slot); }
+    free(s);
+    free(io);
+    errno = ENOMEM;
+    return NULL;
+  }
+  s->inner = inner;
+  s->cfg = *cfg;
+  pthread_mutex_init(&s->lock, NULL);
+  io->open = sim_open;
+  io->read = sim_read;
+  io->write = sim_write;
+  io->close = sim_close;
+  io->preallocate = inner.preallocate != NULL ? sim_preallocate : NULL;
+  io->punch = inner.punch != NULL ? sim_punch : NULL;
+  io->hole = inner.hole != NULL ? sim_hole : NULL;
+  /* vectored reads are what a queue depth is for, so always offer them. */
+  io->vread = sim_vread;
+  io->vwrite = inner.vwrite != NULL ? sim_vwrite : NULL;
+  io->state = s;
+  return io;
+}
+
+void
+simulated_destroy(struct io* io)
+{
+  if(io == NULL) { return; }
+  struct sim* s = (struct sim*) io->state;
+  pthread_mutex_destroy(&s->lock);
+  free(s->slot);
+  free(s);
+  free(io);
+}
+
+void
+simulated_stats(const struct io* io, struct simstats* st)
+{
+  struct sim* s = (struct sim*) io->state;
+  pthread_mutex_lock(&s->lock);
+  *st = s->st;
+  pthread_mutex_unlock(&s->lock);
+}
@@ -0,0 +1,45 @@
+#ifndef OOKCONTRIB_SIMULATED_IO_H
+#define OOKCONTRIB_SIMULATED_IO_H
+/* SimulatedIO is an IO interface which wraps another and makes it behave like
+ * slower storage: a parallel filesystem or object store, say.  Every read and
+ * write does the real work through the wrapped interface, and then waits
+ * until a simulated device would have finished it.
+ *
+ * The device serves at most 'depth' requests at once; more wait their turn.
+ * Each costs 'latency' before its data start to move, and all the data share
+ * one link of 'bandwidth' bytes per second.  The pieces of a vectored request
+ * are submitted together, so they overlap up to the queue depth; that is what
+ * makes deeper queues pay off on such storage.  The device is the interface:
+ * every file opened through it shares it. */
+#include "io-interface.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct simio {
+  uint64_t latency; /* nanoseconds per request. */
+  uint64_t bandwidth; /* bytes per second; 0 for unlimited. */
+  size_t depth; /* requests served at once; 0 for unlimited. */
+};
+
+/* what the device has done.  The times are those of the simulation, summed
+ * over requests (or the pieces of vectored ones). */
+struct simstats {
+  uint64_t reads, writes;
+  uint64_t bytes_read, bytes_written;
+  uint64_t queued_ns; /* spent waiting for a free slot. */
+  uint64_t service_ns; /* from submission to completion. */
+  uint64_t max_ns; /* the slowest single request. */
+};
+
+/** wraps 'inner' in a device described by 'sim'.  Release it with
+ * 'simulated_destroy', after every file opened through it is closed. */
+struct io* simulated_io(struct io inner, const struct simio* sim);
+void simulated_destroy(struct io*);
+void simulated_stats(const struct io*, struct simstats*);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -3,171 +3,563 @@
 #include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include "stack.h"
-#include "carr.h"
 #include "imgio.h"
 
+/* images kept open at once, when the metadata doesn't say. */
+#define STACK_MAXOPEN 64
+/* threads encoding slices, when the metadata doesn't say. */
+#define STACK_THREADS 4
+
+/* one open image in the pool. */
+struct slot {
+  size_t z; /* slice held; SIZE_MAX if the slot is empty. */
+  void* img; /* NULL while the image is being opened. */
+  uint64_t used; /* for LRU. */
+  size_t pins; /* readers currently using the image. */
+};
+
 struct stack {
-  array* images;
+  char** names; /* full path of every slice, in Z order. */
+  size_t nnames;
   uint64_t dims[3];
   size_t components;
   size_t width;
+  bool floating;
+  enum OOKMODE mode;
+  const struct io* img; /* how slices are read: ImageIO or ImageIO_slice. */
+  struct slot* pool;
+  size_t npool;
+  uint64_t tick;
+  pthread_mutex_t lock;
+  pthread_cond_t changed; /* a slot was opened or released. */
+  /* prefetching: the thread opens slices [next, upto). */
+  size_t prefetch;
+  size_t next;
+  size_t upto;
+  bool quit;
+  bool threaded;
+  pthread_t thread;
+  /* writing: each slice is gathered in memory until every voxel of it has
+   * been written, then queued for the encoders.  A voxel may be written
+   * more than once (a brick rewritten, or a sieved write carrying its
+   * neighbours' data), so what has been written is tracked exactly. */
+  char** bufs; /* NULL until the slice is first written to. */
+  uint64_t** written; /* a bit per voxel of each slice; NULL with 'bufs'. */
+  uint64_t* filled; /* distinct voxels written into each slice. */
+  bool* flushed; /* queued already; later writes would be lost. */
+  struct job* queue;
+  struct job* last;
+  size_t queued;
+  pthread_t* encoders;
+  size_t nencoders;
+  int werr; /* the first error from encoding. */
 };
 
-static void
-cleanup_images(array* imgs)
-{
-  for(size_t i=0; i < ca_size(imgs); ++i) {
-    ImageIO.close(ca_elem(imgs, i));
-  }
-}
-
-#ifdef __GNUC__
-# define CONST __attribute__((const))
-#else
-# define CONST /* unavailable */
-#endif
-
-CONST static int64_t
-MIN(const int64_t a, const int64_t b)
-{
-  return a < b ? a : b;
-}
+/* a complete slice, waiting to be encoded. */
+struct job {
+  size_t z;
+  char* data;
+  struct job* next;
+};
 
 /*allocs-memory*/ static char*
 dirconcat(const char* prefix, const char* suffix)
 {
   const size_t n = strlen(prefix) + strlen(suffix) + 2;
   char* rv = calloc(n, sizeof(char));
+  if(rv == NULL) { return NULL; }
   strncpy(rv, prefix, n);
   strncat(rv, "/", n);
   strncat(rv, suffix, n);
   return rv;
 }
 
+static int
+namecmp(const void* a, const void* b)
+{
+  return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* gets the image for slice 'z', opening it if need be, and pins it.  A
+ * prefetch never waits: it gives up if it would have to.
+ * @return NULL on failure, with errno set (or 0 for a prefetch which gave
+ *         up). */
+static struct slot*
+acquire(struct stack* stk, const size_t z, const bool prefetch)
+{
+  pthread_mutex_lock(&stk->lock);
+  struct slot* victim;
+  for(;;) {
+    struct slot* have = NULL;
+    victim = NULL;
+    for(size_t i=0; i < stk->npool; ++i) {
+      struct slot* s = &stk->pool[i];
+      if(s->z == z) { have = s; break; }
+      /* the least recently used slot that no one is using or opening. */
+      if(s->pins == 0 && (s->img != NULL || s->z == SIZE_MAX) &&
+         (victim == NULL || s->used < victim->used)) {
+        victim = s;
+      }
+    }
+    if(have != NULL && have->img != NULL) {
+      have->pins++;
+      have->used = ++stk->tick;
+      pthread_mutex_unlock(&stk->lock);
+      return have;
+    }
+    if(have == NULL && victim != NULL) { break; }
+    /* being opened by someone else, or everything is in use. */
+    if(prefetch) {
+      pthread_mutex_unlock(&stk->lock);
+      errno = 0;
+      return NULL;
+    }
+    pthread_cond_wait(&stk->changed, &stk->lock);
+  }
+  void* old = victim->img;
+  victim->z = z;
+  victim->img = NULL;
+  victim->pins = 1;
+  victim->used = ++stk->tick;
+  pthread_mutex_unlock(&stk->lock);
+
+  /* the slow parts happen without the lock, so others can carry on. */
+  if(old != NULL) { stk->img->close(old); }
+  void* img = stk->img->open(stk->names[z], stk->mode, stk->dims);
+  const int err = errno;
+
+  pthread_mutex_lock(&stk->lock);
+  if(img == NULL) {
+    victim->z = SIZE_MAX;
+    victim->pins = 0;
+  } else {
+    victim->img = img;
+  }
+  pthread_cond_broadcast(&stk->changed);
+  pthread_mutex_unlock(&stk->lock);
+  if(img == NULL) {
+    errno = err == 0 ? EINVAL : err;
+    return NULL;
+  }
+  return victim;
+}
+
+static void
+release(struct stack* stk, struct slot* s)
+{
+  pthread_mutex_lock(&stk->lock);
+  s->pins--;
+  pthread_cond_broadcast(&stk->changed);
+  pthread_mutex_unlock(&stk->lock);
+}
+
+/* opens the slices after the one last read, so that they're ready by the
+ * time a reader moves on to them. */
+static void*
+prefetcher(void* arg)
+{
+  struct stack* stk = (struct stack*) arg;
+  pthread_mutex_lock(&stk->lock);
+  while(!stk->quit) {
+    if(stk->next >= stk->upto) {
+      pthread_cond_wait(&stk->changed, &stk->lock);
+      continue;
+    }
+    const size_t z = stk->next++;
+    pthread_mutex_unlock(&stk->lock);
+    struct slot* s = acquire(stk, z, true);
+    if(s != NULL) { release(stk, s); }
+    pthread_mutex_lock(&stk->lock);
+  }
+  pthread_mutex_unlock(&stk->lock);
+  return NULL;
+}
+
+static uint64_t
+slicebytes(const struct stack* stk)
+{
+  return stk->dims[0]*stk->dims[1]*stk->components*stk->width;
+}
+
+static uint64_t
+voxelbytes(const struct stack* stk)
+{
+  return stk->components*stk->width;
+}
+
+static unsigned
+popcount(uint64_t v)
+{
+  v = v - ((v >> 1) & UINT64_C(0x5555555555555555));
+  v = (v & UINT64_C(0x3333333333333333)) +
+      ((v >> 2) & UINT64_C(0x3333333333333333));
+  v = (v + (v >> 4)) & UINT64_C(0x0f0f0f0f0f0f0f0f);
+  return (unsigned)((v * UINT64_C(0x0101010101010101)) >> 56);
+}
+
+/* sets bits [from, to) of 'bits'.  @return how many were not set before. */
+static uint64_t
+mark(uint64_t* bits, uint64_t from, const uint64_t to)
+{
+  uint64_t added = 0;
+  while(from < to) {
+    const uint64_t word = from / 64;
+    const unsigned lo = (unsigned)(from % 64);
+    const unsigned hi = to - word*64 < 64 ? (unsigned)(to - word*64) : 64;
+    const uint64_t m = (hi == 64 ? ~UINT64_C(0) : (UINT64_C(1) << hi) - 1) &
+                       ~((UINT64_C(1) << lo) - 1);
+    added += popcount(m & ~bits[word]);
+    bits[word] |= m;
+    from = word*64 + hi;
+  }
+  return added;
+}
+
+static int
+encode(const struct stack* stk, const size_t z, char* data)
+{
+  return img_save(stk->names[z], data, stk->dims[0], stk->dims[1],
+                  stk->components, stk->width, stk->floating);
+}
+
+static void*
+encoder(void* arg)
+{
+  struct stack* stk = (struct stack*) arg;
+  pthread_mutex_lock(&stk->lock);
+  for(;;) {
+    while(stk->queue == NULL && !stk->quit) {
+      pthread_cond_wait(&stk->changed, &stk->lock);
+    }
+    /* only stop once everything queued is written. */
+    if(stk->queue == NULL) { break; }
+    struct job* job = stk->queue;
+    stk->queue = job->next;
+    if(stk->queue == NULL) { stk->last = NULL; }
+    pthread_mutex_unlock(&stk->lock);
+    const int err = encode(stk, job->z, job->data);
+    free(job->data);
+    free(job);
+    pthread_mutex_lock(&stk->lock);
+    stk->queued--;
+    if(err != 0 && stk->werr == 0) { stk->werr = err; }
+    pthread_cond_broadcast(&stk->changed);
+  }
+  pthread_mutex_unlock(&stk->lock);
+  return NULL;
+}
+
+/* hands slice 'z' to the encoders; the caller holds the lock.  To bound the
+ * memory in flight, waits while the encoders are well behind. */
+static void
+enqueue(struct stack* stk, const size_t z)
+{
+  char* data = stk->bufs[z];
+  stk->bufs[z] = NULL;
+  free(stk->written[z]);
+  stk->written[z] = NULL;
+  stk->flushed[z] = true;
+  struct job* job = malloc(sizeof(struct job));
+  if(stk->nencoders == 0 || job == NULL) {
+    free(job);
+    /* no one to hand it to: do it ourselves. */
+    const int err = encode(stk, z, data);
+    free(data);
+    if(err != 0 && stk->werr == 0) { stk->werr = err; }
+    return;
+  }
+  while(stk->queued >= 2*stk->nencoders) {
+    pthread_cond_wait(&stk->changed, &stk->lock);
+  }
+  job->z = z;
+  job->data = data;
+  job->next = NULL;
+  if(stk->last) { stk->last->next = job; } else { stk->queue = job; }
+  stk->last = job;
+  stk->queued++;
+  pthread_cond_broadcast(&stk->changed);
+}
+
+static int
+stack_close(void* fd)
+{
+  struct stack* stk = (struct stack*)fd;
+  /* slices which were never completely written are written as they are;
+   * any parts never written are zero. */
+  if(stk->flushed != NULL) {
+    pthread_mutex_lock(&stk->lock);
+    for(size_t z=0; z < stk->dims[2]; ++z) {
+      if(stk->flushed[z]) { continue; }
+      if(stk->bufs[z] == NULL) {
+        stk->bufs[z] = calloc(1, slicebytes(stk));
+        if(stk->bufs[z] == NULL) {
+          if(stk->werr == 0) { stk->werr = ENOMEM; }
+          continue;
+        }
+      }
+      enqueue(stk, z);
+    }
+    pthread_mutex_unlock(&stk->lock);
+  }
+  if(stk->threaded || stk->nencoders > 0) {
+    pthread_mutex_lock(&stk->lock);
+    stk->quit = true;
+    pthread_cond_broadcast(&stk->changed);
+    pthread_mutex_unlock(&stk->lock);
+    if(stk->threaded) { pthread_join(stk->thread, NULL); }
+    for(size_t i=0; i < stk->nencoders; ++i) {
+      pthread_join(stk->encoders[i], NULL);
+    }
+  }
+  int err = stk->werr;
+  for(size_t i=0; stk->pool != NULL && i < stk->npool; ++i) {
+    if(stk->pool[i].img != NULL) {
+      const int e = stk->img->close(stk->pool[i].img);
+      if(err == 0) { err = e; }
+    }
+  }
+  for(size_t i=0; i < stk->nnames; ++i) { free(stk->names[i]); }
+  for(size_t z=0; stk->bufs != NULL && z < stk->dims[2]; ++z) {
+    free(stk->bufs[z]);
+    if(stk->written != NULL) { free(stk->written[z]); }
+  }
+  free(stk->bufs);
+  free(stk->written);
+  free(stk->filled);
+  free(stk->flushed);
+  free(stk->encoders);
+  free(stk->names);
+  free(stk->pool);
+  pthread_cond_destroy(&stk->changed);
+  pthread_mutex_destroy(&stk->lock);
+  free(stk);
+  return err;
+}
+
+/* names the slices to be written, and starts up the encoders. */
+static int
+open_writer(struct stack* stk, const char* fn, const struct metadata* md)
+{
+  if(mkdir(fn, 0777) != 0 && errno != EEXIST) { return errno; }
+  const char* suffix = md->suffix == NULL ? ".tif" : md->suffix;
+  /* enough digits for every slice, so names sort in Z order. */
+  int digits = 5;
+  for(uint64_t n=stk->dims[2]/100000; n > 0 && digits < 20; n /= 10) {
+    ++digits;
+  }
+  const size_t nz = stk->dims[2];
+  stk->names = calloc(nz, sizeof(char*));
+  stk->bufs = calloc(nz, sizeof(char*));
+  stk->written = calloc(nz, sizeof(uint64_t*));
+  stk->filled = calloc(nz, sizeof(uint64_t));
+  stk->flushed = calloc(nz, sizeof(bool));
+  if(!stk->names || !stk->bufs || !stk->written || !stk->filled ||
+     !stk->flushed) {
+    return ENOMEM;
+  }
+  for(size_t z=0; z < nz; ++z) {
+    const size_t n = strlen(fn) + 1 + 20 + strlen(suffix) + 1;
+    stk->names[z] = malloc(n);
+    if(stk->names[z] == NULL) { return ENOMEM; }
+    snprintf(stk->names[z], n, "%s/%0*zu%s", fn, digits, z, suffix);
+    stk->nnames++;
+  }
+  const size_t threads = md->threads == 0 ? STACK_THREADS : md->threads;
+  stk->encoders = calloc(threads, sizeof(pthread_t));
+  if(stk->encoders == NULL) { return ENOMEM; }
+  for(size_t i=0; i < threads; ++i) {
+    if(pthread_create(&stk->encoders[i], NULL, encoder, stk) != 0) { break; }
+    stk->nencoders++;
+  }
+  return 0;
+}
+
+/* nothing is opened here: only the names of the slices are gathered.  Each
+ * image is opened when it is first read. */
 static void*
 stack_open(const char* fn, const enum OOKMODE mode, const void* state)
 {
-  if(state == NULL) {
+  if(state == NULL || mode == OOK_UPDATE) {
     errno = EINVAL;
     return NULL;
   }
   const struct metadata* md = state;
 
-  DIR* d = opendir(fn);
-  if(d == NULL) {
-    return NULL; /* errno is already set by opendir. */
-  }
-
   struct stack* stk = calloc(1, sizeof(struct stack));
+  if(stk == NULL) { errno = ENOMEM; return NULL; }
+  pthread_mutex_init(&stk->lock, NULL);
+  pthread_cond_init(&stk->changed, NULL);
   memcpy(stk->dims, md->voxels, sizeof(uint64_t)*3);
   stk->components = md->components;
   stk->width = md->width;
-  stk->images = carray(2);
-  {
-    struct dirent cur;
-    struct dirent* pcur;
-    while(readdir_r(d, &cur, &pcur) == 0) {
-      if(pcur == NULL) { break; } /* EOF */
-      if(cur.d_name[0] == '.') { continue; } /* skip hidden files. */
-      char* fname = dirconcat(fn, cur.d_name);
-      void* img = ImageIO.open(fname, mode, md->voxels);
-      free(fname);
-      if(img == NULL) { /* image failed to open... :-( */
-        int err = errno;
-        cleanup_images(stk->images);
-        ca_destroy(stk->images);
-        free(stk);
-        errno = err;
-        return NULL;
-      }
-      stk->images = ca_append(stk->images, img);
+  stk->floating = md->floating;
+  stk->mode = mode;
+  stk->img = md->whole ? &ImageIO_slice : &ImageIO;
+  if(mode == OOK_RDWR) {
+    const int err = open_writer(stk, fn, md);
+    if(err != 0) {
+      free(stk->flushed); /* nothing to flush. */
+      stk->flushed = NULL;
+      stack_close(stk);
+      errno = err;
+      return NULL;
     }
+    return stk;
   }
-  if(closedir(d) != 0) {
-    int err = errno;
-    cleanup_images(stk->images);
-    ca_destroy(stk->images);
-    free(stk);
+
+  DIR* d = opendir(fn);
+  if(d == NULL) {
+    const int err = errno;
+    stack_close(stk);
+    errno = err;
+    return NULL;
+  }
+  int err = 0;
+  size_t cap = 0;
+  for(struct dirent* cur=readdir(d); cur != NULL && err == 0;
+      cur=readdir(d)) {
+    if(cur->d_name[0] == '.') { continue; } /* skip hidden files. */
+    if(stk->nnames == cap) {
+      cap = cap == 0 ? 256 : cap*2;
+      char** names = realloc(stk->names, sizeof(char*)*cap);
+      if(names == NULL) { err = ENOMEM; break; }
+      stk->names = names;
+    }
+    stk->names[stk->nnames] = dirconcat(fn, cur->d_name);
+    if(stk->names[stk->nnames] == NULL) { err = ENOMEM; break; }
+    stk->nnames++;
+  }
+  if(closedir(d) != 0 && err == 0) { err = errno; }
+  if(err == 0 && stk->nnames < stk->dims[2]) { err = EINVAL; }
+  if(err == 0) {
+    /* readdir's order is arbitrary; slices go in lexicographic order. */
+    qsort(stk->names, stk->nnames, sizeof(char*), namecmp);
+    stk->npool = md->maxopen == 0 ? STACK_MAXOPEN : md->maxopen;
+    stk->pool = calloc(stk->npool, sizeof(struct slot));
+    if(stk->pool == NULL) { err = ENOMEM; }
+  }
+  for(size_t i=0; err == 0 && i < stk->npool; ++i) {
+    stk->pool[i].z = SIZE_MAX;
+  }
+  if(err == 0 && md->prefetch > 0) {
+    /* leave room for the slices being read. */
+    stk->prefetch = md->prefetch < stk->npool/2 ? md->prefetch
+                                                : stk->npool/2;
+    stk->threaded = stk->prefetch > 0 &&
+                    pthread_create(&stk->thread, NULL, prefetcher, stk) == 0;
+  }
+  if(err != 0) {
+    stack_close(stk);
     errno = err;
     return NULL;
   }
-
   return stk;
 }
 
-/* This is a bit confusing.  We only get 1D offsets, but we need 3D offsets to
- * do the reads correctly: for one, we need to know the Z offset because that
- * tells us which slice to read from.  Secondly, we need to loop because we
- * might have to read from multiple slices.  Instead of an explicit loop, we
- * solve the issue by recursing, with a base case of the desired reading
- * fitting on a single slice. */
+/* the read may begin part way through a slice and run on into the next
+ * ones; each piece is read from its own image. */
 static int
 stack_read(void* fd, const off_t offset, const size_t len, void* buf)
 {
-  const struct stack* stk = (struct stack*)fd;
+  struct stack* stk = (struct stack*)fd;
   assert(stk->components > 0);
   assert(stk->width > 0);
 
-  /* the offset is a byte offset, but we need the element# to be able to
-   * calculate the slice. */
-  const size_t start = offset / (stk->components*stk->width);
-  const off_t start3[3] = {
-    (start % stk->dims[0]),
-    (start / stk->dims[0]) % stk->dims[1],
-    (start / (stk->dims[0]*stk->dims[1])) % stk->dims[2]
-  };
-  assert(start3[0] >= 0 && start3[1] >= 0 && start3[2] >= 0);
-  assert((uint64_t)start3[0] < stk->dims[0] &&
-         (uint64_t)start3[1] < stk->dims[1] &&
-         (uint64_t)start3[2] < stk->dims[2]);
-  const size_t end = (offset+len) / (stk->components*stk->width);
-  assert(start < end);
-  const off_t end3[3] = {
-    (end % stk->dims[0]),
-    (end / stk->dims[0]) % stk->dims[1],
-    (end / (stk->dims[0]*stk->dims[1])) % stk->dims[2]
-  };
-  assert(end3[0] >= 0 && end3[1] >= 0 && end3[2] >= 0);
-  assert((uint64_t)end3[0] < stk->dims[0] &&
-         (uint64_t)end3[1] < stk->dims[1] &&
-         (uint64_t)end3[2] < stk->dims[2]);
-
-  /* read only up to the end of this slice. */
-  const uint64_t slice_sz = stk->dims[0]*stk->dims[1]*stk->components*stk->width;
-  const size_t length =
-    MIN(len, slice_sz - (int64_t)offset) > 0 ?
-      (size_t)MIN(len, slice_sz - (int64_t)offset) : len;
-  assert(length <= len || length <= slice_sz);
-  assert(length > 0);
-
-  void* img = ca_elem(stk->images, start3[2]);
-  ImageIO.read(img, start3[0]*start3[1]*stk->components*stk->width, length,
-               buf);
-  /* do we need to continue onto the next slice? */
-  if((len - length) > 0) {
-    return stack_read(fd, offset+length, len-length, buf+length);
+  if(stk->mode != OOK_RDONLY) { return EINVAL; }
+  const uint64_t slice = slicebytes(stk);
+  uint64_t at = (uint64_t)offset;
+  size_t left = len;
+  char* out = (char*)buf;
+  while(left > 0) {
+    const size_t z = at / slice;
+    const uint64_t within = at % slice;
+    if(z >= stk->dims[2]) { return EINVAL; }
+    const size_t n = slice - within < left ? (size_t)(slice - within) : left;
+    struct slot* s = acquire(stk, z, false);
+    if(s == NULL) { return errno; }
+    if(stk->threaded) {
+      pthread_mutex_lock(&stk->lock);
+      const size_t upto = z+1 + stk->prefetch < stk->dims[2] ?
+                          z+1 + stk->prefetch : stk->dims[2];
+      if(upto > stk->upto || stk->next > z+1) {
+        stk->next = z+1;
+        stk->upto = upto;
+        pthread_cond_broadcast(&stk->changed);
+      }
+      pthread_mutex_unlock(&stk->lock);
+    }
+    const int err = stk->img->read(s->img, (off_t)within, n, out);
+    release(stk, s);
+    if(err != 0) { return err; }
+    at += n;
+    out += n;
+    left -= n;
   }
   return 0;
 }
 
+/* writes must be of whole voxels, so that we can tell when a slice is
+ * complete. */
 static int
-stack_close(void* fd)
+stack_write(void* fd, const off_t offset, const size_t len, const void* buf)
 {
   struct stack* stk = (struct stack*)fd;
-  cleanup_images(stk->images);
-  ca_destroy(stk->images);
-  free(stk);
+  if(stk->mode != OOK_RDWR) { return EINVAL; }
+  const uint64_t vox = voxelbytes(stk);
+  if((uint64_t)offset % vox != 0 || len % vox != 0) { return EINVAL; }
+  const uint64_t slice = slicebytes(stk);
+  uint64_t at = (uint64_t)offset;
+  size_t left = len;
+  const char* in = (const char*)buf;
+  while(left > 0) {
+    const size_t z = at / slice;
+    const uint64_t within = at % slice;
+    if(z >= stk->dims[2]) { return EINVAL; }
+    const size_t n = slice - within < left ? (size_t)(slice - within) : left;
+    pthread_mutex_lock(&stk->lock);
+    int err = stk->werr;
+    if(err == 0 && stk->flushed[z]) { err = EINVAL; } /* already written. */
+    if(err == 0 && stk->bufs[z] == NULL) {
+      stk->bufs[z] = calloc(1, slice);
+      stk->written[z] = calloc((slice/vox + 63) / 64, sizeof(uint64_t));
+      if(stk->bufs[z] == NULL || stk->written[z] == NULL) {
+        free(stk->bufs[z]);
+        free(stk->written[z]);
+        stk->bufs[z] = NULL;
+        stk->written[z] = NULL;
+        err = ENOMEM;
+      }
+    }
+    if(err != 0) {
+      pthread_mutex_unlock(&stk->lock);
+      return err;
+    }
+    /* copied under the lock: a write overlapping ours could otherwise
+     * complete the slice, and queue it, while we are still copying. */
+    memcpy(stk->bufs[z] + within, in, n);
+    stk->filled[z] += mark(stk->written[z], within/vox, (within+n)/vox);
+    if(stk->filled[z] == slice/vox) { enqueue(stk, z); }
+    pthread_mutex_unlock(&stk->lock);
+    at += n;
+    in += n;
+    left -= n;
+  }
   return 0;
 }
 
 struct io StackIO = {
   .open = stack_open,
   .read = stack_read,
-  .write = NULL,
+  .write = stack_write,
   .close = stack_close,
   .preallocate = NULL
 };
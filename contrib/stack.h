@@ -2,8 +2,10 @@
 #define OOKCONTRIB_STACK_IO_H
 /* Stack is an IO interface for a stack of images.  Give it a directory and it
  * will assume each of the files in the directory is a single 2D slice of a 3D
- * dataset.  The ordering of the slices is lexographic based on filename. */
+ * dataset.  The ordering of the slices is lexographic based on filename.
+ * Writing creates such a directory, with one image per slice. */
 
+#include <stdbool.h>
 #include "io-interface.h"
 
 #ifdef __cplusplus
@@ -14,13 +16,35 @@ struct metadata {
   uint64_t voxels[3];
   size_t components;
   size_t width; /* in bytes */
+  /* images are opened as they are first read, and at most 'maxopen' are kept
+   * open at once; the least recently used is closed to make room.  0 means
+   * the default, 64. */
+  size_t maxopen;
+  /* after a read from slice z, open slices z+1 .. z+prefetch in the
+   * background.  0 disables prefetching. */
+  size_t prefetch;
+  /* decode each slice in full when it is first read (ImageIO_slice), rather
+   * than just the rows each read needs.  Pays off when every slice will be
+   * read completely, as when bricking the stack, and costs one decoded image
+   * per open slice. */
+  bool whole;
+  /* writing (ookcreate): the directory is created if need be, and slice z is
+   * written to a file named by z, zero-padded, plus 'suffix' (default
+   * ".tif"), which picks the format.  Slices are encoded by 'threads'
+   * threads (0: 4) as soon as every voxel of them has been written; writes
+   * must be of whole voxels, and may overlap.
+   * 'floating' says 4- and 8-byte values are float/double, not integers. */
+  const char* suffix;
+  size_t threads;
+  bool floating;
 };
 
 /* the 'state' should be set to a pointer to metadata.
- *  struct metadata md;
+ *  struct metadata md = {0};
  *  memcpy(md.voxels, voxels, sizeof(uint64_t)*3);
  *  md.components = components;
  *  md.width = sizeof(...);
+ *  md.prefetch = 2;
  *  struct io mystack = StackIO;
  *  mystack.state = &md;
  *  struct ookfile* of = ookread(mystack, "file", voxels, ...); */
@@ -51,6 +51,7 @@ usage(const char* progname)
 "\t-z  ditto, for Z dimension\n"
 "\t-m  minimum value to threshold with [default=%f]\n"
 "\t-M  maximum value to threshold with [default=%f]\n"
+"\t-v  print I/O statistics when done\n"
 "\t-o  output volume to create.  always creates a raw uint8 volume.\n\n"
 "Type names are generally 'i' for integer, 'u' for unsigned integer, "
 "followed by the byte width of the type.  The special types 'f' and 'd' "
@@ -112,7 +113,11 @@ main(int argc, char* const argv[])
     fprintf(stderr, "Initialization failed.\n");
     exit(EXIT_FAILURE);
   }
-  const size_t bricksize[3] = { 64, 64, 64 };
+  size_t bricksize[3];
+  if(ookautobricksize(vol, itype, 1, NULL, bricksize) != 0) {
+    fprintf(stderr, "Invalid volume dimensions.\n");
+    exit(EXIT_FAILURE);
+  }
 
   struct ookfile* fin = ookread(StdCIO, input, vol, bricksize, itype, 1);
   if(!fin) { perror("open"); exit(EXIT_FAILURE); }
@@ -138,14 +143,19 @@ main(int argc, char* const argv[])
   }
 
   printf("\n");
-  for(size_t brick=0; brick < ookbricks(fin); ++brick) {
+  const size_t nbricks = ookbricks(fin);
+  for(size_t brick=0; brick < nbricks; ++brick) {
     size_t bs[3];
     ookbricksize(fin, brick, bs);
     ookbrick(fin, brick, data);
     ookwrite(fout, brick, data);
-    printf("\rProcessed brick %5zu / %5zu...", brick, ookbricks(fin));
+    printf("\rProcessed brick %5zu / %5zu...", brick, nbricks);
   }
   printf("\n");
+  if(verbose) {
+    ookstats_json(fin, stderr);
+    ookstats_json(fout, stderr);
+  }
 
   free(data);
   free(outdata);
@@ -0,0 +1,248 @@
+/* DirectIO: an io-interface which bypasses the page cache.  Requests which
+ * are aligned to the file's block size (offset, length and buffer) go straight
+ * to the device; anything else is bounced through an aligned buffer.  Ook's
+ * 'ookalign' and 'ookalloc' arrange things so that bricks take the fast path.
+ * On systems without O_DIRECT, we ask the OS not to cache instead. */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "io-interface.h"
+
+struct dio {
+  int fd;
+  size_t align; /* required alignment of offsets, lengths and buffers. */
+  bool direct; /* did we manage to bypass the cache? */
+  off_t end; /* end of the last byte written; guarded by 'rmwlock'. */
+};
+
+/* an unaligned write rewrites the whole blocks around it, including bytes
+ * which belong to other bricks.  Two of them sharing a block would undo each
+ * other's changes, so they take turns: within the process under this lock,
+ * and with other processes under a write lock on the blocks. */
+static pthread_mutex_t rmwlock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool
+aligned(const struct dio* d, const off_t offset, const size_t len,
+        const void* buf)
+{
+  return (offset % d->align) == 0 && (len % d->align) == 0 &&
+         ((uintptr_t)buf % d->align) == 0;
+}
+
+/* pread/pwrite can return early; loop until we get everything.  Reads which
+ * hit EOF stop early and report how much they did get. */
+static int
+fullread(int fd, off_t offset, size_t len, char* buf, size_t* got)
+{
+  *got = 0;
+  while(len > 0) {
+    const ssize_t r = pread(fd, buf, len, offset);
+    if(r < 0 && errno == EINTR) { continue; }
+    if(r < 0) { return errno; }
+    if(r == 0) { break; } /* EOF */
+    buf += r; offset += r; len -= r; *got += r;
+  }
+  return 0;
+}
+
+static int
+fullwrite(int fd, off_t offset, size_t len, const char* buf)
+{
+  while(len > 0) {
+    const ssize_t w = pwrite(fd, buf, len, offset);
+    if(w < 0 && errno == EINTR) { continue; }
+    if(w < 0) { return errno; }
+    buf += w; offset += w; len -= w;
+  }
+  return 0;
+}
+
+/* takes ('type' F_WRLCK) or gives up (F_UNLCK) the file lock on a range.
+ * Open file description locks are held by the handle, and so survive other
+ * handles to the file being closed, where POSIX ones would not. */
+static int
+lockrange(const int fd, const short type, const off_t start, const size_t len)
+{
+  struct flock fl;
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = type;
+  fl.l_whence = SEEK_SET;
+  fl.l_start = start;
+  fl.l_len = (off_t)len;
+#ifdef F_OFD_SETLKW
+  const int cmd = F_OFD_SETLKW;
+#else
+  const int cmd = F_SETLKW;
+#endif
+  while(fcntl(fd, cmd, &fl) != 0) {
+    if(errno != EINTR) { return errno; }
+  }
+  return 0;
+}
+
+/* notes that the file now extends to 'end'. */
+static void
+extend(struct dio* d, const off_t end)
+{
+  pthread_mutex_lock(&rmwlock);
+  if(end > d->end) { d->end = end; }
+  pthread_mutex_unlock(&rmwlock);
+}
+
+static void*
+dio_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  (void) state;
+  int flags = O_RDONLY;
+  if(mode == OOK_RDWR) { flags = O_RDWR | O_CREAT | O_TRUNC; }
+  if(mode == OOK_UPDATE) { flags = O_RDWR; }
+  struct dio* d = calloc(1, sizeof(struct dio));
+  if(d == NULL) { errno = ENOMEM; return NULL; }
+#ifdef O_DIRECT
+  d->fd = open(fn, flags | O_DIRECT, 0666);
+  d->direct = d->fd != -1;
+  /* not every filesystem (e.g. tmpfs) supports O_DIRECT.  Still work there. */
+  if(d->fd == -1 && errno == EINVAL) {
+    d->fd = open(fn, flags, 0666);
+  }
+#else
+  d->fd = open(fn, flags, 0666);
+# ifdef F_NOCACHE
+  d->direct = d->fd != -1 && fcntl(d->fd, F_NOCACHE, 1) != -1;
+# endif
+#endif
+  if(d->fd == -1) {
+    const int err = errno;
+    free(d);
+    errno = err;
+    return NULL;
+  }
+  struct stat st;
+  d->align = 4096;
+  if(fstat(d->fd, &st) == 0 && st.st_blksize > 0) {
+    d->align = (size_t)st.st_blksize;
+  }
+  /* an existing file is already this long; never trim it at close. */
+  if(mode == OOK_UPDATE && fstat(d->fd, &st) == 0) { d->end = st.st_size; }
+  return d;
+}
+
+static int
+dio_read(void* fd, const off_t offset, const size_t len, void* buf)
+{
+  const struct dio* d = (const struct dio*) fd;
+  size_t got;
+  if(aligned(d, offset, len, buf)) {
+    const int err = fullread(d->fd, offset, len, buf, &got);
+    if(err != 0) { return err; }
+    return got == len ? 0 : EIO;
+  }
+  /* bounce: read the covering aligned region. */
+  const off_t start = offset - (offset % d->align);
+  const off_t end = offset + len;
+  const size_t span = ((end - start + d->align-1) / d->align) * d->align;
+  void* bounce;
+  if(posix_memalign(&bounce, d->align, span) != 0) { return ENOMEM; }
+  int err = fullread(d->fd, start, span, bounce, &got);
+  if(err == 0 && got < (size_t)(end - start)) { err = EIO; }
+  if(err == 0) { memcpy(buf, (char*)bounce + (offset-start), len); }
+  free(bounce);
+  return err;
+}
+
+static int
+dio_write(void* fd, const off_t offset, const size_t len, const void* buf)
+{
+  struct dio* d = (struct dio*) fd;
+  if(aligned(d, offset, len, buf)) {
+    const int err = fullwrite(d->fd, offset, len, buf);
+    if(err == 0) { extend(d, offset + (off_t)len); }
+    return err;
+  }
+  /* read-modify-write of the covering aligned region.  Anything past the
+   * current end of file reads as zeroes. */
+  const off_t start = offset - (offset % d->align);
+  const off_t end = offset + len;
+  const size_t span = ((end - start + d->align-1) / d->align) * d->align;
+  void* bounce;
+  if(posix_memalign(&bounce, d->align, span) != 0) { return ENOMEM; }
+  pthread_mutex_lock(&rmwlock);
+  int err = lockrange(d->fd, F_WRLCK, start, span);
+  if(err == 0) {
+    size_t got;
+    err = fullread(d->fd, start, span, bounce, &got);
+    if(err == 0) {
+      memset((char*)bounce + got, 0, span - got);
+      memcpy((char*)bounce + (offset-start), buf, len);
+      err = fullwrite(d->fd, start, span, bounce);
+    }
+    lockrange(d->fd, F_UNLCK, start, span);
+  }
+  if(err == 0 && end > d->end) { d->end = end; }
+  pthread_mutex_unlock(&rmwlock);
+  free(bounce);
+  return err;
+}
+
+static int
+dio_close(void* fd)
+{
+  struct dio* d = (struct dio*) fd;
+  int err = 0;
+  /* padding out a write to the block size can push the file past the last
+   * byte we were given.  Trim that back off. */
+  struct stat st;
+  pthread_mutex_lock(&rmwlock);
+  const off_t last = d->end;
+  pthread_mutex_unlock(&rmwlock);
+  if(last > 0 && fstat(d->fd, &st) == 0 && st.st_size > last) {
+    if(ftruncate(d->fd, last) != 0) { err = errno; }
+  }
+  if(close(d->fd) != 0 && err == 0) { err = errno; }
+  free(d);
+  return err;
+}
+
+static void
+dio_prealloc(void* fd, off_t len)
+{
+  struct dio* d = (struct dio*) fd;
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+  /* the file really is this long now; don't trim it at close. */
+  if(posix_fallocate(d->fd, 0, len) == 0) { extend(d, len); }
+#elif defined(F_PREALLOCATE)
+  /* reserves blocks without changing the file's size. */
+  fstore_t fs = {
+    .fst_flags = F_ALLOCATECONTIG, .fst_posmode = F_PEOFPOSMODE,
+    .fst_offset = 0, .fst_length = len
+  };
+  if(fcntl(d->fd, F_PREALLOCATE, &fs) == -1) {
+    fs.fst_flags = F_ALLOCATEALL;
+    (void) fcntl(d->fd, F_PREALLOCATE, &fs);
+  }
+#else
+  (void) d; (void) len;
+#endif
+}
+
+struct io DirectIO = {
+  .open = dio_open,
+  .read = dio_read,
+  .write = dio_write,
+  .close = dio_close,
+  .preallocate = dio_prealloc,
+  .punch = NULL,
+  .hole = NULL,
+  .vread = NULL,
+  .vwrite = NULL
+};
@@ -20,7 +20,9 @@
  * implementation knows/assumes what 'open' returned.
  * @return NULL on failure, identifier on success. */
 /**@{*/
-enum OOKMODE { OOK_RDONLY, OOK_RDWR };
+/* OOK_RDWR creates (or truncates) the file; OOK_UPDATE opens an existing
+ * file for reading and writing, and must leave its contents alone. */
+enum OOKMODE { OOK_RDONLY, OOK_RDWR, OOK_UPDATE };
 typedef void* (opener)(const char* fn, const enum OOKMODE, const void*);
 /**@}*/
 
@@ -57,6 +59,44 @@ typedef int (closer)(void* fd);
  *       support it. */
 typedef void (prealloc)(void*, off_t len);
 
+/** A puncher deallocates ('punches a hole' in) the given byte range, which
+ * then reads back as zeroes.  A range that does not cover whole filesystem
+ * blocks is still zeroed, but may not free any space.  Punching past the end
+ * of the file extends the file.
+ * @note This function is optional; set it to NULL if your interface cannot
+ *       support it.  Ook writes zeroes instead when it is NULL or fails.
+ * @returns 0 on success, an error code on error. */
+typedef int (puncher)(void* fd, const off_t offset, const size_t len);
+
+/** A hole test reports whether the given byte range is entirely unallocated,
+ * and therefore reads back as zeroes without any need to actually read it.
+ * @note This function is optional; set it to NULL if your interface cannot
+ *       support it.
+ * @returns nonzero if the entire range is a hole, 0 otherwise. */
+typedef int (holetest)(void* fd, const off_t offset, const size_t len);
+
+/** One piece of a vectored request: 'len' bytes at file offset 'offset', to
+ * or from 'buf'. */
+struct ookiov {
+  off_t offset;
+  size_t len;
+  void* buf;
+};
+
+/** A vectored reader performs all 'n' reads in 'iov', in any order and
+ * possibly concurrently; Ook uses it to hand over a whole brick at once.
+ * Like 'reader', it is atomic: it succeeds only if every piece was read.
+ * @note This function is optional; set it to NULL if your interface cannot
+ *       support it.  Ook calls 'read' once per piece when it is NULL.
+ * @returns 0 on success, an error code on error. */
+typedef int (vreader)(void* fd, const struct ookiov* iov, const size_t n);
+
+/** The vectored counterpart of 'writer'.  The pieces never overlap.
+ * @note This function is optional; set it to NULL if your interface cannot
+ *       support it.
+ * @returns 0 on success, an error code on error. */
+typedef int (vwriter)(void* fd, const struct ookiov* iov, const size_t n);
+
 extern reader* stdc_reader;
 
 struct io {
@@ -65,8 +105,31 @@ struct io {
   writer* write;
   closer* close;
   prealloc* preallocate;
+  puncher* punch;
+  holetest* hole;
+  vreader* vread;
+  vwriter* vwrite;
   const void* state;
 };
 extern struct io StdCIO;
+/* like StdCIO, but bypasses the OS' page cache (O_DIRECT). */
+extern struct io DirectIO;
+
+/** StripeIO presents several files as one logical volume.  Set the 'state'
+ * to a 'struct ookstripe'; the filename given to ookread/ookcreate is not
+ * used.  The files are either concatenated (e.g. one file per slab of Z
+ * slices) or, if 'stripe' is nonzero, striped round-robin in units of
+ * 'stripe' bytes, as RAID 0 does.  Requests which touch several files are
+ * serviced by one thread per file, so files on different devices are read
+ * in parallel. */
+struct ookstripe {
+  const char* const* files;
+  size_t n; /* number of files. */
+  /* concatenated: the size of every file but the last, which holds whatever
+   * remains.  If 0, the files' actual sizes are used (reading only). */
+  uint64_t chunk;
+  size_t stripe; /* striped: bytes per stripe unit.  0 to concatenate. */
+};
+extern struct io StripeIO;
 
 #endif
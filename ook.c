@@ -1,14 +1,30 @@
+#define _POSIX_C_SOURCE 200112L
+#define _DEFAULT_SOURCE /* for MAP_ANONYMOUS */
 #include <assert.h>
 #include <errno.h>
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+/* the SSSE3 byteswap is compiled for that target on its own, and only used
+ * when the CPU we run on has it; the rest of the build stays baseline. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define OOK_SSSE3 1
+# include <tmmintrin.h>
+#endif
 #include "io-interface.h"
 #include "ook.h"
+#include "shmcache.h"
+#include "trace.h"
 
 struct ookfile {
   void* fd;
@@ -17,6 +33,28 @@ struct ookfile {
   uint64_t volsize[3];
   enum OOKTYPE type;
   size_t components;
+  enum OOKMODE mode;
+  size_t align; /* block size the file layout is padded to; 0 if unpadded. */
+  size_t pitch; /* bytes between brick scanlines in a padded layout. */
+  bool sparse; /* punch zero bricks out on write, skip holes on read. */
+  bool punched; /* preallocated space has been given back; see 'ooksparse'. */
+  struct ookstats* stats; /* separate, so that const ookfiles can update it */
+  struct ooktrace* trace; /* timeline of operations, if enabled. */
+  char* tracefile; /* where to write 'trace' when the file is closed. */
+  /* geometry, computed once by 'geometry'. */
+  size_t layout[3]; /* number of bricks per dimension. */
+  size_t nbricks;
+  size_t* edge[3]; /* extent of the i'th brick along each dimension. */
+  uint64_t* origin[3]; /* first voxel of the i'th brick along each dim. */
+  bool swap; /* file's byte order differs from ours.  see 'ookendian'. */
+  char* filename; /* as given to open; identifies the file to the cache. */
+  struct shmcache* cache; /* bricks shared between processes, if enabled. */
+  struct cachekey cachekey; /* everything but the brick ID. */
+  size_t sievegap; /* see 'ooksieve'; 0 if not sieving. */
+  size_t sievebuf; /* the most one sieved transfer may cover. */
+  pthread_mutex_t* sievelock; /* serializes sieved writes. */
+  off_t brickmajor; /* where brick 0 starts, in a file from 'ookrebrick'.
+                       0 in an x-fastest file. */
 };
 
 #ifndef NDEBUG
@@ -27,28 +65,108 @@ static int test();
 #  define CONST __attribute__((const))
 #  define MALLOC __attribute__((malloc))
 #  define PURE __attribute__((pure))
+#  define STATADD(var, n) __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
 #else
 #  define CONST /* no const function support */
 #  define MALLOC /* no malloc function support */
 #  define PURE /* no pure function support */
+#  define STATADD(var, n) ((var) += (n)) /* not thread-safe. */
 #endif
 
-/* returns the brick layout (number of bricks per dimension) for the given
- * file. */
-static void blayout(const struct ookfile* of, size_t nbricks[3]);
+/** fills in the layout and per-axis tables of the file.
+ * @return 0 on success, an error code on failure. */
+static int geometry(struct ookfile* of);
+/** frees what 'geometry' allocated. */
+static void geometry_free(struct ookfile* of);
 /** @return the number of bytes a given type needs. */
 PURE static size_t width(enum OOKTYPE t);
+/** @return a monotonic timestamp, in nanoseconds. */
+static uint64_t clocknow();
+/** adds an operation which started at 'start' to the latency histogram. */
+static void latency(const struct ookfile* of, enum OOKOP op, uint64_t start,
+                    uint64_t arg);
+/** the histogram half of 'latency', for an operation which took 'ns'. */
+static void histogram(const struct ookfile* of, enum OOKOP op, uint64_t ns);
+/** records an event in the timeline, if tracing is enabled. */
+static void traceop(const struct ookfile* of, const char* name,
+                    uint64_t start, const char* argname, uint64_t arg);
 /** converts brick 1D ID to 3D ID.
  * @param id the 1-dimensional brick ID
  * @param layout the layout of bricks in the dataset (# bricks per dim)
  * @param[out] brick where the 3D index (output) is stored */
 static void bidxto3d(const size_t id, const size_t layout[3], size_t brick[3]);
+/** fills in any zero fields of the constraints with values for this host. */
+static void hostconstraints(struct ookconstraints* c);
+/** picks a brick extent near 'want' for a dimension of 'dim' voxels. */
+static size_t extent(const uint64_t dim, size_t want, const size_t elem,
+                     const size_t align);
 
 /* a read or write operation on the opaque ook interface. */
 typedef int (rwop)(void* fd, const off_t offset, const size_t len, void* buf);
+/* a subset of a file's components, and how to lay them out in memory.  see
+ * 'ookbrick_components'. */
+struct selection {
+  size_t n; /* number of components selected. */
+  size_t comp[64]; /* the selected components, in increasing order. */
+  enum OOKLAYOUT layout;
+  char* scratch; /* holds one whole (all-component) scanline. */
+};
 /** identifies the location of data within the larger set, and moves data
- * between the two places. */
-static void srcop(rwop* op, const struct ookfile* of, size_t id, void* buffer);
+ * between the two places.  If 'sel' is non-NULL, only the selected
+ * components are copied out of the file (reads only). */
+static void srcop(rwop* op, const struct ookfile* of, size_t id, void* buffer,
+                  const struct selection* sel);
+/** reverses the bytes of each of the 'n' values of 'w' bytes in 'src',
+ * storing them in 'dst'.  'dst' may be 'src'. */
+#ifdef OOK_SSSE3
+/** byteswaps the leading values of 'n' values of 'w' bytes, 16 bytes at a
+ * time, as 'byteswap'.  @return the number of values done. */
+static size_t byteswap_ssse3(char* dst, const char* src, const size_t n,
+                             const size_t w);
+#endif
+static void byteswap(void* dst, const void* src, const size_t n,
+                     const size_t w);
+/** copies the selected components of 'n' voxels out of a whole scanline.
+ * @param first index of the scanline's first voxel within the brick
+ * @param nvox number of voxels in the brick */
+static void scatter(const struct selection* sel, const char* scanline,
+                    const size_t w, const size_t c, const size_t first,
+                    const size_t n, const size_t nvox, char* out);
+/** calls the io-interface and keeps the statistics up to date. */
+static int iocall(rwop* op, const struct ookfile* of, const off_t offset,
+                  const size_t len, void* buf);
+/** hands a whole list of pieces to a vectored io-interface call. */
+static int viocall(vreader* vop, const struct ookfile* of,
+                   const struct ookiov* iov, const size_t n);
+/** moves a single scanline of a padded layout.  see 'ookalign'. */
+static int padop(rwop* op, const struct ookfile* of, const off_t offset,
+                 const size_t scanline, char* buf, char* bounce);
+/** @return the file offset of the scanline starting at the given voxel. */
+static off_t scanoffset(const struct ookfile* of, const size_t layout[3],
+                        const size_t bx, const uint64_t at[3]);
+/** @return true if the given memory is entirely zero. */
+static bool zeroes(const void* mem, const size_t n);
+/** punches a brick's region out of the file.  see 'ooksparse'. */
+static int punch(const struct ookfile* of, const size_t layout[3],
+                 const size_t bx, const uint64_t origin[3],
+                 const size_t bsize[3]);
+/** reads a whole brick, going through the shared cache if there is one. */
+static void cachedread(const struct ookfile* of, size_t id, void* data);
+/** @return true if the shared cache had the brick, now copied to 'data'. */
+static bool cachehit(const struct ookfile* of, size_t id, void* data);
+/** reads a list of pieces sorted by offset, a span at a time.  see
+ * 'ooksieve'. */
+static int readruns(const struct ookfile* of, const struct ookiov* iov,
+                    const size_t n, const size_t gap, const size_t maxspan);
+/** writes a list of pieces sorted by offset, a span at a time. */
+static int sievewrite(const struct ookfile* of, const struct ookiov* iov,
+                      const size_t n);
+/** @return the number of voxels in the bricks before brick 'id'. */
+static uint64_t voxelsbefore(const struct ookfile* of, const size_t id);
+/** @return the file offset of a brick of a brick-major file. */
+static off_t brickstart(const struct ookfile* of, const size_t id);
+/** gives the shared cache, if any, the (host order) contents of a brick. */
+static void cacheput(const struct ookfile* of, size_t id, const void* data);
 
 bool
 ookinit()
@@ -59,9 +177,12 @@ ookinit()
   return true;
 }
 
-struct ookfile*
-ookread(struct io iop, const char* fn, const uint64_t voxels[3],
-        const size_t bsize[3], const enum OOKTYPE type, const size_t components)
+/* opens 'fn' in the given mode and sets up everything but the mode-specific
+ * parts of the ookfile. */
+static struct ookfile*
+ookopen(struct io iop, const char* fn, const enum OOKMODE mode,
+        const uint64_t voxels[3], const size_t bsize[3],
+        const enum OOKTYPE type, const size_t components)
 {
   if(fn == NULL) { errno = EINVAL; return NULL; }
   /* bricks can't be larger than data size. */
@@ -76,11 +197,27 @@ ookread(struct io iop, const char* fn, const uint64_t voxels[3],
     errno = ENOMEM;
     return NULL;
   }
+  of->stats = calloc(1, sizeof(struct ookstats));
+  if(of->stats == NULL) {
+    free(of);
+    errno = ENOMEM;
+    return NULL;
+  }
+  of->filename = malloc(strlen(fn)+1);
+  if(of->filename == NULL) {
+    free(of->stats);
+    free(of);
+    errno = ENOMEM;
+    return NULL;
+  }
+  strcpy(of->filename, fn);
   of->iop = iop;
-  of->fd = iop.open(fn, OOK_RDONLY, of->iop.state);
+  of->fd = iop.open(fn, mode, of->iop.state);
 
   if(of->fd == NULL) {
     const int err = errno;
+    free(of->filename);
+    free(of->stats);
     free(of);
     errno = err;
     return NULL;
@@ -89,23 +226,50 @@ ookread(struct io iop, const char* fn, const uint64_t voxels[3],
   memcpy(of->bricksize, bsize, sizeof(size_t)*3);
   of->type = type;
   of->components = components;
+  of->mode = mode;
+  const int err = geometry(of);
+  if(err != 0) {
+    geometry_free(of);
+    of->iop.close(of->fd);
+    free(of->filename);
+    free(of->stats);
+    free(of);
+    errno = err;
+    return NULL;
+  }
   return of;
 }
 
+struct ookfile*
+ookread(struct io iop, const char* fn, const uint64_t voxels[3],
+        const size_t bsize[3], const enum OOKTYPE type, const size_t components)
+{
+  return ookopen(iop, fn, OOK_RDONLY, voxels, bsize, type, components);
+}
+
+/* opens an existing file for reading and writing.  Nothing is truncated,
+ * preallocated or punched: bricks which aren't written keep their data. */
+struct ookfile*
+ookupdate(struct io iop, const char* fn, const uint64_t voxels[3],
+          const size_t bsize[3], const enum OOKTYPE type,
+          const size_t components)
+{
+  if(iop.read == NULL || iop.write == NULL) { errno = EINVAL; return NULL; }
+  return ookopen(iop, fn, OOK_UPDATE, voxels, bsize, type, components);
+}
+
 size_t
 ookbricks(const struct ookfile* ook)
 {
   if(ook == NULL) { errno = EINVAL; return 0; }
-  size_t nbricks[3];
-  blayout(ook, nbricks);
-  return nbricks[0] * nbricks[1] * nbricks[2];
+  return ook->nbricks;
 }
 
 void
 ooklayout(const struct ookfile* of, size_t layout[3])
 {
   if(of == NULL) { errno = EINVAL; return; }
-  blayout(of, layout);
+  memcpy(layout, of->layout, sizeof(size_t)*3);
 }
 
 void
@@ -120,7 +284,9 @@ int
 ookbrick(const struct ookfile* of, size_t id, void* target)
 {
   errno = 0;
-  srcop(of->iop.read, of, id, target);
+  const uint64_t start = clocknow();
+  cachedread(of, id, target);
+  latency(of, OOK_OP_BRICK, start, id);
   return errno;
 }
 
@@ -132,10 +298,43 @@ ookbrick3(const struct ookfile* of, const size_t id[3], void* data)
   /* Somewhat humorously, 'srcop' needs the 1D index---which it just goes and
    * converts to a 3D index anyway.  To satisfy the interface, for now, we just
    * convert 3D to 1D and let 'srcop' convert it back. */
-  size_t layout[3];
-  blayout(of, layout);
+  const size_t* layout = of->layout;
   const size_t bid = id[2]*layout[0]*layout[1] + id[1]*layout[0] + id[0];
-  srcop(of->iop.read, of, bid, data);
+  const uint64_t start = clocknow();
+  cachedread(of, bid, data);
+  latency(of, OOK_OP_BRICK, start, bid);
+  return errno;
+}
+
+/* copies only the components in 'mask' of the given brick into 'data'.  With
+ * OOK_PLANAR, each component gets a plane of its own: all of component 0's
+ * values for the brick, then all of component 1's, and so on. */
+int
+ookbrick_components(const struct ookfile* of, size_t id, uint64_t mask,
+                    enum OOKLAYOUT layout, void* data)
+{
+  if(of == NULL || data == NULL || mask == 0) { return EINVAL; }
+  if(layout != OOK_INTERLEAVED && layout != OOK_PLANAR) { return EINVAL; }
+  if(of->components < 64 && (mask >> of->components) != 0) { return EINVAL; }
+  const uint64_t all = of->components >= 64 ? UINT64_MAX
+                                            : (UINT64_C(1) << of->components)-1;
+  /* everything, as it is on disk: nothing to pick apart. */
+  if(mask == all && (layout == OOK_INTERLEAVED || of->components == 1)) {
+    return ookbrick(of, id, data);
+  }
+  struct selection sel;
+  sel.n = 0;
+  for(size_t i=0; i < 64; ++i) {
+    if(mask & (UINT64_C(1) << i)) { sel.comp[sel.n++] = i; }
+  }
+  sel.layout = layout;
+  sel.scratch = malloc(of->bricksize[0] * of->components * width(of->type));
+  if(sel.scratch == NULL) { return ENOMEM; }
+  errno = 0;
+  const uint64_t start = clocknow();
+  srcop(of->iop.read, of, id, data, &sel);
+  latency(of, OOK_OP_BRICK, start, id);
+  free(sel.scratch);
   return errno;
 }
 
@@ -151,30 +350,9 @@ ookcreate(struct io iop, const char* filename,
           const uint64_t dims[3], const size_t bsize[3],
           enum OOKTYPE type, size_t components)
 {
-  if(filename == NULL) { errno = EINVAL; return NULL; }
-  /* bricks can't be larger than data size. */
-  if(bsize[0] > dims[0] ||
-     bsize[1] > dims[1] ||
-     bsize[2] > dims[2]) {
-    errno = EINVAL;
-    return NULL;
-  }
-  struct ookfile* of = calloc(1, sizeof(struct ookfile));
-  if(of == NULL) {
-    errno = ENOMEM;
-    return NULL;
-  }
-  of->iop = iop;
-  of->fd = iop.open(filename, OOK_RDWR, iop.state);
-  if(of->fd == NULL) {
-    free(of);
-    errno = EINVAL;
-    return NULL;
-  }
-  memcpy(of->volsize, dims, sizeof(uint64_t)*3);
-  memcpy(of->bricksize, bsize, sizeof(size_t)*3);
-  of->type = type;
-  of->components = components;
+  struct ookfile* of = ookopen(iop, filename, OOK_RDWR, dims, bsize, type,
+                               components);
+  if(of == NULL) { return NULL; }
 
   if(of->iop.preallocate) {
     const off_t sz = width(type) * components * dims[0]*dims[1]*dims[2];
@@ -191,42 +369,25 @@ void
 ookbricksize(const struct ookfile* of, const size_t id, size_t bsize[3])
 {
   if(of == NULL) { errno = EINVAL; return; }
-  const double nbricks[3] = {
-    of->volsize[0] / of->bricksize[0],
-    of->volsize[1] / of->bricksize[1],
-    of->volsize[2] / of->bricksize[2]
-  };
-  size_t layout[3];
-  blayout(of, layout);
   size_t bid[3];
-  bidxto3d(id, layout, bid);
-  memcpy(bsize, of->bricksize, sizeof(size_t)*3);
-  for(size_t i=0; i < 3; ++i) {
-		if(bid[i] == nbricks[i]) {
-			bsize[i] = of->volsize[i] % of->bricksize[i];
-		}
-  }
+  bidxto3d(id, of->layout, bid);
+  bsize[0] = of->edge[0][bid[0]];
+  bsize[1] = of->edge[1][bid[1]];
+  bsize[2] = of->edge[2][bid[2]];
 }
 
 void
 ookbricksize3(const struct ookfile* of, const size_t bid[3], size_t bsize[3])
 {
   if(of == NULL) { errno = EINVAL; return; }
-  const double nbricks[3] = {
-    of->volsize[0] / of->bricksize[0],
-    of->volsize[1] / of->bricksize[1],
-    of->volsize[2] / of->bricksize[2]
-  };
-  if(bid[0] > nbricks[0] || bid[1] > nbricks[1] || bid[2] > nbricks[2]) {
+  if(bid[0] >= of->layout[0] || bid[1] >= of->layout[1] ||
+     bid[2] >= of->layout[2]) {
     errno = EINVAL;
     return;
   }
-  memcpy(bsize, of->bricksize, sizeof(size_t)*3);
-  for(size_t i=0; i < 3; ++i) {
-		if(bid[i] == nbricks[i]) {
-			bsize[i] = of->volsize[i] % of->bricksize[i];
-		}
-  }
+  bsize[0] = of->edge[0][bid[0]];
+  bsize[1] = of->edge[1][bid[1]];
+  bsize[2] = of->edge[2][bid[2]];
 }
 
 void
@@ -234,30 +395,342 @@ ookwrite(struct ookfile* of, const size_t id, const void* from)
 {
   /* 'srcop' is defined for a 'read' buffer, which doesn't have the same
    * "const"s: hence the casting. */
-  srcop((rwop*)of->iop.write, of, id, (void*)from);
+  const uint64_t start = clocknow();
+  const void* original = from;
+  void* swapped = NULL;
+  if(of->swap && id < of->nbricks) {
+    /* we can't touch the caller's data, so swap into a copy. */
+    size_t bs[3];
+    ookbricksize(of, id, bs);
+    const size_t n = bs[0]*bs[1]*bs[2] * of->components;
+    swapped = malloc(n * width(of->type));
+    if(swapped == NULL) { errno = ENOMEM; return; }
+    byteswap(swapped, from, n, width(of->type));
+    from = swapped;
+  }
+  const int before = errno;
+  errno = 0;
+  srcop((rwop*)of->iop.write, of, id, (void*)from, NULL);
+  free(swapped);
+  if(errno == 0) {
+    /* keep other processes' view of the brick current. */
+    cacheput(of, id, original);
+    errno = before;
+  }
+  latency(of, OOK_OP_OOKWRITE, start, id);
+}
+
+/* declares the byte order of the data in the file.  Bricks are converted to
+ * and from the host's byte order as they are read and written. */
+int
+ookendian(struct ookfile* of, enum OOKENDIAN order)
+{
+  if(of == NULL) { return EINVAL; }
+  const uint16_t one = 1;
+  const bool big = *(const uint8_t*)&one == 0;
+  switch(order) {
+    case OOK_NATIVE: of->swap = false; break;
+    case OOK_LITTLE: of->swap = big; break;
+    case OOK_BIG: of->swap = !big; break;
+    default: return EINVAL;
+  }
+  /* single bytes have no order. */
+  if(width(of->type) == 1) { of->swap = false; }
+  return 0;
+}
+
+/* turns on the timeline of operations.  It is written to 'filename' as
+ * trace-event JSON when the file is closed. */
+int
+ooktrace(struct ookfile* of, const char* filename)
+{
+  if(of == NULL || filename == NULL) { return EINVAL; }
+  if(of->trace != NULL) { return EBUSY; }
+  of->tracefile = malloc(strlen(filename)+1);
+  if(of->tracefile == NULL) { return ENOMEM; }
+  strcpy(of->tracefile, filename);
+  of->trace = trace_create(1U << 16);
+  if(of->trace == NULL) {
+    free(of->tracefile);
+    of->tracefile = NULL;
+    return ENOMEM;
+  }
+  return 0;
+}
+
+/* shares bricks read from this file with every other process that attaches
+ * to the cache called 'name'.  The cache is created with room for 'bytes'
+ * bytes if it does not exist yet. */
+int
+ookshmcache(struct ookfile* of, const char* name, size_t bytes)
+{
+  if(of == NULL || name == NULL || bytes == 0) { return EINVAL; }
+  if(of->cache != NULL) { return EBUSY; }
+  /* the same file under a different name (or a new file under the same
+   * name) must map to the same (or a different) set of bricks. */
+  struct stat st;
+  if(stat(of->filename, &st) != 0) { return errno; }
+  struct cachekey key;
+  memset(&key, 0, sizeof(struct cachekey));
+  key.file[0] = (uint64_t)st.st_dev;
+  key.file[1] = (uint64_t)st.st_ino;
+  key.file[2] = (uint64_t)st.st_mtime;
+#ifdef __APPLE__
+  key.file[3] = (uint64_t)st.st_mtimespec.tv_nsec;
+#else
+  key.file[3] = (uint64_t)st.st_mtim.tv_nsec;
+#endif
+  /* a brick's contents depend on how the file is read, too. */
+  for(size_t i=0; i < 3; ++i) {
+    key.geometry[i] = of->volsize[i];
+    key.geometry[3+i] = of->bricksize[i];
+  }
+  key.geometry[6] = ((uint64_t)of->type << 32) | of->components;
+  key.geometry[7] = ((uint64_t)of->align << 1) | (of->swap ? 1 : 0);
+
+  const size_t slot = of->bricksize[0]*of->bricksize[1]*of->bricksize[2] *
+                      of->components * width(of->type);
+  of->cache = shmcache_open(name, bytes, slot);
+  if(of->cache == NULL) { return errno; }
+  of->cachekey = key;
+  return 0;
+}
+
+/* removes the named cache.  Processes still attached keep using it. */
+int
+ookshmcache_unlink(const char* name)
+{
+  if(name == NULL) { return EINVAL; }
+  return shm_unlink(name) == 0 ? 0 : errno;
+}
+
+int
+ookstats(const struct ookfile* of, struct ookstats* st)
+{
+  if(of == NULL || st == NULL) { return EINVAL; }
+  memcpy(st, of->stats, sizeof(struct ookstats));
+  return 0;
+}
+
+static void
+jsonhist(FILE* fp, const char* name, const struct ookstats* st, enum OOKOP op)
+{
+  uint64_t count = 0;
+  for(size_t i=0; i < OOK_HISTBUCKETS; ++i) { count += st->latency[op][i]; }
+  fprintf(fp, "    \"%s\": { \"count\": %" PRIu64 ", \"ns\": %" PRIu64
+          ", \"hist\": [", name, count, st->nanoseconds[op]);
+  for(size_t i=0; i < OOK_HISTBUCKETS; ++i) {
+    fprintf(fp, "%s%" PRIu64, i == 0 ? "" : ",", st->latency[op][i]);
+  }
+  fprintf(fp, "] }");
+}
+
+/* dumps the statistics as a JSON object.  Histogram bucket 'i' counts the
+ * operations which took [2^i, 2^(i+1)) nanoseconds. */
+int
+ookstats_json(const struct ookfile* of, FILE* fp)
+{
+  if(of == NULL || fp == NULL) { return EINVAL; }
+  struct ookstats st;
+  ookstats(of, &st);
+  const double amplification = st.brick_bytes_read == 0 ? 0.0 :
+    (double)st.bytes_read / st.brick_bytes_read;
+  fprintf(fp, "{\n"
+          "  \"bricks_read\": %" PRIu64 ",\n"
+          "  \"bricks_written\": %" PRIu64 ",\n"
+          "  \"brick_bytes_read\": %" PRIu64 ",\n"
+          "  \"brick_bytes_written\": %" PRIu64 ",\n"
+          "  \"read_calls\": %" PRIu64 ",\n"
+          "  \"write_calls\": %" PRIu64 ",\n"
+          "  \"bytes_read\": %" PRIu64 ",\n"
+          "  \"bytes_written\": %" PRIu64 ",\n"
+          "  \"punch_calls\": %" PRIu64 ",\n"
+          "  \"hole_calls\": %" PRIu64 ",\n"
+          "  \"cache_hits\": %" PRIu64 ",\n"
+          "  \"cache_misses\": %" PRIu64 ",\n"
+          "  \"read_amplification\": %.4f,\n"
+          "  \"latency\": {\n",
+          st.bricks_read, st.bricks_written, st.brick_bytes_read,
+          st.brick_bytes_written, st.read_calls, st.write_calls,
+          st.bytes_read, st.bytes_written, st.punch_calls, st.hole_calls,
+          st.cache_hits, st.cache_misses, amplification);
+  jsonhist(fp, "read", &st, OOK_OP_READ);
+  fprintf(fp, ",\n");
+  jsonhist(fp, "write", &st, OOK_OP_WRITE);
+  fprintf(fp, ",\n");
+  jsonhist(fp, "ookbrick", &st, OOK_OP_BRICK);
+  fprintf(fp, ",\n");
+  jsonhist(fp, "ookwrite", &st, OOK_OP_OOKWRITE);
+  fprintf(fp, "\n  }\n}\n");
+  return ferror(fp) ? EIO : 0;
 }
 
 int
 ookclose(struct ookfile* of)
 {
   if(of == NULL) { return EINVAL; }
+  const uint64_t start = of->trace ? clocknow() : 0;
   int errcode = of->iop.close(of->fd);
+  if(of->trace) {
+    traceop(of, "close", start, NULL, 0);
+    FILE* fp = fopen(of->tracefile, "w");
+    const int err = fp == NULL ? errno : trace_flush(of->trace, fp);
+    if(fp != NULL && fclose(fp) != 0 && errcode == 0) { errcode = errno; }
+    if(errcode == 0) { errcode = err; }
+    trace_destroy(of->trace);
+    free(of->tracefile);
+  }
+  shmcache_close(of->cache);
+  geometry_free(of);
+  free(of->filename);
+  if(of->sievelock) {
+    pthread_mutex_destroy(of->sievelock);
+    free(of->sievelock);
+  }
+  free(of->stats);
   free(of);
   return errcode;
 }
 
-/* returns the brick layout (number of bricks per dimension) for the given
- * file. */
-static void
-blayout(const struct ookfile* of, size_t nbricks[3])
+/* switches the file to a padded layout: every brick scanline starts on a
+ * 'block' boundary and occupies a whole number of blocks.  The file is still
+ * X-fastest, but each row of the volume is split into one padded chunk per
+ * brick.  Transfers then never straddle a block, which is what O_DIRECT
+ * wants.  This changes what is on disk, so readers must use the same value
+ * that the file was written with. */
+int
+ookalign(struct ookfile* of, size_t block)
+{
+  if(of == NULL || block == 0 || (block & (block-1)) != 0) { return EINVAL; }
+  if(of->brickmajor != 0) { return EOPNOTSUPP; }
+  const size_t scanline = of->bricksize[0] * of->components * width(of->type);
+  const size_t pitch = ((scanline + block-1) / block) * block;
+  of->align = block;
+  of->pitch = pitch;
+
+  if(of->mode == OOK_RDWR && of->iop.preallocate) {
+    const off_t sz = of->volsize[1]*of->volsize[2] * of->layout[0] * pitch;
+    of->iop.preallocate(of->fd, sz);
+  }
+  return 0;
+}
+
+/* allocates memory for one (maximally-sized) brick.  the memory is aligned
+ * such that, in a padded layout, scanlines can go straight to the
+ * io-interface without an intermediate copy. */
+void*
+ookalloc(const struct ookfile* of)
+{
+  if(of == NULL) { errno = EINVAL; return NULL; }
+  const size_t bytes = of->bricksize[0]*of->bricksize[1]*of->bricksize[2] *
+                       of->components * width(of->type);
+  size_t alignment = of->align;
+  if(alignment == 0) {
+    const long page = sysconf(_SC_PAGESIZE);
+    alignment = page > 0 ? (size_t)page : 4096;
+  }
+  if(alignment < sizeof(void*)) { alignment = sizeof(void*); }
+  void* mem;
+  const int err = posix_memalign(&mem, alignment, bytes);
+  if(err != 0) { errno = err; return NULL; }
+  return mem;
+}
+
+void
+ookfree(void* mem)
+{
+  free(mem);
+}
+
+/* chooses a brick size for the given volume.  We start with X, because a
+ * brick's X extent is what becomes a single transfer in the I/O layer; it must
+ * be at least the requested scanline length.  The remaining budget is then
+ * split evenly between Y and Z. */
+int
+ookautobricksize(const uint64_t dims[3], enum OOKTYPE type, size_t components,
+                 const struct ookconstraints* cons, size_t bsize[3])
+{
+  if(dims == NULL || bsize == NULL || components == 0) { return EINVAL; }
+  if(dims[0] == 0 || dims[1] == 0 || dims[2] == 0) { return EINVAL; }
+  struct ookconstraints c = { 0, 0, 0, 0 };
+  if(cons != NULL) { c = *cons; }
+  hostconstraints(&c);
+
+  const size_t elem = width(type) * components;
+  size_t budget = (c.cache < c.memory ? c.cache : c.memory) / elem;
+  if(budget == 0) { budget = 1; }
+
+  size_t want = (c.scanline + elem-1) / elem;
+  const size_t cube = (size_t) cbrt((double)budget);
+  if(want < cube) { want = cube; }
+  if(want > c.memory / elem) { want = c.memory / elem; }
+  bsize[0] = extent(dims[0], want, elem, c.iosize);
+
+  size_t plane = budget / bsize[0];
+  if(plane == 0) { plane = 1; }
+  size_t wy = (size_t) sqrt((double)plane);
+  if(wy == 0) { wy = 1; }
+  /* a thin volume can't use all of its Z budget; give the rest to Y. */
+  if(wy > dims[2]) { wy = plane / dims[2]; }
+  bsize[1] = extent(dims[1], wy, elem, 0);
+  bsize[2] = extent(dims[2], plane / bsize[1], elem, 0);
+  return 0;
+}
+
+/** fills in the brick layout (number of bricks per dimension) and, for each
+ * dimension, tables of where each brick starts and how large it is.  Bricks
+ * are the same size except for the last, which gets the remainder.  Tables
+ * are per-axis, so they stay small even for enormous volumes; everything is
+ * integer math, so it is exact no matter how many voxels there are.
+ * @return 0 on success, an error code on failure. */
+static int
+geometry(struct ookfile* of)
 {
   assert(of != NULL);
-  assert(of->volsize[0] >= of->bricksize[0]);
-  assert(of->volsize[1] >= of->bricksize[1]);
-  assert(of->volsize[2] >= of->bricksize[2]);
-  nbricks[0] = (size_t) ceil((double)of->volsize[0] / of->bricksize[0]);
-  nbricks[1] = (size_t) ceil((double)of->volsize[1] / of->bricksize[1]);
-  nbricks[2] = (size_t) ceil((double)of->volsize[2] / of->bricksize[2]);
+  for(size_t i=0; i < 3; ++i) {
+    if(of->bricksize[i] == 0 || of->volsize[i] < of->bricksize[i]) {
+      return EINVAL;
+    }
+    const uint64_t n = (of->volsize[i] + of->bricksize[i]-1) /
+                       of->bricksize[i];
+    if(n > SIZE_MAX) { return EOVERFLOW; }
+    of->layout[i] = (size_t)n;
+  }
+  if(of->layout[1] > SIZE_MAX / of->layout[0] ||
+     of->layout[2] > SIZE_MAX / (of->layout[0]*of->layout[1])) {
+    return EOVERFLOW;
+  }
+  of->nbricks = of->layout[0] * of->layout[1] * of->layout[2];
+
+  /* one allocation for all six tables.  the origins come first, since
+   * they have the stricter alignment. */
+  const size_t entries = of->layout[0] + of->layout[1] + of->layout[2];
+  uint64_t* origins = malloc(entries * (sizeof(uint64_t) + sizeof(size_t)));
+  if(origins == NULL) { return ENOMEM; }
+  size_t* edges = (size_t*)(origins + entries);
+  for(size_t i=0; i < 3; ++i) {
+    of->origin[i] = origins;
+    of->edge[i] = edges;
+    for(size_t b=0; b < of->layout[i]; ++b) {
+      of->origin[i][b] = (uint64_t)b * of->bricksize[i];
+      const uint64_t left = of->volsize[i] - of->origin[i][b];
+      of->edge[i][b] = left < of->bricksize[i] ? (size_t)left
+                                               : of->bricksize[i];
+    }
+    origins += of->layout[i];
+    edges += of->layout[i];
+  }
+  return 0;
+}
+
+static void
+geometry_free(struct ookfile* of)
+{
+  free(of->origin[0]); /* all tables share the one allocation. */
+  for(size_t i=0; i < 3; ++i) {
+    of->origin[i] = NULL;
+    of->edge[i] = NULL;
+  }
 }
 
 /** @return the number of bytes a given type needs. */
@@ -280,6 +753,73 @@ width(enum OOKTYPE t)
   return -42;
 }
 
+/** fills in any zero fields of the constraints with values for this host.
+ * The cache default is the larger of L2 and this core's share of the LLC.
+ * Memory defaults to a quarter of this core's share of physical memory. */
+static void
+hostconstraints(struct ookconstraints* c)
+{
+  long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+  if(ncpu < 1) { ncpu = 1; }
+  long page = sysconf(_SC_PAGESIZE);
+  if(page < 1) { page = 4096; }
+  if(c->cache == 0) {
+    long l2 = -1, llc = -1;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+    l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+#endif
+    if(l2 > 0) { c->cache = (size_t)l2; }
+    if(llc > 0 && (size_t)(llc/ncpu) > c->cache) {
+      c->cache = (size_t)(llc/ncpu);
+    }
+    if(c->cache == 0) { c->cache = 1024*1024; } /* unknown; guess 1 MiB. */
+  }
+  if(c->memory == 0) {
+    long pages = -1;
+#ifdef _SC_PHYS_PAGES
+    pages = sysconf(_SC_PHYS_PAGES);
+#endif
+    c->memory = pages > 0 ? (size_t)(pages/ncpu/4) * (size_t)page
+                          : (size_t)64*1024*1024;
+  }
+  if(c->iosize == 0) { c->iosize = (size_t)page; }
+  if(c->scanline == 0) { c->scanline = c->iosize; }
+}
+
+/** picks a brick extent close to, but no larger than, 'want', for a dimension
+ * of 'dim' voxels.  Extents that divide 'dim' evenly win; failing that, we
+ * pick the one whose last brick is the most full, so we don't end up with a
+ * thin brick at the edge.  Ties go to extents whose byte size is a multiple
+ * of 'align' (if nonzero), and then to the larger extent. */
+static size_t
+extent(const uint64_t dim, size_t want, const size_t elem, const size_t align)
+{
+  if(want == 0) { want = 1; }
+  if(want >= dim) { return (size_t)dim; }
+  const size_t lowest = want/2 > 0 ? want/2 : 1;
+  size_t best = want;
+  uint64_t bestfill = 0; /* the fill fraction is bestfill / best. */
+  bool bestaligned = false;
+  /* only consider a bounded number of candidates for huge extents. */
+  const size_t step = (want - lowest) / 65536 + 1;
+  for(size_t c=want; c >= lowest; c -= step) {
+    const uint64_t rem = dim % c;
+    const uint64_t fill = rem == 0 ? c : rem;
+    const bool aligned = align > 0 && (c*elem) % align == 0;
+    if(fill*best > bestfill*c ||
+       (fill*best == bestfill*c && aligned && !bestaligned)) {
+      best = c;
+      bestfill = fill;
+      bestaligned = aligned;
+    }
+    if(c < lowest + step) { break; }
+  }
+  return best;
+}
+
 /** converts brick 1D ID to 3D ID.
  * @param id the 1-dimensional brick ID
  * @param layout the layout of bricks in the dataset (# bricks per dim)
@@ -300,28 +840,27 @@ bidxto3d(const size_t id, const size_t layout[3], size_t brick[3])
 /** identifies the location of data within the larger set, and moves data
  * between the two places. */
 static void
-srcop(rwop* op, const struct ookfile* of, size_t id, void* buffer)
+srcop(rwop* op, const struct ookfile* of, size_t id, void* buffer,
+      const struct selection* sel)
 {
   assert(op);
   if(of == NULL || buffer == NULL) { errno = EINVAL; return; }
 
-  size_t bsize[3];
-  ookbricksize(of, id, bsize);
+  if(id >= of->nbricks) { errno = EINVAL; return; }
 
-  size_t layout[3];
-  blayout(of, layout);
+  const size_t* layout = of->layout;
   size_t brickid[3];
   bidxto3d(id, layout, brickid);
+  const size_t bsize[3] = {
+    of->edge[0][brickid[0]], of->edge[1][brickid[1]], of->edge[2][brickid[2]]
+  };
 
-  /* just for typing convenience: */
-  const uint64_t vol[3] = { of->volsize[0], of->volsize[1], of->volsize[2] };
-
-  size_t src_offset[3] = {
-    (brickid[0] % layout[0]) * of->bricksize[0],
-    (brickid[1] % layout[1]) * of->bricksize[1],
-    (brickid[2] % layout[2]) * of->bricksize[2],
+  uint64_t src_offset[3] = {
+    of->origin[0][brickid[0]],
+    of->origin[1][brickid[1]],
+    of->origin[2][brickid[2]],
   };
-  const size_t original_src_offset[3] = {
+  const uint64_t original_src_offset[3] = {
     src_offset[0], src_offset[1], src_offset[2]
   };
 
@@ -329,18 +868,1347 @@ srcop(rwop* op, const struct ookfile* of, size_t id, void* buffer)
   const size_t w = width(of->type); /* convenience */
   /* our copy size/scanline size is the width of our target brick. */
   const size_t scanline = bsize[0] * c * w;
+  const bool writing = op == (rwop*)of->iop.write;
+  assert(!writing || sel == NULL);
+  const size_t nvox = bsize[0]*bsize[1]*bsize[2];
+  if(writing) {
+    STATADD(of->stats->bricks_written, 1);
+    STATADD(of->stats->brick_bytes_written, scanline*bsize[1]*bsize[2]);
+  } else {
+    STATADD(of->stats->bricks_read, 1);
+    STATADD(of->stats->brick_bytes_read,
+            sel ? nvox * sel->n * w : scanline*bsize[1]*bsize[2]);
+  }
+  /* a brick of a brick-major file is one contiguous piece of it. */
+  if(of->brickmajor != 0 && sel == NULL) {
+    const off_t at = brickstart(of, id);
+    const size_t bytes = scanline*bsize[1]*bsize[2];
+    if(writing && of->sparse && of->iop.punch && zeroes(buffer, bytes)) {
+      STATADD(of->stats->punch_calls, 1);
+      if(of->iop.punch(of->fd, at, bytes) == 0) { return; }
+    }
+    if(!writing && of->sparse && of->iop.hole) {
+      STATADD(of->stats->hole_calls, 1);
+      if(of->iop.hole(of->fd, at, bytes)) {
+        memset(buffer, 0, bytes);
+        return;
+      }
+    }
+    const int errcode = iocall(op, of, at, bytes, buffer);
+    if(errcode != 0) { errno = errcode; return; }
+    if(!writing && of->swap) { byteswap(buffer, buffer, nvox * c, w); }
+    return;
+  }
+  if(writing && of->sparse && zeroes(buffer, scanline*bsize[1]*bsize[2]) &&
+     punch(of, layout, brickid[0], src_offset, bsize) == 0) {
+    return;
+  }
+  /* when the interface takes a list of requests, or we are sieving, build
+   * up the whole brick and hand it over in one go.  Padded layouts go
+   * through a bounce buffer one scanline at a time, so they always go piece
+   * by piece.  The buffer is this call's own: other threads may be using the
+   * same ookfile. */
+  char* bounce = NULL;
+  if(of->align != 0) {
+    void* mem;
+    const size_t memalign = of->align < sizeof(void*) ? sizeof(void*)
+                                                      : of->align;
+    if(posix_memalign(&mem, memalign, of->pitch) != 0) {
+      errno = ENOMEM;
+      return;
+    }
+    bounce = mem;
+  }
+  vreader* vop = NULL;
+  bool sieving = false;
+  if(of->align == 0 && sel == NULL) {
+    sieving = of->sievegap != 0;
+    vop = writing ? (vreader*)of->iop.vwrite : of->iop.vread;
+  }
+  struct ookiov* iov = NULL;
+  size_t niov = 0;
+  if(vop != NULL || sieving) {
+    iov = malloc(sizeof(struct ookiov) * bsize[1]*bsize[2]);
+    if(iov == NULL) { vop = NULL; sieving = false; }
+  }
+  const size_t plane = scanline * bsize[1];
   for(size_t z=0; z < bsize[2]; ++z) {
+    /* the scanlines of one slice are a 'batch' in the timeline. */
+    const uint64_t batch = of->trace ? clocknow() : 0;
+    /* if this whole slice of the brick lies in a hole, it's all zeroes. */
+    if(!writing && of->sparse && of->iop.hole && of->brickmajor == 0) {
+      const off_t first = scanoffset(of, layout, brickid[0], src_offset);
+      const uint64_t last[3] = {
+        src_offset[0], src_offset[1]+bsize[1]-1, src_offset[2]
+      };
+      const off_t end = scanoffset(of, layout, brickid[0], last) +
+                        (of->align ? of->pitch : scanline);
+      STATADD(of->stats->hole_calls, 1);
+      const uint64_t start = of->trace ? clocknow() : 0;
+      const int hole = of->iop.hole(of->fd, first, end-first);
+      traceop(of, "hole", start, "bytes", end-first);
+      if(hole && sel != NULL) {
+        memset(sel->scratch, 0, scanline);
+        for(size_t y=0; y < bsize[1]; ++y) {
+          scatter(sel, sel->scratch, w, c, (z*bsize[1] + y)*bsize[0],
+                  bsize[0], nvox, buffer);
+        }
+      } else if(hole) {
+        memset(buffer + z*plane, 0, plane);
+      }
+      if(hole) {
+        src_offset[2]++;
+        continue;
+      }
+    }
     for(size_t y=0; y < bsize[1]; ++y) {
       const off_t tgt_offs = (z*bsize[1]*bsize[0] + y*bsize[0] + 0) * c * w;
-      const off_t src_offs = (src_offset[2]*vol[1]*vol[0] +
-                              src_offset[1]*vol[0] + src_offset[0]) * c * w;
-      int errcode = op(of->fd, src_offs, scanline, buffer+tgt_offs); /* copy */
-      if(errcode != 0) { errno = errcode; return; }
+      const off_t src_offs = of->brickmajor != 0 ?
+        brickstart(of, id) + (off_t)((z*bsize[1] + y) * scanline) :
+        scanoffset(of, layout, brickid[0], src_offset);
+      int errcode = 0;
+      if(iov != NULL) {
+        struct ookiov* last = niov > 0 ? &iov[niov-1] : NULL;
+        /* scanlines adjacent in both the file and memory become one piece. */
+        if(last && last->offset + (off_t)last->len == src_offs &&
+           (char*)last->buf + last->len == (char*)buffer+tgt_offs) {
+          last->len += scanline;
+        } else {
+          iov[niov].offset = src_offs;
+          iov[niov].len = scanline;
+          iov[niov].buf = (char*)buffer+tgt_offs;
+          ++niov;
+        }
+      } else {
+        /* selections land in the scratch scanline, then get picked apart. */
+        char* target = sel ? sel->scratch : (char*)buffer+tgt_offs;
+        if(of->align == 0) {
+          errcode = iocall(op, of, src_offs, scanline, target);
+        } else {
+          errcode = padop(op, of, src_offs, scanline, target, bounce);
+        }
+        if(errcode == 0 && sel) {
+          scatter(sel, sel->scratch, w, c, tgt_offs / (c*w), bsize[0], nvox,
+                  buffer);
+        }
+      }
+      if(errcode != 0) {
+        free(bounce);
+        errno = errcode;
+        return;
+      }
       src_offset[1]++; /* follows y's increment.. */
     }
+    traceop(of, "srcop", batch, "z", src_offset[2]);
     src_offset[1] = original_src_offset[1];
     src_offset[2]++;
   }
+  free(bounce);
+  if(iov != NULL) {
+    int errcode = 0;
+    if(niov > 0 && sieving && writing) {
+      errcode = sievewrite(of, iov, niov);
+    } else if(niov > 0 && sieving) {
+      errcode = readruns(of, iov, niov, of->sievegap, of->sievebuf);
+    } else if(niov > 0) {
+      errcode = viocall(vop, of, iov, niov);
+    }
+    free(iov);
+    if(errcode != 0) { errno = errcode; return; }
+  }
+  /* reads are swapped in place, once everything has arrived. */
+  if(!writing && of->swap) {
+    byteswap(buffer, buffer, nvox * (sel ? sel->n : c), w);
+  }
+}
+
+#ifdef OOK_SSSE3
+__attribute__((target("ssse3"))) static size_t
+byteswap_ssse3(char* dst, const char* src, const size_t n, const size_t w)
+{
+  const __m128i mask = w == 2 ?
+    _mm_set_epi8(14,15, 12,13, 10,11, 8,9, 6,7, 4,5, 2,3, 0,1) : w == 4 ?
+    _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3) :
+    _mm_set_epi8(8,9,10,11,12,13,14,15, 0,1,2,3,4,5,6,7);
+  const size_t per = 16 / w;
+  size_t i = 0;
+  for(; i+per <= n; i += per) {
+    const __m128i v = _mm_loadu_si128((const __m128i*)(src + i*w));
+    _mm_storeu_si128((__m128i*)(dst + i*w), _mm_shuffle_epi8(v, mask));
+  }
+  return i;
+}
+#endif
+
+/** reverses the bytes of each of the 'n' values of 'w' bytes in 'src',
+ * storing them in 'dst'.  'dst' may be 'src'.  On CPUs with SSSE3, one
+ * shuffle swaps 16 bytes' worth of values at a time. */
+static void
+byteswap(void* dst, const void* src, const size_t n, const size_t w)
+{
+  char* d = (char*) dst;
+  const char* s = (const char*) src;
+  size_t i = 0;
+#ifdef OOK_SSSE3
+  if((w == 2 || w == 4 || w == 8) && __builtin_cpu_supports("ssse3")) {
+    i = byteswap_ssse3(d, s, n, w);
+  }
+#endif
+  switch(w) {
+#ifdef __GNUC__
+    case 2:
+      for(; i < n; ++i) {
+        uint16_t v; memcpy(&v, s + i*2, 2);
+        v = __builtin_bswap16(v); memcpy(d + i*2, &v, 2);
+      }
+      break;
+    case 4:
+      for(; i < n; ++i) {
+        uint32_t v; memcpy(&v, s + i*4, 4);
+        v = __builtin_bswap32(v); memcpy(d + i*4, &v, 4);
+      }
+      break;
+    case 8:
+      for(; i < n; ++i) {
+        uint64_t v; memcpy(&v, s + i*8, 8);
+        v = __builtin_bswap64(v); memcpy(d + i*8, &v, 8);
+      }
+      break;
+#endif
+    default:
+      for(; i < n; ++i) {
+        for(size_t b=0; b < w/2; ++b) {
+          const char t = s[i*w + b];
+          d[i*w + b] = s[i*w + w-1-b];
+          d[i*w + w-1-b] = t;
+        }
+        if(w % 2 == 1 && d != s) { d[i*w + w/2] = s[i*w + w/2]; }
+      }
+      break;
+  }
+}
+
+/* copies one value of 'w' bytes.  Constant sizes let the compiler turn each
+ * memcpy into a single load and store. */
+#define PICK(W) \
+  for(size_t v=0; v < n; ++v) { \
+    for(size_t k=0; k < sel->n; ++k) { \
+      memcpy(out + (planar ? (k*nvox + first+v) : ((first+v)*sel->n + k))*(W), \
+             scanline + (v*c + sel->comp[k])*(W), (W)); \
+    } \
+  }
+
+static void
+scatter(const struct selection* sel, const char* scanline, const size_t w,
+        const size_t c, const size_t first, const size_t n, const size_t nvox,
+        char* out)
+{
+  const bool planar = sel->layout == OOK_PLANAR;
+  switch(w) {
+    case 1: PICK(1); break;
+    case 2: PICK(2); break;
+    case 4: PICK(4); break;
+    case 8: PICK(8); break;
+    default: PICK(w); break;
+  }
+}
+#undef PICK
+
+/** @return the file offset of the scanline which starts at voxel 'at', which
+ * lies in brick column 'bx'. */
+static off_t
+scanoffset(const struct ookfile* of, const size_t layout[3], const size_t bx,
+           const uint64_t at[3])
+{
+  const uint64_t* vol = of->volsize;
+  if(of->align == 0) {
+    return (at[2]*vol[1]*vol[0] + at[1]*vol[0] + at[0]) *
+           of->components * width(of->type);
+  }
+  return ((at[2]*vol[1] + at[1]) * layout[0] + bx) * of->pitch;
+}
+
+/** @return true if the 'n' bytes at 'mem' are all zero. */
+static bool
+zeroes(const void* mem, const size_t n)
+{
+  const unsigned char* m = (const unsigned char*) mem;
+  /* if the first byte is 0 and every byte equals the one before it, they
+   * are all 0.  memcmp is much faster than any loop we'd write. */
+  return n == 0 || (m[0] == 0 && memcmp(m, m+1, n-1) == 0);
+}
+
+/** punches out the file region of a brick, instead of writing zeroes to it.
+ * Scanlines that are adjacent in the file are punched together.
+ * @return 0 on success; on failure the caller should just write zeroes. */
+static int
+punch(const struct ookfile* of, const size_t layout[3], const size_t bx,
+      const uint64_t origin[3], const size_t bsize[3])
+{
+  if(of->iop.punch == NULL) { return EOPNOTSUPP; }
+  const size_t len = of->align ? of->pitch
+                               : bsize[0] * of->components * width(of->type);
+  off_t start = -1;
+  off_t end = -1;
+  for(size_t z=0; z < bsize[2]; ++z) {
+    for(size_t y=0; y < bsize[1]; ++y) {
+      const uint64_t at[3] = { origin[0], origin[1]+y, origin[2]+z };
+      const off_t offset = scanoffset(of, layout, bx, at);
+      if(offset != end) {
+        if(start != -1) {
+          STATADD(of->stats->punch_calls, 1);
+          const uint64_t t = of->trace ? clocknow() : 0;
+          const int err = of->iop.punch(of->fd, start, end-start);
+          traceop(of, "punch", t, "bytes", end-start);
+          if(err != 0) { return err; }
+        }
+        start = offset;
+      }
+      end = offset + len;
+    }
+  }
+  STATADD(of->stats->punch_calls, 1);
+  const uint64_t t = of->trace ? clocknow() : 0;
+  const int err = of->iop.punch(of->fd, start, end-start);
+  traceop(of, "punch", t, "bytes", end-start);
+  return err;
+}
+
+/* sparse mode: bricks which are entirely zero are punched out of the file
+ * rather than written, and reads skip over holes in the file.  Enabling it
+ * on a file from 'ookcreate' also gives back any preallocated space, since
+ * that would defeat the purpose.  That punches the whole file, so it has to
+ * happen before any brick is written, and only happens the first time. */
+int
+ooksparse(struct ookfile* of, bool enable)
+{
+  if(of == NULL) { return EINVAL; }
+  if(enable && !of->punched && of->mode == OOK_RDWR && of->iop.punch) {
+    if(of->stats->bricks_written != 0) { return EBUSY; }
+    of->sparse = true;
+    of->punched = true;
+    const size_t* layout = of->layout;
+    const uint64_t last[3] = { 0, of->volsize[1]-1, of->volsize[2]-1 };
+    const off_t end = of->align ? scanoffset(of, layout, layout[0], last)
+                                : scanoffset(of, layout, 0, last) +
+                                  (off_t)(of->volsize[0] * of->components *
+                                          width(of->type));
+    return of->iop.punch(of->fd, 0, end);
+  }
+  of->sparse = enable;
+  return 0;
+}
+
+/* data sieving: scanlines less than 'gap' bytes apart in the file are moved
+ * with a single transfer of up to 'bufsize' bytes, through a staging buffer.
+ * Reads throw away what lies between the scanlines; writes read it first and
+ * write it back.  Only whole bricks in unpadded layouts are sieved. */
+int
+ooksieve(struct ookfile* of, size_t gap, size_t bufsize)
+{
+  if(of == NULL) { return EINVAL; }
+  if(gap != 0 && of->align != 0) { return EOPNOTSUPP; }
+  if(gap != 0 && of->mode != OOK_RDONLY && of->sievelock == NULL) {
+    of->sievelock = malloc(sizeof(pthread_mutex_t));
+    if(of->sievelock == NULL) { return ENOMEM; }
+    pthread_mutex_init(of->sievelock, NULL);
+  }
+  of->sievegap = gap;
+  of->sievebuf = bufsize != 0 ? bufsize : 4*1024*1024;
+  return 0;
+}
+
+/** calls the io-interface and keeps the statistics up to date. */
+static int
+iocall(rwop* op, const struct ookfile* of, const off_t offset,
+       const size_t len, void* buf)
+{
+  const uint64_t start = clocknow();
+  const int errcode = op(of->fd, offset, len, buf);
+  if(op == (rwop*)of->iop.write) {
+    STATADD(of->stats->write_calls, 1);
+    STATADD(of->stats->bytes_written, len);
+    latency(of, OOK_OP_WRITE, start, len);
+  } else {
+    STATADD(of->stats->read_calls, 1);
+    STATADD(of->stats->bytes_read, len);
+    latency(of, OOK_OP_READ, start, len);
+  }
+  return errcode;
+}
+
+/** hands a whole list of pieces to a vectored io-interface call.  It counts
+ * as a single call in the statistics. */
+static int
+viocall(vreader* vop, const struct ookfile* of, const struct ookiov* iov,
+        const size_t n)
+{
+  size_t bytes = 0;
+  for(size_t i=0; i < n; ++i) { bytes += iov[i].len; }
+  const uint64_t start = clocknow();
+  const int errcode = vop(of->fd, iov, n);
+  if(vop == (vreader*)of->iop.vwrite) {
+    STATADD(of->stats->write_calls, 1);
+    STATADD(of->stats->bytes_written, bytes);
+    latency(of, OOK_OP_WRITE, start, bytes);
+  } else {
+    STATADD(of->stats->read_calls, 1);
+    STATADD(of->stats->bytes_read, bytes);
+    latency(of, OOK_OP_READ, start, bytes);
+  }
+  return errcode;
+}
+
+static uint64_t
+clocknow()
+{
+  struct timespec ts;
+  if(clock_gettime(CLOCK_MONOTONIC, &ts) != 0) { return 0; }
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+latency(const struct ookfile* of, enum OOKOP op, uint64_t start, uint64_t arg)
+{
+  const uint64_t end = clocknow();
+  if(of->trace) {
+    static const char* names[OOK_NOPS] = {
+      "read", "write", "ookbrick", "ookwrite"
+    };
+    static const char* args[OOK_NOPS] = { "bytes", "bytes", "brick", "brick" };
+    trace_event(of->trace, names[op], start, end, args[op], arg);
+  }
+  histogram(of, op, end - start);
+}
+
+static void
+histogram(const struct ookfile* of, enum OOKOP op, uint64_t ns)
+{
+  size_t bucket = 0;
+  for(uint64_t v=ns; v > 1 && bucket < OOK_HISTBUCKETS-1; v >>= 1) {
+    ++bucket;
+  }
+  STATADD(of->stats->latency[op][bucket], 1);
+  STATADD(of->stats->nanoseconds[op], ns);
+}
+
+static void
+traceop(const struct ookfile* of, const char* name, uint64_t start,
+        const char* argname, uint64_t arg)
+{
+  if(of->trace) {
+    trace_event(of->trace, name, start, clocknow(), argname, arg);
+  }
+}
+
+/** @return the number of bytes in brick 'id'. */
+static size_t
+brickbytes(const struct ookfile* of, size_t id)
+{
+  size_t bs[3];
+  ookbricksize(of, id, bs);
+  return bs[0]*bs[1]*bs[2] * of->components * width(of->type);
+}
+
+static void
+cachedread(const struct ookfile* of, size_t id, void* data)
+{
+  if(cachehit(of, id, data)) { return; }
+  srcop(of->iop.read, of, id, data, NULL);
+  if(errno == 0) { cacheput(of, id, data); }
+}
+
+static bool
+cachehit(const struct ookfile* of, size_t id, void* data)
+{
+  if(of->cache == NULL || id >= of->nbricks) { return false; }
+  struct cachekey key = of->cachekey;
+  key.brick = id;
+  const size_t bytes = brickbytes(of, id);
+  if(shmcache_get(of->cache, &key, data, bytes)) {
+    STATADD(of->stats->cache_hits, 1);
+    STATADD(of->stats->bricks_read, 1);
+    STATADD(of->stats->brick_bytes_read, bytes);
+    return true;
+  }
+  STATADD(of->stats->cache_misses, 1);
+  return false;
+}
+
+static void
+cacheput(const struct ookfile* of, size_t id, const void* data)
+{
+  if(of->cache == NULL || id >= of->nbricks) { return; }
+  struct cachekey key = of->cachekey;
+  key.brick = id;
+  shmcache_put(of->cache, &key, data, brickbytes(of, id));
+}
+
+/** moves a single scanline of a padded layout.  Transfers are always whole
+ * blocks; we go through 'bounce' ('pitch' aligned bytes) unless the caller's
+ * memory is already suitable. */
+static int
+padop(rwop* op, const struct ookfile* of, const off_t offset,
+      const size_t scanline, char* buf, char* bounce)
+{
+  if(scanline == of->pitch && ((uintptr_t)buf % of->align) == 0) {
+    return iocall(op, of, offset, scanline, buf);
+  }
+  if(op == (rwop*)of->iop.write) {
+    memcpy(bounce, buf, scanline);
+    memset(bounce + scanline, 0, of->pitch - scanline);
+    return iocall(op, of, offset, of->pitch, bounce);
+  }
+  const int errcode = iocall(op, of, offset, of->pitch, bounce);
+  if(errcode == 0) {
+    memcpy(buf, bounce, scanline);
+  }
+  return errcode;
+}
+
+/** @return the number of voxels in the bricks before brick 'id'.  Bricks
+ * are ordered X-fastest, so that is the whole brick-layers below, the
+ * whole brick-rows before it in its layer, and the bricks before it in its
+ * row. */
+static uint64_t
+voxelsbefore(const struct ookfile* of, const size_t id)
+{
+  const uint64_t* vol = of->volsize;
+  if(id >= of->nbricks) { return vol[0]*vol[1]*vol[2]; }
+  size_t b[3];
+  bidxto3d(id, of->layout, b);
+  return of->origin[2][b[2]]*vol[0]*vol[1] +
+         of->origin[1][b[1]]*vol[0]*of->edge[2][b[2]] +
+         of->origin[0][b[0]]*of->edge[1][b[1]]*of->edge[2][b[2]];
+}
+
+/** @return the first brick of the given rank's share of the file. */
+static size_t
+partstart(const struct ookfile* of, const size_t rank, const size_t nranks)
+{
+  if(rank >= nranks) { return of->nbricks; }
+  const uint64_t total = voxelsbefore(of, of->nbricks);
+  const uint64_t target = (total / nranks) * rank +
+                          (total % nranks) * rank / nranks;
+  size_t lo = 0, hi = of->nbricks;
+  while(lo < hi) {
+    const size_t mid = lo + (hi-lo)/2;
+    if(voxelsbefore(of, mid) < target) { lo = mid+1; } else { hi = mid; }
+  }
+  return lo;
+}
+
+/* splits the bricks into 'nranks' contiguous ranges holding (as near as
+ * whole bricks allow) the same number of voxels.  Contiguous ranges keep each
+ * rank's share of the file contiguous as well. */
+int
+ookpartition(const struct ookfile* of, size_t rank, size_t nranks,
+             size_t range[2])
+{
+  if(of == NULL || range == NULL || nranks == 0 || rank >= nranks) {
+    return EINVAL;
+  }
+  range[0] = partstart(of, rank, nranks);
+  range[1] = partstart(of, rank+1, nranks);
+  return 0;
+}
+
+/* a barrier between processes.  pthread barriers are optional in POSIX and
+ * missing on macOS, so this one is built from a mutex and condition
+ * variable, both process-shared. */
+struct collbarrier {
+  pthread_mutex_t lock;
+  pthread_cond_t cv;
+  size_t n; /* ranks taking part. */
+  size_t waiting; /* ranks which have arrived this cycle. */
+  uint64_t cycle; /* bumped each time the last rank arrives. */
+};
+
+static int
+barrier_init(struct collbarrier* b, const size_t n)
+{
+  b->n = n;
+  b->waiting = 0;
+  b->cycle = 0;
+  pthread_mutexattr_t mattr;
+  int err = pthread_mutexattr_init(&mattr);
+  if(err != 0) { return err; }
+  err = pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  if(err == 0) { err = pthread_mutex_init(&b->lock, &mattr); }
+  pthread_mutexattr_destroy(&mattr);
+  if(err != 0) { return err; }
+  pthread_condattr_t cattr;
+  err = pthread_condattr_init(&cattr);
+  if(err == 0) {
+    err = pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+    if(err == 0) { err = pthread_cond_init(&b->cv, &cattr); }
+    pthread_condattr_destroy(&cattr);
+  }
+  if(err != 0) { pthread_mutex_destroy(&b->lock); }
+  return err;
+}
+
+static void
+barrier_wait(struct collbarrier* b)
+{
+  pthread_mutex_lock(&b->lock);
+  const uint64_t cycle = b->cycle;
+  if(++b->waiting == b->n) {
+    b->waiting = 0;
+    b->cycle++;
+    pthread_cond_broadcast(&b->cv);
+  } else {
+    /* the cycle changing, not the wakeup, is what lets us go. */
+    while(b->cycle == cycle) { pthread_cond_wait(&b->cv, &b->lock); }
+  }
+  pthread_mutex_unlock(&b->lock);
+}
+
+static void
+barrier_destroy(struct collbarrier* b)
+{
+  pthread_cond_destroy(&b->cv);
+  pthread_mutex_destroy(&b->lock);
+}
+
+/* the part of a collective which every process shares.  It lives in memory
+ * mapped before the fork, so the pointers are valid everywhere. */
+struct collshared {
+  struct collbarrier barrier;
+  size_t nranks;
+  size_t naggregators;
+  size_t bufsize;
+  int err[2]; /* for this round and the last; see 'collective'. */
+  size_t* want; /* the brick each rank is moving this round. */
+  char* buf; /* 'bufsize' bytes of the file, staged by the aggregators. */
+};
+
+struct ookcollective {
+  struct collshared* sh;
+  size_t bytes; /* size of the mapping. */
+  uint64_t round; /* private to each process, but the same in all. */
+};
+
+/* a byte range of the file. */
+struct span {
+  off_t offset;
+  size_t len;
+};
+
+static int
+spancmp(const void* a, const void* b)
+{
+  const struct span* sa = (const struct span*) a;
+  const struct span* sb = (const struct span*) b;
+  return sa->offset < sb->offset ? -1 : sa->offset > sb->offset ? 1 : 0;
+}
+
+/** fills 'out' with the file ranges of each of the brick's scanlines, in the
+ * order they appear in a brick buffer.  In a brick-major file that is one
+ * range, for the whole brick.  @return the number of ranges. */
+static size_t
+brickspans(const struct ookfile* of, const size_t id, struct span* out)
+{
+  size_t b[3];
+  bidxto3d(id, of->layout, b);
+  const size_t bs[3] = {
+    of->edge[0][b[0]], of->edge[1][b[1]], of->edge[2][b[2]]
+  };
+  const size_t len = bs[0] * of->components * width(of->type);
+  if(of->brickmajor != 0) {
+    out[0].offset = brickstart(of, id);
+    out[0].len = len * bs[1]*bs[2];
+    return 1;
+  }
+  size_t n = 0;
+  for(size_t z=0; z < bs[2]; ++z) {
+    for(size_t y=0; y < bs[1]; ++y) {
+      const uint64_t at[3] = {
+        of->origin[0][b[0]], of->origin[1][b[1]]+y, of->origin[2][b[2]]+z
+      };
+      out[n].offset = scanoffset(of, of->layout, b[0], at);
+      out[n].len = len;
+      ++n;
+    }
+  }
+  return n;
+}
+
+/* creates the shared state for 'nranks' processes, of which the first
+ * 'naggregators' do the actual I/O through a staging buffer of 'bufsize'
+ * bytes.  Call this before forking. */
+struct ookcollective*
+ookcollective(size_t nranks, size_t naggregators, size_t bufsize)
+{
+  if(nranks == 0 || naggregators == 0 || naggregators > nranks ||
+     bufsize == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  struct ookcollective* coll = calloc(1, sizeof(struct ookcollective));
+  if(coll == NULL) { errno = ENOMEM; return NULL; }
+  const size_t page = 4096;
+  const size_t head = ((sizeof(struct collshared) + sizeof(size_t)*nranks +
+                        page-1) / page) * page;
+  coll->bytes = head + bufsize;
+  void* mem = mmap(NULL, coll->bytes, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if(mem == MAP_FAILED) {
+    const int err = errno;
+    free(coll);
+    errno = err;
+    return NULL;
+  }
+  struct collshared* sh = (struct collshared*) mem;
+  sh->nranks = nranks;
+  sh->naggregators = naggregators;
+  sh->bufsize = bufsize;
+  sh->want = (size_t*)(sh+1);
+  sh->buf = (char*)mem + head;
+  const int err = barrier_init(&sh->barrier, nranks);
+  if(err != 0) {
+    munmap(mem, coll->bytes);
+    free(coll);
+    errno = err;
+    return NULL;
+  }
+  coll->sh = sh;
+  return coll;
+}
+
+/* only the creator should call this, once every rank is done. */
+int
+ookcollective_destroy(struct ookcollective* coll)
+{
+  if(coll == NULL) { return EINVAL; }
+  barrier_destroy(&coll->sh->barrier);
+  const int err = munmap(coll->sh, coll->bytes) == 0 ? 0 : errno;
+  free(coll);
+  return err;
+}
+
+/** one round of a collective: every rank moves (at most) one brick.  This is
+ * two-phase I/O, as in ROMIO's collective buffering.  The union of what every
+ * rank wants is merged into contiguous runs, and the file region they span is
+ * processed one staging buffer's worth at a time.  Within each window, the
+ * aggregators split the runs between them and make a few large transfers,
+ * while every rank copies its own scanlines in or out of the buffer.  The
+ * number of barriers depends only on what every rank wants, so all ranks
+ * agree on it.
+ * @return 0 on success, or the first error any rank saw. */
+static int
+collective(struct ookcollective* coll, const struct ookfile* of,
+           const size_t rank, const size_t id, char* data, const bool writing)
+{
+  struct collshared* sh = coll->sh;
+  const size_t cur = coll->round % 2;
+  coll->round++;
+  sh->want[rank] = id < of->nbricks ? id : OOK_NOBRICK;
+  barrier_wait(&sh->barrier);
+  /* everyone is past reading the last round's error now. */
+  if(rank == 0) { sh->err[1-cur] = 0; }
+
+  /* the extent of the whole round, from each brick's first and last
+   * scanlines. */
+  off_t lo = -1, hi = -1;
+  size_t nbricks = 0;
+  for(size_t r=0; r < sh->nranks; ++r) {
+    if(sh->want[r] == OOK_NOBRICK) { continue; }
+    size_t b[3];
+    bidxto3d(sh->want[r], of->layout, b);
+    const size_t bs[3] = {
+      of->edge[0][b[0]], of->edge[1][b[1]], of->edge[2][b[2]]
+    };
+    const uint64_t first[3] = {
+      of->origin[0][b[0]], of->origin[1][b[1]], of->origin[2][b[2]]
+    };
+    const uint64_t last[3] = { first[0], first[1]+bs[1]-1, first[2]+bs[2]-1 };
+    const off_t start = scanoffset(of, of->layout, b[0], first);
+    const off_t end = scanoffset(of, of->layout, b[0], last) +
+                      (off_t)(bs[0] * of->components * width(of->type));
+    if(lo == -1 || start < lo) { lo = start; }
+    if(hi == -1 || end > hi) { hi = end; }
+    ++nbricks;
+  }
+  if(nbricks == 0) { return 0; }
+
+  /* the merged runs of everything wanted, and this rank's own scanlines. */
+  const size_t per = of->bricksize[1]*of->bricksize[2];
+  struct span* runs = malloc(sizeof(struct span) * per * nbricks);
+  struct span* mine = malloc(sizeof(struct span) * per);
+  size_t nruns = 0, nmine = 0;
+  if(runs == NULL || mine == NULL) {
+    sh->err[cur] = ENOMEM;
+  } else {
+    for(size_t r=0; r < sh->nranks; ++r) {
+      if(sh->want[r] != OOK_NOBRICK) {
+        nruns += brickspans(of, sh->want[r], runs + nruns);
+      }
+    }
+    qsort(runs, nruns, sizeof(struct span), spancmp);
+    size_t m = 0;
+    for(size_t i=1; i < nruns; ++i) {
+      if(runs[i].offset <= runs[m].offset + (off_t)runs[m].len) {
+        const off_t end = runs[i].offset + (off_t)runs[i].len;
+        if(end > runs[m].offset + (off_t)runs[m].len) {
+          runs[m].len = (size_t)(end - runs[m].offset);
+        }
+      } else {
+        runs[++m] = runs[i];
+      }
+    }
+    nruns = nruns == 0 ? 0 : m+1;
+    if(sh->want[rank] != OOK_NOBRICK) {
+      nmine = brickspans(of, sh->want[rank], mine);
+    }
+  }
+  const size_t scanline = nmine ? mine[0].len : 0;
+
+  for(off_t win=lo; win < hi; win += (off_t)sh->bufsize) {
+    const off_t whi = win + (off_t)sh->bufsize < hi ? win + (off_t)sh->bufsize
+                                                    : hi;
+    /* this aggregator's part of the window; page multiples, where possible */
+    size_t part = ((whi-win) + sh->naggregators-1) / sh->naggregators;
+    part = ((part + 4095) / 4096) * 4096;
+    const off_t alo = win + (off_t)(rank * part);
+    const off_t ahi = alo + (off_t)part < whi ? alo + (off_t)part : whi;
+    const bool aggregator = rank < sh->naggregators && alo < whi;
+
+    /* writes gather into the buffer before the aggregators write it out. */
+    for(size_t i=0; writing && i < nmine; ++i) {
+      const off_t a = mine[i].offset > win ? mine[i].offset : win;
+      const off_t e = mine[i].offset + (off_t)mine[i].len;
+      const off_t b = e < whi ? e : whi;
+      if(a < b) {
+        memcpy(sh->buf + (a-win), data + i*scanline + (a-mine[i].offset),
+               (size_t)(b-a));
+      }
+    }
+    if(writing) { barrier_wait(&sh->barrier); }
+    for(size_t i=0; aggregator && i < nruns; ++i) {
+      const off_t a = runs[i].offset > alo ? runs[i].offset : alo;
+      const off_t e = runs[i].offset + (off_t)runs[i].len;
+      const off_t b = e < ahi ? e : ahi;
+      if(a >= b) { continue; }
+      rwop* op = writing ? (rwop*)of->iop.write : of->iop.read;
+      const int err = iocall(op, of, a, (size_t)(b-a), sh->buf + (a-win));
+      if(err != 0) { sh->err[cur] = err; break; }
+    }
+    barrier_wait(&sh->barrier);
+    /* .. and reads scatter out of it once the aggregators have filled it. */
+    for(size_t i=0; !writing && i < nmine; ++i) {
+      const off_t a = mine[i].offset > win ? mine[i].offset : win;
+      const off_t e = mine[i].offset + (off_t)mine[i].len;
+      const off_t b = e < whi ? e : whi;
+      if(a < b) {
+        memcpy(data + i*scanline + (a-mine[i].offset), sh->buf + (a-win),
+               (size_t)(b-a));
+      }
+    }
+    if(!writing) { barrier_wait(&sh->barrier); }
+  }
+  free(runs);
+  free(mine);
+  return sh->err[cur];
+}
+
+/* collectively reads brick 'id' into 'data'.  Every rank must make the same
+ * number of calls; ranks with nothing left to read pass OOK_NOBRICK. */
+int
+ookcollread(struct ookcollective* coll, const struct ookfile* of,
+            size_t rank, size_t id, void* data)
+{
+  if(coll == NULL || of == NULL || rank >= coll->sh->nranks) { return EINVAL; }
+  if(of->align != 0 || of->brickmajor != 0) { return EOPNOTSUPP; }
+  const uint64_t start = clocknow();
+  const int err = collective(coll, of, rank, id, (char*)data, false);
+  if(id < of->nbricks) {
+    size_t bs[3];
+    ookbricksize(of, id, bs);
+    const size_t n = bs[0]*bs[1]*bs[2] * of->components;
+    STATADD(of->stats->bricks_read, 1);
+    STATADD(of->stats->brick_bytes_read, n * width(of->type));
+    if(err == 0 && of->swap) { byteswap(data, data, n, width(of->type)); }
+    latency(of, OOK_OP_BRICK, start, id);
+  }
+  return err;
+}
+
+/* collectively writes brick 'id' from 'data'.  As with 'ookcollread', every
+ * rank must make the same number of calls. */
+int
+ookcollwrite(struct ookcollective* coll, struct ookfile* of, size_t rank,
+             size_t id, const void* data)
+{
+  if(coll == NULL || of == NULL || rank >= coll->sh->nranks) { return EINVAL; }
+  if(of->align != 0 || of->brickmajor != 0) { return EOPNOTSUPP; }
+  const uint64_t start = clocknow();
+  const void* original = data;
+  void* swapped = NULL;
+  int failed = 0;
+  if(id < of->nbricks) {
+    size_t bs[3];
+    ookbricksize(of, id, bs);
+    const size_t n = bs[0]*bs[1]*bs[2] * of->components;
+    STATADD(of->stats->bricks_written, 1);
+    STATADD(of->stats->brick_bytes_written, n * width(of->type));
+    if(of->swap) {
+      swapped = malloc(n * width(of->type));
+      if(swapped != NULL) {
+        byteswap(swapped, data, n, width(of->type));
+        data = swapped;
+      } else {
+        /* we still have to take part in the round, just without a brick. */
+        failed = ENOMEM;
+        id = OOK_NOBRICK;
+      }
+    }
+  }
+  const int err = collective(coll, of, rank, id, (char*)data, true);
+  free(swapped);
+  if(err == 0) { cacheput(of, id, original); }
+  if(id < of->nbricks) { latency(of, OOK_OP_OOKWRITE, start, id); }
+  return failed != 0 ? failed : err;
+}
+
+/* the longest run of adjacent scanlines 'ookbricks_read' reads at once. */
+#define BATCH_RUN (4U*1024*1024)
+
+static int
+iovcmp(const void* a, const void* b)
+{
+  const struct ookiov* ia = (const struct ookiov*) a;
+  const struct ookiov* ib = (const struct ookiov*) b;
+  if(ia->offset != ib->offset) { return ia->offset < ib->offset ? -1 : 1; }
+  return (uintptr_t)ia->buf < (uintptr_t)ib->buf ? -1 :
+         (uintptr_t)ia->buf > (uintptr_t)ib->buf;
+}
+
+/* a brick, by where it starts in the file. */
+struct brickat {
+  off_t offset;
+  size_t i; /* index into the caller's arrays. */
+};
+
+static int
+brickatcmp(const void* a, const void* b)
+{
+  const struct brickat* ba = (const struct brickat*) a;
+  const struct brickat* bb = (const struct brickat*) b;
+  return ba->offset < bb->offset ? -1 : ba->offset > bb->offset ? 1 : 0;
+}
+
+/** @return the end of the group of pieces starting at 'iov[i]': the first
+ * piece which lies more than 'gap' bytes past the ones before it, or would
+ * make the group span more than 'maxspan' bytes.  'end' gets the group's
+ * last byte offset (+1). */
+static size_t
+group(const struct ookiov* iov, const size_t n, const size_t i,
+      const size_t gap, const size_t maxspan, off_t* end)
+{
+  *end = iov[i].offset + (off_t)iov[i].len;
+  size_t j = i+1;
+  while(j < n && iov[j].offset <= *end + (off_t)gap &&
+        iov[j].offset + (off_t)iov[j].len - iov[i].offset <= (off_t)maxspan) {
+    const off_t e = iov[j].offset + (off_t)iov[j].len;
+    if(e > *end) { *end = e; }
+    ++j;
+  }
+  return j;
+}
+
+/** @return memory for the largest group of pieces 'group' will form, or
+ * NULL if no group has more than one piece (or there is no memory). */
+static char*
+spanbuffer(const struct ookiov* iov, const size_t n, const size_t gap,
+           const size_t maxspan)
+{
+  size_t biggest = 0;
+  for(size_t i=0; i < n; ) {
+    off_t end;
+    const size_t j = group(iov, n, i, gap, maxspan, &end);
+    if(j > i+1 && (size_t)(end - iov[i].offset) > biggest) {
+      biggest = (size_t)(end - iov[i].offset);
+    }
+    i = j;
+  }
+  return biggest == 0 ? NULL : malloc(biggest);
+}
+
+/* reads a group of pieces with one call, into a staging buffer, and copies
+ * the pieces out of it.  With a 'gap', what lies between the pieces is read
+ * and thrown away: that's data sieving.  A single piece is read directly,
+ * and without staging memory, every piece is. */
+static int
+readruns(const struct ookfile* of, const struct ookiov* iov, const size_t n,
+         const size_t gap, const size_t maxspan)
+{
+  char* staging = spanbuffer(iov, n, gap, maxspan);
+  int err = 0;
+  for(size_t i=0; i < n && err == 0; ) {
+    off_t end;
+    const size_t j = staging ? group(iov, n, i, gap, maxspan, &end) : i+1;
+    if(j == i+1) {
+      err = iocall(of->iop.read, of, iov[i].offset, iov[i].len, iov[i].buf);
+    } else {
+      err = iocall(of->iop.read, of, iov[i].offset,
+                   (size_t)(end - iov[i].offset), staging);
+      for(size_t k=i; k < j && err == 0; ++k) {
+        memcpy(iov[k].buf, staging + (iov[k].offset - iov[i].offset),
+               iov[k].len);
+      }
+    }
+    i = j;
+  }
+  free(staging);
+  return err;
+}
+
+/* the write side of sieving is read-modify-write: a group's span is read,
+ * the pieces are laid over it, and the whole span goes back with one call.
+ * A group without gaps needn't be read first.  If the span can't be read
+ * (it may lie past the end of a new file), the pieces are written one by
+ * one instead.  The lock stops another of this file's writers changing the
+ * gaps between our read and our write. */
+static int
+sievewrite(const struct ookfile* of, const struct ookiov* iov, const size_t n)
+{
+  rwop* wr = (rwop*)of->iop.write;
+  char* staging = spanbuffer(iov, n, of->sievegap, of->sievebuf);
+  if(of->sievelock) { pthread_mutex_lock(of->sievelock); }
+  int err = 0;
+  for(size_t i=0; i < n && err == 0; ) {
+    off_t end;
+    const size_t j = staging ? group(iov, n, i, of->sievegap, of->sievebuf,
+                                     &end)
+                             : i+1;
+    bool gaps = false;
+    for(size_t k=i+1; k < j; ++k) {
+      if(iov[k].offset > iov[k-1].offset + (off_t)iov[k-1].len) {
+        gaps = true;
+      }
+    }
+    const size_t span = j > i+1 ? (size_t)(end - iov[i].offset) : 0;
+    if(j == i+1 ||
+       (gaps && iocall(of->iop.read, of, iov[i].offset, span, staging) != 0)) {
+      for(size_t k=i; k < j && err == 0; ++k) {
+        err = iocall(wr, of, iov[k].offset, iov[k].len, iov[k].buf);
+      }
+    } else {
+      for(size_t k=i; k < j; ++k) {
+        memcpy(staging + (iov[k].offset - iov[i].offset), iov[k].buf,
+               iov[k].len);
+      }
+      err = iocall(wr, of, iov[i].offset, span, staging);
+    }
+    i = j;
+  }
+  if(of->sievelock) { pthread_mutex_unlock(of->sievelock); }
+  free(staging);
+  return err;
+}
+
+/* reads many bricks at once.  Rather than reading them one after another,
+ * the scanlines of all of them are gathered into one list, sorted by file
+ * offset and read in that order: the file is swept from front to back once,
+ * as an elevator would, however the bricks were ordered.  A vectored
+ * interface gets the whole list in one call; otherwise adjacent scanlines
+ * (or, when sieving, nearby ones) are read together.
+ * Padded and sparse files, which need their scanlines one at a time, just
+ * have their bricks read in file order. */
+int
+ookbricks_read(const struct ookfile* of, const size_t ids[], size_t n,
+               void* bufs[])
+{
+  if(of == NULL || (n > 0 && (ids == NULL || bufs == NULL))) { return EINVAL; }
+  for(size_t i=0; i < n; ++i) {
+    if(ids[i] >= of->nbricks || bufs[i] == NULL) { return EINVAL; }
+  }
+  const uint64_t start = clocknow();
+  /* the bricks we actually have to read, in file order. */
+  struct brickat* todo = malloc(sizeof(struct brickat) * (n+1));
+  if(todo == NULL) { return ENOMEM; }
+  size_t ntodo = 0;
+  size_t pieces = 0;
+  for(size_t i=0; i < n; ++i) {
+    if(cachehit(of, ids[i], bufs[i])) { continue; }
+    size_t b[3];
+    bidxto3d(ids[i], of->layout, b);
+    const uint64_t at[3] = {
+      of->origin[0][b[0]], of->origin[1][b[1]], of->origin[2][b[2]]
+    };
+    todo[ntodo].offset = of->brickmajor != 0 ? brickstart(of, ids[i])
+                                             : scanoffset(of, of->layout, b[0],
+                                                          at);
+    todo[ntodo].i = i;
+    ++ntodo;
+    pieces += of->edge[1][b[1]] * of->edge[2][b[2]];
+  }
+  qsort(todo, ntodo, sizeof(struct brickat), brickatcmp);
+
+  int err = 0;
+  if(of->align != 0 || of->sparse) {
+    for(size_t t=0; t < ntodo && err == 0; ++t) {
+      errno = 0;
+      srcop(of->iop.read, of, ids[todo[t].i], bufs[todo[t].i], NULL);
+      err = errno;
+      if(err == 0) { cacheput(of, ids[todo[t].i], bufs[todo[t].i]); }
+    }
+    free(todo);
+    histogram(of, OOK_OP_BRICK, clocknow() - start);
+    traceop(of, "ookbricks_read", start, "bricks", n);
+    return err;
+  }
+
+  struct ookiov* iov = malloc(sizeof(struct ookiov) * (pieces+1));
+  struct span* spans = malloc(sizeof(struct span) *
+                              of->bricksize[1]*of->bricksize[2]);
+  if(iov == NULL || spans == NULL) {
+    free(spans); free(iov); free(todo);
+    return ENOMEM;
+  }
+  size_t niov = 0;
+  for(size_t t=0; t < ntodo; ++t) {
+    const size_t i = todo[t].i;
+    const size_t ns = brickspans(of, ids[i], spans);
+    for(size_t k=0; k < ns; ++k) {
+      iov[niov].offset = spans[k].offset;
+      iov[niov].len = spans[k].len;
+      iov[niov].buf = (char*)bufs[i] + k*spans[k].len;
+      ++niov;
+    }
+    STATADD(of->stats->bricks_read, 1);
+    STATADD(of->stats->brick_bytes_read, brickbytes(of, ids[i]));
+  }
+  free(spans);
+  qsort(iov, niov, sizeof(struct ookiov), iovcmp);
+  /* scanlines adjacent in both the file and memory become one piece. */
+  size_t m = 0;
+  for(size_t k=1; k < niov; ++k) {
+    if(iov[m].offset + (off_t)iov[m].len == iov[k].offset &&
+       (char*)iov[m].buf + iov[m].len == (char*)iov[k].buf) {
+      iov[m].len += iov[k].len;
+    } else {
+      iov[++m] = iov[k];
+    }
+  }
+  niov = niov == 0 ? 0 : m+1;
+
+  if(niov > 0 && of->iop.vread != NULL && of->sievegap == 0) {
+    err = viocall(of->iop.vread, of, iov, niov);
+  } else if(niov > 0) {
+    err = readruns(of, iov, niov, of->sievegap,
+                   of->sievegap ? of->sievebuf : BATCH_RUN);
+  }
+  free(iov);
+
+  for(size_t t=0; t < ntodo && err == 0; ++t) {
+    const size_t i = todo[t].i;
+    if(of->swap) {
+      size_t bs[3];
+      ookbricksize(of, ids[i], bs);
+      byteswap(bufs[i], bufs[i], bs[0]*bs[1]*bs[2] * of->components,
+               width(of->type));
+    }
+    cacheput(of, ids[i], bufs[i]);
+  }
+  free(todo);
+  /* one sample for the batch; the timeline has its own event for it. */
+  histogram(of, OOK_OP_BRICK, clocknow() - start);
+  traceop(of, "ookbricks_read", start, "bricks", n);
+  return err;
+}
+
+/* a brick-major file starts with a header of this many bytes, which holds
+ * the descriptor below; the bricks follow, in ID order.  Every field is
+ * little-endian:
+ *    0  "OOKBRICK"
+ *    8  u32 version (1)
+ *   12  u32 bytes in the header: where brick 0 starts
+ *   16  u64 voxels, X Y Z
+ *   40  u64 brick size, X Y Z
+ *   64  u32 type, u32 components
+ * The rest of the header is zeroes.  A whole page keeps the bricks aligned,
+ * and lets DirectIO read it. */
+#define BRICKMAJOR_HEADER 4096
+static const char brickmagic[8] = { 'O','O','K','B','R','I','C','K' };
+
+static void
+put64(unsigned char* p, uint64_t v)
+{
+  for(size_t i=0; i < 8; ++i) { p[i] = (unsigned char)(v >> (8*i)); }
+}
+
+static uint64_t
+get64(const unsigned char* p)
+{
+  uint64_t v = 0;
+  for(size_t i=0; i < 8; ++i) { v |= (uint64_t)p[i] << (8*i); }
+  return v;
+}
+
+static void
+put32(unsigned char* p, uint32_t v)
+{
+  for(size_t i=0; i < 4; ++i) { p[i] = (unsigned char)(v >> (8*i)); }
+}
+
+static uint32_t
+get32(const unsigned char* p)
+{
+  uint32_t v = 0;
+  for(size_t i=0; i < 4; ++i) { v |= (uint32_t)p[i] << (8*i); }
+  return v;
+}
+
+static off_t
+brickstart(const struct ookfile* of, const size_t id)
+{
+  return of->brickmajor +
+         (off_t)(voxelsbefore(of, id) * of->components * width(of->type));
+}
+
+/* switches an opened file to the brick-major layout 'ookrebrick' writes.
+ * The header is read straight from the interface, so that it doesn't show
+ * up in the statistics.  A file without one, or whose header doesn't match
+ * what the caller said the volume is, is refused: it would be read as
+ * garbage otherwise. */
+int
+ookbrickmajor(struct ookfile* of)
+{
+  if(of == NULL || of->mode == OOK_RDWR) { return EINVAL; }
+  if(of->align != 0) { return EOPNOTSUPP; }
+  void* mem;
+  if(posix_memalign(&mem, BRICKMAJOR_HEADER, BRICKMAJOR_HEADER) != 0) {
+    return ENOMEM;
+  }
+  const unsigned char* h = (const unsigned char*) mem;
+  int err = of->iop.read(of->fd, 0, BRICKMAJOR_HEADER, mem);
+  if(err == 0 && memcmp(h, brickmagic, sizeof(brickmagic)) != 0) {
+    err = EINVAL;
+  }
+  if(err == 0) {
+    const uint32_t hsize = get32(h+12);
+    if(get32(h+8) != 1 || hsize < 72) { err = EINVAL; }
+    for(size_t i=0; i < 3; ++i) {
+      if(get64(h+16 + 8*i) != of->volsize[i] ||
+         get64(h+40 + 8*i) != (uint64_t)of->bricksize[i]) {
+        err = EINVAL;
+      }
+    }
+    if(get32(h+64) != (uint32_t)of->type ||
+       get32(h+68) != (uint32_t)of->components) {
+      err = EINVAL;
+    }
+    if(err == 0) { of->brickmajor = (off_t)hsize; }
+  }
+  free(mem);
+  return err;
+}
+
+/* rewrites the x-fastest file behind 'src' into 'dst', brick-major: each
+ * brick contiguous, in ID order, after a header which describes the volume.
+ * 'ookread' recognizes the header, and then reads every brick with a single
+ * call.  Values are copied as they are, in whatever byte order 'src' has.
+ *
+ * This works a row of bricks (one Y and Z brick index; every X) at a time.
+ * In 'src' a row is ey*ez scanlines, the whole width of the volume, and for
+ * every slice those are one contiguous piece; in 'dst' the bricks of a row
+ * are consecutive.  So a row is one read per slice, an in-memory shuffle,
+ * and one write.  If a row (twice over: as read, then as bricks) doesn't fit
+ * in 'budget' bytes, it is done a few bricks at a time instead. */
+int
+ookrebrick(const struct ookfile* src, struct io out, const char* dst,
+           size_t budget)
+{
+  if(src == NULL || dst == NULL) { return EINVAL; }
+  if(src->align != 0 || src->brickmajor != 0) { return EOPNOTSUPP; }
+  if(budget == 0) { budget = 64*1024*1024; }
+  const size_t cw = src->components * width(src->type);
+  const size_t maxbrick = src->bricksize[0]*src->bricksize[1]*
+                          src->bricksize[2] * cw;
+  size_t per = budget / (2*maxbrick); /* bricks in X done at once. */
+  if(per == 0) { per = 1; }
+  if(per > src->layout[0]) { per = src->layout[0]; }
+
+  unsigned char* head = calloc(1, BRICKMAJOR_HEADER);
+  char* in = malloc(per*maxbrick);
+  char* bricks = malloc(per*maxbrick);
+  if(head == NULL || in == NULL || bricks == NULL) {
+    free(bricks); free(in); free(head);
+    return ENOMEM;
+  }
+  void* fd = out.open(dst, OOK_RDWR, out.state);
+  if(fd == NULL) {
+    const int err = errno != 0 ? errno : EINVAL;
+    free(bricks); free(in); free(head);
+    return err;
+  }
+  const uint64_t* vol = src->volsize;
+  const off_t total = (off_t)(vol[0]*vol[1]*vol[2] * cw);
+  if(out.preallocate) { out.preallocate(fd, BRICKMAJOR_HEADER + total); }
+
+  memcpy(head, brickmagic, sizeof(brickmagic));
+  put32(head+8, 1);
+  put32(head+12, BRICKMAJOR_HEADER);
+  for(size_t i=0; i < 3; ++i) {
+    put64(head+16 + 8*i, vol[i]);
+    put64(head+40 + 8*i, src->bricksize[i]);
+  }
+  put32(head+64, (uint32_t)src->type);
+  put32(head+68, (uint32_t)src->components);
+  int err = out.write(fd, 0, BRICKMAJOR_HEADER, head);
+
+  const size_t* layout = src->layout;
+  for(size_t bz=0; bz < layout[2] && err == 0; ++bz) {
+    for(size_t by=0; by < layout[1] && err == 0; ++by) {
+      const size_t ey = src->edge[1][by];
+      const size_t ez = src->edge[2][bz];
+      for(size_t bx0=0; bx0 < layout[0] && err == 0; bx0 += per) {
+        const size_t bx1 = bx0+per < layout[0] ? bx0+per : layout[0];
+        const uint64_t x0 = src->origin[0][bx0];
+        const size_t wide = (size_t)(src->origin[0][bx1-1] +
+                                     src->edge[0][bx1-1] - x0);
+        /* 'in' holds the part of the row as it is in the file. */
+        for(size_t z=0; z < ez && err == 0; ++z) {
+          const uint64_t at[3] = {
+            x0, src->origin[1][by], src->origin[2][bz] + z
+          };
+          const off_t offset = scanoffset(src, layout, bx0, at);
+          if(wide == vol[0]) {
+            err = iocall(src->iop.read, src, offset, wide*ey*cw,
+                         in + z*ey*wide*cw);
+            continue;
+          }
+          for(size_t y=0; y < ey && err == 0; ++y) {
+            err = iocall(src->iop.read, src, offset + (off_t)(y*vol[0]*cw),
+                         wide*cw, in + (z*ey + y)*wide*cw);
+          }
+        }
+        /* .. and 'bricks', the same data as the bricks of the row. */
+        char* to = bricks;
+        for(size_t bx=bx0; bx < bx1; ++bx) {
+          const size_t ex = src->edge[0][bx];
+          const size_t dx = (size_t)(src->origin[0][bx] - x0);
+          for(size_t zy=0; zy < ez*ey; ++zy) {
+            memcpy(to, in + (zy*wide + dx)*cw, ex*cw);
+            to += ex*cw;
+          }
+        }
+        const size_t first = bz*layout[0]*layout[1] + by*layout[0] + bx0;
+        if(err == 0) {
+          err = out.write(fd, BRICKMAJOR_HEADER +
+                              (off_t)(voxelsbefore(src, first) * cw),
+                          (size_t)(to - bricks), bricks);
+        }
+      }
+    }
+  }
+  const int cerr = out.close(fd);
+  free(bricks);
+  free(in);
+  free(head);
+  return err != 0 ? err : cerr;
 }
 
 #ifndef NDEBUG
@@ -351,6 +2219,8 @@ test()
     struct ookfile of;
     of.volsize[0] = of.volsize[1] = of.volsize[2] = 1000;
     of.bricksize[0] = of.bricksize[1] = of.bricksize[2] = 100;
+    assert(geometry(&of) == 0);
+    assert(of.nbricks == 10*10*10);
     size_t bs[3];
     for(size_t i=0; i < 10*10*10; ++i) {
 			ookbricksize(&of, i, bs);
@@ -358,11 +2228,14 @@ test()
 			assert(bs[1] == 100);
 			assert(bs[2] == 100);
     }
+    geometry_free(&of);
   }
   {
     struct ookfile of;
     of.volsize[0] = of.volsize[1] = of.volsize[2] = 40;
     of.bricksize[0] = of.bricksize[1] = of.bricksize[2] = 16;
+    assert(geometry(&of) == 0);
+    assert(of.nbricks == 3*3*3);
     size_t bs[3];
     ookbricksize(&of, 0, bs);
     assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 16);
@@ -403,6 +2276,21 @@ test()
     assert(bs[0] == 16 && bs[1] == 8 && bs[2] == 8);
     ookbricksize(&of, 26, bs);
     assert(bs[0] == 8 && bs[1] == 8 && bs[2] == 8);
+    geometry_free(&of);
+  }
+  {
+    /* more voxels than a double can count exactly. */
+    struct ookfile of;
+    of.volsize[0] = (UINT64_C(1) << 53) + 1;
+    of.volsize[1] = of.volsize[2] = 1;
+    of.bricksize[0] = (size_t)1 << 40;
+    of.bricksize[1] = of.bricksize[2] = 1;
+    assert(geometry(&of) == 0);
+    assert(of.layout[0] == (1U << 13) + 1);
+    size_t bs[3];
+    ookbricksize(&of, of.layout[0]-1, bs);
+    assert(bs[0] == 1);
+    geometry_free(&of);
   }
   return 1;
 }
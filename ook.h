@@ -29,19 +29,103 @@ void ookmaxbricksize(const struct ookfile*, size_t[3]);
 
 int ookbrick(const struct ookfile*, size_t id, void* data);
 int ookbrick3(const struct ookfile*, const size_t id[3], void* data);
+/* reads 'n' bricks into the corresponding buffers, in file order. */
+int ookbricks_read(const struct ookfile*, const size_t ids[], size_t n,
+                   void* bufs[]);
+/* how multiple components are arranged in memory.  Interleaved is how they
+ * are stored: all of a voxel's components together.  Planar gives each
+ * component its own contiguous plane. */
+enum OOKLAYOUT { OOK_INTERLEAVED, OOK_PLANAR };
+int ookbrick_components(const struct ookfile*, size_t id, uint64_t mask,
+                        enum OOKLAYOUT layout, void* data);
 void ookdimensions(const struct ookfile*, uint64_t[3]);
 
 struct ookfile*
 ookcreate(struct io, const char* filename,
           const uint64_t dims[3], const size_t bsize[3],
           enum OOKTYPE, size_t components);
+struct ookfile*
+ookupdate(struct io, const char* filename,
+          const uint64_t dims[3], const size_t bsize[3],
+          enum OOKTYPE, size_t components);
 
 void ookbricksize(const struct ookfile*, const size_t id, size_t bsize[3]);
 void ookbricksize3(const struct ookfile*, const size_t id[3], size_t bsize[3]);
 void ookwrite(struct ookfile*, const size_t id, const void*);
 
+/* multi-process execution: each of 'nranks' ranks takes a balanced,
+ * contiguous range of bricks [range[0], range[1]). */
+int ookpartition(const struct ookfile*, size_t rank, size_t nranks,
+                 size_t range[2]);
+/* two-phase collective I/O between processes forked after it is created. */
+struct ookcollective;
+#define OOK_NOBRICK SIZE_MAX
+struct ookcollective* ookcollective(size_t nranks, size_t naggregators,
+                                    size_t bufsize);
+int ookcollread(struct ookcollective*, const struct ookfile*, size_t rank,
+                size_t id, void* data);
+int ookcollwrite(struct ookcollective*, struct ookfile*, size_t rank,
+                 size_t id, const void* data);
+int ookcollective_destroy(struct ookcollective*);
+
 int ookclose(struct ookfile*);
 
+int ookalign(struct ookfile*, size_t block);
+void* ookalloc(const struct ookfile*);
+void ookfree(void*);
+/* byte order of the data in a file. */
+enum OOKENDIAN { OOK_NATIVE, OOK_LITTLE, OOK_BIG };
+int ookendian(struct ookfile*, enum OOKENDIAN);
+int ooksparse(struct ookfile*, bool enable);
+int ooksieve(struct ookfile*, size_t gap, size_t bufsize);
+/* rewrites a file so that each brick is contiguous; see ookrebrick(3). */
+int ookrebrick(const struct ookfile* src, struct io, const char* dst,
+               size_t budget);
+/* reads a file ookrebrick wrote; see ookbrickmajor(3). */
+int ookbrickmajor(struct ookfile*);
+
+/** Counters kept for every ookfile.  'bytes_*' and '*_calls' refer to the
+ * io-interface; 'brick_bytes_*' to what callers of ookbrick/ookwrite see. */
+#define OOK_HISTBUCKETS 32
+enum OOKOP { OOK_OP_READ, OOK_OP_WRITE, OOK_OP_BRICK, OOK_OP_OOKWRITE,
+             OOK_NOPS };
+struct ookstats {
+  uint64_t bricks_read;
+  uint64_t bricks_written;
+  uint64_t brick_bytes_read;
+  uint64_t brick_bytes_written;
+  uint64_t read_calls;
+  uint64_t write_calls;
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint64_t punch_calls;
+  uint64_t hole_calls;
+  uint64_t cache_hits; /* bricks served from the shared cache */
+  uint64_t cache_misses;
+  /* latency[op][i] counts operations which took [2^i, 2^(i+1)) ns. */
+  uint64_t latency[OOK_NOPS][OOK_HISTBUCKETS];
+  uint64_t nanoseconds[OOK_NOPS]; /* total time spent in each operation */
+};
+int ookstats(const struct ookfile*, struct ookstats*);
+int ookstats_json(const struct ookfile*, FILE*);
+int ooktrace(struct ookfile*, const char* filename);
+
+/** Shares bricks between every process attached to the same POSIX
+ * shared-memory cache.  see ookshmcache(3). */
+int ookshmcache(struct ookfile*, const char* name, size_t bytes);
+int ookshmcache_unlink(const char* name);
+
+/** Hints used to choose a brick size automatically.  Every field is in bytes;
+ * a field left as 0 is filled in with a default derived from the host. */
+struct ookconstraints {
+  size_t cache;    /* cache a brick should fit in.  default: LLC per core */
+  size_t memory;   /* per-thread memory budget for one brick */
+  size_t iosize;   /* preferred I/O size of the filesystem (st_blksize) */
+  size_t scanline; /* desired minimum length of one scanline transfer */
+};
+int ookautobricksize(const uint64_t dims[3], enum OOKTYPE, size_t components,
+                     const struct ookconstraints*, size_t bsize[3]);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,197 @@
+/* Re-bricking tool using ook.  Usage (e.g.):
+ *    ./ookrebrick -i volume.raw -o bricked.raw -t i16 -x 128 -y 96 -z 84
+ * reads: 'volume.raw'
+ * outputs: 'bricked.raw', the same volume in brick-major order.
+ * Reading the output with ook (see ookbrickmajor(3)), using the same brick
+ * size, gives back the same bricks, but each comes from one contiguous piece
+ * of the file.  Worth it for
+ * volumes which are read many times. */
+#define _POSIX_C_SOURCE 200112L
+#include <assert.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "ook.h"
+
+/* dimensions of the input volume. */
+static uint64_t vol[3] = {0};
+/* brick size to lay the output out in; 0s mean ook picks one. */
+static size_t bsize[3] = {0};
+/* filename given as input */
+static char* input = NULL;
+/* filename to create/generate */
+static char* output = NULL;
+/* input type to assume */
+static enum OOKTYPE itype = OOK_I8;
+/* number of components per voxel */
+static size_t components = 1;
+/* memory to use for the conversion, in MiB.  0 means ook's default. */
+static size_t budget = 0;
+/* verbosity of output.  0 (the default) is terse. */
+static uint16_t verbose = 0U;
+
+/* allocation that succeeds or dies. */
+static void* xmalloc(const size_t bytes);
+/* duplicates a string.  caller must free! */
+static char* tjfstrdup(const char* str);
+/* identifies the appropriate ook type from a string representation of it. */
+static enum OOKTYPE strtotype(const char*);
+
+static void
+usage(const char* progname)
+{
+  printf(
+"Usage: %s -i input.raw -t type -x <uint> -y <uint> -z <uint> -o out.raw\n\n"
+"\t-i  input volume to read.  only raw data are supported.\n"
+"\t-t  type of input volume. one of: i8,u8,i16,u16,i32,u32,i64,u64,f,d\n"
+"\t-c  number of components per voxel [default=1]\n"
+"\t-x  number of voxels in input (and output) volume, in X dimension.\n"
+"\t-y  ditto, for Y dimension\n"
+"\t-z  ditto, for Z dimension\n"
+"\t-X  brick size of the output, in X dimension [default: automatic]\n"
+"\t-Y  ditto, for Y dimension\n"
+"\t-Z  ditto, for Z dimension\n"
+"\t-m  memory to use, in MiB [default=64]\n"
+"\t-v  print I/O statistics when done\n"
+"\t-o  output volume to create, brick-major.\n\n"
+"Type names are generally 'i' for integer, 'u' for unsigned integer, "
+"followed by the byte width of the type.  The special types 'f' and 'd' "
+"stand for 'float' and 'double', respectively.\n"
+"The output must be read with the same brick size it was written with, "
+"through ookbrickmajor(3); the size chosen is printed.\n",
+  progname);
+}
+
+/* sets global variables (options) based on command line options.
+ * allocates 'input' and 'output'. */
+static void
+parseopt(int argc, char* const argv[])
+{
+  int opt;
+  while((opt = getopt(argc, argv, "i:o:t:c:x:y:z:X:Y:Z:m:vh")) != -1) {
+    switch(opt) {
+      case 'i':
+        if(input != NULL) { free(input); input = NULL; }
+        input = tjfstrdup(optarg);
+        break;
+      case 'o':
+        if(output != NULL) { free(output); output = NULL; }
+        output = tjfstrdup(optarg);
+        break;
+      case 't':
+        itype = strtotype(optarg);
+        break;
+      case 'c': components = (size_t)atoll(optarg); break;
+      case 'x': vol[0] = (uint64_t)atoll(optarg); break;
+      case 'y': vol[1] = (uint64_t)atoll(optarg); break;
+      case 'z': vol[2] = (uint64_t)atoll(optarg); break;
+      case 'X': bsize[0] = (size_t)atoll(optarg); break;
+      case 'Y': bsize[1] = (size_t)atoll(optarg); break;
+      case 'Z': bsize[2] = (size_t)atoll(optarg); break;
+      case 'm': budget = (size_t)atoll(optarg); break;
+      case 'v':
+        verbose++;
+        break;
+      case 'h': /* FALL-THROUGH */
+      default:
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+  }
+  if(NULL == input) {
+    fprintf(stderr, "No input file given!\n");
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if(NULL == output) {
+    fprintf(stderr, "Output file needed.\n");
+    usage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  if(components == 0) {
+    fprintf(stderr, "Need at least one component.\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+int
+main(int argc, char* const argv[])
+{
+  parseopt(argc, argv);
+
+  if(!ookinit()) {
+    fprintf(stderr, "Initialization failed.\n");
+    exit(EXIT_FAILURE);
+  }
+  if(bsize[0] == 0 || bsize[1] == 0 || bsize[2] == 0) {
+    if(ookautobricksize(vol, itype, components, NULL, bsize) != 0) {
+      fprintf(stderr, "Invalid volume dimensions.\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  struct ookfile* fin = ookread(StdCIO, input, vol, bsize, itype, components);
+  if(!fin) { perror("open"); exit(EXIT_FAILURE); }
+
+  const int err = ookrebrick(fin, StdCIO, output, budget*1024*1024);
+  if(err != 0) {
+    fprintf(stderr, "Re-bricking failed: %s\n", strerror(err));
+    ookclose(fin);
+    free(input);
+    free(output);
+    return EXIT_FAILURE;
+  }
+  printf("Wrote %s with %zu bricks of %zux%zux%zu.\n", output, ookbricks(fin),
+         bsize[0], bsize[1], bsize[2]);
+  if(verbose) {
+    ookstats_json(fin, stderr);
+  }
+
+  free(input);
+  free(output);
+  ookclose(fin);
+  return EXIT_SUCCESS;
+}
+
+static void*
+xmalloc(const size_t bytes)
+{
+  void* rv = malloc(bytes);
+  if(rv == NULL) {
+    exit(EXIT_FAILURE);
+  }
+  return rv;
+}
+
+static char*
+tjfstrdup(const char* str)
+{
+  const size_t n = strlen(str);
+  char* rv = xmalloc(n + 1);
+  return strncpy(rv, str, n+1);
+}
+
+static enum OOKTYPE
+strtotype(const char* str)
+{
+  if(strcasecmp(str, "i8") == 0) { return OOK_I8;
+  } else if(strcasecmp(str, "u8") == 0) { return OOK_U8;
+  } else if(strcasecmp(str, "i16") == 0) { return OOK_I16;
+  } else if(strcasecmp(str, "u16") == 0) { return OOK_U16;
+  } else if(strcasecmp(str, "i32") == 0) { return OOK_I32;
+  } else if(strcasecmp(str, "u32") == 0) { return OOK_U32;
+  } else if(strcasecmp(str, "i64") == 0) { return OOK_I64;
+  } else if(strcasecmp(str, "u64") == 0) { return OOK_U64;
+  } else if(strcasecmp(str, "f") == 0) { return OOK_FLOAT;
+  } else if(strcasecmp(str, "d") == 0) { return OOK_DOUBLE;
+  } else {
+    fprintf(stderr, "Invalid type '%s'\n", str);
+    exit(EXIT_FAILURE);
+  }
+  assert(false);
+  return OOK_I8;
+}
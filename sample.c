@@ -226,7 +226,12 @@ main(int argc, char* const argv[])
     exit(EXIT_FAILURE);
   }
   const uint64_t volumesize[3] = { 2025, 1600, 400 };
-  const size_t bricksize[3] = { 405, 320, 80 };
+  /* both files are bricked alike; the wider type decides how. */
+  size_t bricksize[3];
+  if(ookautobricksize(volumesize, OOK_U16, 1, NULL, bricksize) != 0) {
+    fprintf(stderr, "Invalid volume dimensions.\n");
+    exit(EXIT_FAILURE);
+  }
 
   struct ookfile* f1 = ookread(StdCIO, input[0], volumesize, bricksize,
                                OOK_U16, 1);
@@ -282,7 +287,8 @@ main(int argc, char* const argv[])
     case OOK_DOUBLE: fqn = adddouble; break;
   }
 
-  for(size_t brick=0; brick < ookbricks(f1); ++brick) {
+  const size_t nbricks = ookbricks(f1);
+  for(size_t brick=0; brick < nbricks; ++brick) {
     size_t bs[3];
     ookbricksize(f1, brick, bs);
     ookbrick(f1, brick, &data[0]);
@@ -0,0 +1,264 @@
+#define _POSIX_C_SOURCE 200809L
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include "shmcache.h"
+
+#define SHM_MAGIC UINT64_C(0x6f6f6b6361636865) /* "ookcache" */
+#define SHM_SHARDS 16
+#define LINE 64 /* keep shards and slot data on separate cache lines. */
+
+#ifdef __GNUC__
+#  define LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#  define STORE(var, v) __atomic_store_n(&(var), (v), __ATOMIC_RELEASE)
+#else
+#  define LOAD(var) (var)
+#  define STORE(var, v) ((var) = (v))
+#endif
+
+/* the start of the shared mapping.  'ready' is set last, once the creator
+ * has initialized everything. */
+struct header {
+  uint64_t magic;
+  uint64_t ready;
+  size_t bytes; /* size of the whole mapping. */
+  size_t slotsize;
+  size_t nshards;
+  size_t pershard; /* slots per shard. */
+};
+
+struct shard {
+  pthread_mutex_t lock;
+  uint64_t tick; /* for LRU; bumped on every use. */
+  char pad_[LINE];
+};
+
+struct slot {
+  struct cachekey key;
+  uint64_t used; /* shard's tick when last used. */
+  size_t len;
+  int valid;
+};
+
+struct shmcache {
+  struct header* hdr;
+  struct shard* shards;
+  struct slot* slots;
+  char* data;
+};
+
+static size_t
+roundup(const size_t n, const size_t to)
+{
+  return ((n + to-1) / to) * to;
+}
+
+/* finds the pieces of the mapping at 'mem'. */
+static void
+carve(struct shmcache* c, char* mem)
+{
+  c->hdr = (struct header*) mem;
+  const size_t nslots = c->hdr->nshards * c->hdr->pershard;
+  c->shards = (struct shard*)(mem + roundup(sizeof(struct header), LINE));
+  c->slots = (struct slot*)((char*)c->shards +
+                            roundup(sizeof(struct shard)*c->hdr->nshards, LINE));
+  c->data = (char*)c->slots + roundup(sizeof(struct slot)*nslots, LINE);
+}
+
+/* a process which died holding a lock may have left a slot half-written.
+ * Slots are marked invalid while they are written, so we just carry on. */
+static void
+lock(pthread_mutex_t* m)
+{
+  const int err = pthread_mutex_lock(m);
+  if(err == EOWNERDEAD) { pthread_mutex_consistent(m); }
+}
+
+static int
+initialize(char* mem, const size_t bytes, const size_t slotsize)
+{
+  struct header* hdr = (struct header*) mem;
+  const size_t fixed = roundup(sizeof(struct header), LINE) +
+                       roundup(sizeof(struct shard)*SHM_SHARDS, LINE) + LINE;
+  const size_t each = sizeof(struct slot) + roundup(slotsize, LINE);
+  size_t nslots = bytes > fixed ? (bytes - fixed) / each : 0;
+  if(nslots == 0) { return EINVAL; }
+  hdr->nshards = nslots < SHM_SHARDS ? nslots : SHM_SHARDS;
+  hdr->pershard = nslots / hdr->nshards;
+  hdr->slotsize = roundup(slotsize, LINE);
+  hdr->bytes = bytes;
+  struct shmcache c;
+  carve(&c, mem);
+  pthread_mutexattr_t attr;
+  int err = pthread_mutexattr_init(&attr);
+  if(err != 0) { return err; }
+  err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  if(err == 0) { err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST); }
+  for(size_t s=0; s < hdr->nshards && err == 0; ++s) {
+    err = pthread_mutex_init(&c.shards[s].lock, &attr);
+    c.shards[s].tick = 0;
+  }
+  pthread_mutexattr_destroy(&attr);
+  if(err != 0) { return err; }
+  /* the mapping starts out zeroed, so every slot is already invalid. */
+  hdr->magic = SHM_MAGIC;
+  STORE(hdr->ready, 1);
+  return 0;
+}
+
+struct shmcache*
+shmcache_open(const char* name, size_t bytes, size_t slotsize)
+{
+  if(name == NULL || bytes == 0 || slotsize == 0) {
+    errno = EINVAL;
+    return NULL;
+  }
+  bool creator = true;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if(fd == -1 && errno == EEXIST) {
+    creator = false;
+    fd = shm_open(name, O_RDWR, 0600);
+  }
+  if(fd == -1) { return NULL; }
+
+  int err = 0;
+  if(creator && ftruncate(fd, (off_t)bytes) != 0) { err = errno; }
+  /* someone else is creating it: wait until it has its size, then (below)
+   * until it is initialized. */
+  const struct timespec ms = { 0, 1000000 };
+  struct stat st;
+  for(size_t tries=0; !creator && err == 0; ++tries) {
+    if(fstat(fd, &st) != 0) { err = errno; break; }
+    if(st.st_size > 0) { bytes = (size_t)st.st_size; break; }
+    if(tries == 1000) { err = ETIMEDOUT; break; }
+    nanosleep(&ms, NULL);
+  }
+  char* mem = MAP_FAILED;
+  if(err == 0) {
+    mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(mem == MAP_FAILED) { err = errno; }
+  }
+  close(fd);
+  if(err == 0 && creator) {
+    err = initialize(mem, bytes, slotsize);
+    if(err != 0) { shm_unlink(name); }
+  }
+  struct header* hdr = (struct header*) mem;
+  for(size_t tries=0; err == 0 && LOAD(hdr->ready) == 0; ++tries) {
+    if(tries == 1000) { err = ETIMEDOUT; break; }
+    nanosleep(&ms, NULL);
+  }
+  if(err == 0 && (hdr->magic != SHM_MAGIC || hdr->bytes != bytes)) {
+    err = EINVAL; /* not one of ours. */
+  }
+  struct shmcache* c = NULL;
+  if(err == 0 && (c = calloc(1, sizeof(struct shmcache))) == NULL) {
+    err = ENOMEM;
+  }
+  if(err != 0) {
+    if(mem != MAP_FAILED) { munmap(mem, bytes); }
+    errno = err;
+    return NULL;
+  }
+  carve(c, mem);
+  return c;
+}
+
+/* FNV-1a, over the whole key. */
+static uint64_t
+hash(const struct cachekey* key)
+{
+  const unsigned char* k = (const unsigned char*) key;
+  uint64_t h = UINT64_C(14695981039346656037);
+  for(size_t i=0; i < sizeof(struct cachekey); ++i) {
+    h = (h ^ k[i]) * UINT64_C(1099511628211);
+  }
+  return h;
+}
+
+/* the shard a key lives in, and that shard's first slot. */
+static struct shard*
+shardof(const struct shmcache* c, const struct cachekey* key,
+        struct slot** first)
+{
+  const size_t s = hash(key) % c->hdr->nshards;
+  *first = c->slots + s*c->hdr->pershard;
+  return &c->shards[s];
+}
+
+static char*
+slotdata(const struct shmcache* c, const struct slot* sl)
+{
+  return c->data + (size_t)(sl - c->slots) * c->hdr->slotsize;
+}
+
+bool
+shmcache_get(struct shmcache* c, const struct cachekey* key, void* data,
+             size_t len)
+{
+  if(len > c->hdr->slotsize) { return false; }
+  struct slot* slots;
+  struct shard* sh = shardof(c, key, &slots);
+  bool hit = false;
+  lock(&sh->lock);
+  for(size_t i=0; i < c->hdr->pershard; ++i) {
+    struct slot* sl = &slots[i];
+    if(sl->valid && sl->len == len &&
+       memcmp(&sl->key, key, sizeof(struct cachekey)) == 0) {
+      memcpy(data, slotdata(c, sl), len);
+      sl->used = ++sh->tick;
+      hit = true;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&sh->lock);
+  return hit;
+}
+
+void
+shmcache_put(struct shmcache* c, const struct cachekey* key,
+             const void* data, size_t len)
+{
+  if(len > c->hdr->slotsize) { return; }
+  struct slot* slots;
+  struct shard* sh = shardof(c, key, &slots);
+  lock(&sh->lock);
+  /* replace the same brick if it's here; else an empty slot; else the
+   * least recently used. */
+  struct slot* victim = NULL;
+  for(size_t i=0; i < c->hdr->pershard; ++i) {
+    struct slot* sl = &slots[i];
+    if(sl->valid && memcmp(&sl->key, key, sizeof(struct cachekey)) == 0) {
+      victim = sl;
+      break;
+    }
+    if(victim == NULL || (victim->valid && !sl->valid) ||
+       (victim->valid && sl->valid && sl->used < victim->used)) {
+      victim = sl;
+    }
+  }
+  victim->valid = 0;
+  memcpy(slotdata(c, victim), data, len);
+  victim->key = *key;
+  victim->len = len;
+  victim->used = ++sh->tick;
+  victim->valid = 1;
+  pthread_mutex_unlock(&sh->lock);
+}
+
+void
+shmcache_close(struct shmcache* c)
+{
+  if(c == NULL) { return; }
+  munmap(c->hdr, c->hdr->bytes);
+  free(c);
+}
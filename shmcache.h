@@ -0,0 +1,39 @@
+#ifndef OOK_SHMCACHE_H
+#define OOK_SHMCACHE_H
+/* Internal to ook: a cache of bricks in POSIX shared memory.  Every process
+ * which opens the same name shares the same cache, so a brick one process
+ * has read is available to the next at memory speed.  The cache is split
+ * into shards, each with its own process-shared lock; within a shard, the
+ * least recently used brick is evicted first. */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/* identifies a brick: the file it came from, the geometry it was read with,
+ * and its ID.  Compared bytewise, so zero any unused words. */
+struct cachekey {
+  uint64_t file[4]; /* device, inode, modification time (s, ns). */
+  uint64_t geometry[8];
+  uint64_t brick;
+};
+
+struct shmcache;
+
+/** attaches to the cache called 'name', creating it with room for 'bytes'
+ * bytes of bricks of (at most) 'slotsize' bytes if it does not exist.  An
+ * existing cache keeps the sizes it was created with.
+ * @return NULL on error, with errno set. */
+struct shmcache* shmcache_open(const char* name, size_t bytes,
+                               size_t slotsize);
+/** copies the brick for 'key' into 'data' if it is cached.
+ * @return true on a hit. */
+bool shmcache_get(struct shmcache*, const struct cachekey* key, void* data,
+                  size_t len);
+/** stores a brick, evicting another if need be.  Bricks larger than the
+ * cache's slots are not cached. */
+void shmcache_put(struct shmcache*, const struct cachekey* key,
+                  const void* data, size_t len);
+/** detaches; the cache itself lives on until it is unlinked. */
+void shmcache_close(struct shmcache*);
+
+#endif
@@ -1,8 +1,12 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include "io-interface.h"
 
 static void*
@@ -10,12 +14,13 @@ stdc_open(const char* fn, const enum OOKMODE mode, const void* state)
 {
   (void) state;
   const char* access = "rb";
-  if(mode == OOK_RDWR) { access = "wb"; }
+  /* creating still allows reads, so bricks can be written and read back. */
+  if(mode == OOK_RDWR) { access = "w+b"; }
+  if(mode == OOK_UPDATE) { access = "r+b"; } /* must exist; no truncation. */
   FILE* fp = fopen(fn, access);
 
 	if(NULL == fp) {
-    errno = -EINVAL;
-    return NULL;
+    return NULL; /* fopen set errno. */
 	}
   return fp;
 }
@@ -89,12 +94,95 @@ stdc_close_dbg(void* fd)
   return stdc_close(fd);
 }
 
+/* reserves space for the whole file up front, so that scattered brick writes
+ * don't leave it fragmented.  This is just a hint; failure is harmless, and
+ * systems with neither posix_fallocate nor F_PREALLOCATE (macOS) skip it. */
+static void
+stdc_prealloc(void* fd, off_t len)
+{
+  FILE* fp = (FILE*) fd;
+  if(fflush(fp) != 0) { return; }
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+  (void) posix_fallocate(fileno(fp), 0, len);
+#elif defined(F_PREALLOCATE)
+  /* contiguous if we can get it, else anywhere. */
+  fstore_t fs = {
+    .fst_flags = F_ALLOCATECONTIG, .fst_posmode = F_PEOFPOSMODE,
+    .fst_offset = 0, .fst_length = len
+  };
+  if(fcntl(fileno(fp), F_PREALLOCATE, &fs) == -1) {
+    fs.fst_flags = F_ALLOCATEALL;
+    (void) fcntl(fileno(fp), F_PREALLOCATE, &fs);
+  }
+#else
+  (void) len;
+#endif
+}
+
+static int
+stdc_punch(void* fd, const off_t offset, const size_t len)
+{
+  FILE* fp = (FILE*) fd;
+  if(fflush(fp) != 0) { return errno; }
+  const int des = fileno(fp);
+  struct stat st;
+  if(fstat(des, &st) != 0) { return errno; }
+  const off_t end = offset + (off_t)len;
+  if(offset < st.st_size) {
+#if defined(FALLOC_FL_PUNCH_HOLE) && defined(FALLOC_FL_KEEP_SIZE)
+    const off_t n = (end < st.st_size ? end : st.st_size) - offset;
+    if(fallocate(des, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                 n) != 0) {
+      return errno;
+    }
+#else
+    return EOPNOTSUPP;
+#endif
+  }
+  /* growing the file leaves a hole at the end. */
+  if(end > st.st_size && ftruncate(des, end) != 0) {
+    return errno;
+  }
+  return 0;
+}
+
+/* the range is a hole if there is no data anywhere within it.  This moves
+ * the descriptor's offset, but every read/write seeks first anyway; we put
+ * it back regardless, since stdio can't know we moved it. */
+static int
+stdc_hole(void* fd, const off_t offset, const size_t len)
+{
+#ifdef SEEK_DATA
+  FILE* fp = (FILE*) fd;
+  if(fflush(fp) != 0) { return 0; }
+  const int des = fileno(fp);
+  struct stat st;
+  if(fstat(des, &st) != 0 || !S_ISREG(st.st_mode)) { return 0; }
+  if(offset + (off_t)len > st.st_size) { return 0; } /* short: not a hole */
+  const off_t cur = lseek(des, 0, SEEK_CUR);
+  const off_t data = lseek(des, offset, SEEK_DATA);
+  const int err = errno;
+  if(cur != -1) { lseek(des, cur, SEEK_SET); }
+  if(data == -1) {
+    return err == ENXIO; /* no data from 'offset' to EOF. */
+  }
+  return data >= offset + (off_t)len;
+#else
+  (void) fd; (void) offset; (void) len;
+  return 0;
+#endif
+}
+
 struct io StdCIO = {
   .open = stdc_open,
   .read = stdc_read,
   .write = stdc_write,
   .close = stdc_close,
-  .preallocate = NULL
+  .preallocate = stdc_prealloc,
+  .punch = stdc_punch,
+  .hole = stdc_hole,
+  .vread = NULL,
+  .vwrite = NULL
 };
 
 struct io StdCIO_debug = {
@@ -102,5 +190,9 @@ struct io StdCIO_debug = {
   .read = stdc_read_dbg,
   .write = stdc_write_dbg,
   .close = stdc_close_dbg,
-  .preallocate = NULL
+  .preallocate = stdc_prealloc,
+  .punch = NULL,
+  .hole = NULL,
+  .vread = NULL,
+  .vwrite = NULL
 };
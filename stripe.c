@@ -0,0 +1,293 @@
+/* StripeIO: one logical volume spread over several files.  The files are
+ * either concatenated, or striped round-robin in fixed-size units.  A
+ * request is split into per-file pieces, and each file with work to do gets
+ * a thread, so that files on separate devices are accessed in parallel. */
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include "io-interface.h"
+
+struct stripe {
+  size_t n;
+  int* fds;
+  off_t* start; /* concatenated: logical offset at which each file begins. */
+  size_t unit; /* striped: bytes per stripe unit; 0 if concatenated. */
+};
+
+/* a piece of a request which lies entirely within one file. */
+struct seg {
+  off_t offset; /* within the file. */
+  size_t len;
+  char* buf;
+};
+
+/* everything one file must do for a request. */
+struct work {
+  int fd;
+  bool writing;
+  struct seg* segs;
+  size_t n;
+  size_t cap;
+  int err;
+};
+
+/* pread/pwrite can return early; loop until everything is moved.  Reading
+ * past the end of a file is an error, since readers must be atomic. */
+static int
+fullio(int fd, bool writing, off_t offset, size_t len, char* buf)
+{
+  while(len > 0) {
+    const ssize_t r = writing ? pwrite(fd, buf, len, offset)
+                              : pread(fd, buf, len, offset);
+    if(r < 0 && errno == EINTR) { continue; }
+    if(r < 0) { return errno; }
+    if(r == 0) { return EIO; }
+    buf += r; offset += r; len -= r;
+  }
+  return 0;
+}
+
+/* identifies the file which holds logical byte 'offset', the offset within
+ * that file, and how many bytes from there on are in the same file. */
+static void
+locate(const struct stripe* s, const off_t offset, size_t* file, off_t* foff,
+       uint64_t* avail)
+{
+  if(s->unit > 0) {
+    const uint64_t unit = (uint64_t)offset / s->unit;
+    const size_t within = (uint64_t)offset % s->unit;
+    *file = unit % s->n;
+    *foff = (off_t)((unit / s->n) * s->unit + within);
+    *avail = s->unit - within;
+    return;
+  }
+  /* binary search for the last file starting at or before 'offset'. */
+  size_t lo = 0, hi = s->n;
+  while(hi - lo > 1) {
+    const size_t mid = lo + (hi-lo)/2;
+    if(s->start[mid] <= offset) { lo = mid; } else { hi = mid; }
+  }
+  *file = lo;
+  *foff = offset - s->start[lo];
+  *avail = lo+1 < s->n ? (uint64_t)(s->start[lo+1] - offset) : UINT64_MAX;
+}
+
+static int
+addseg(struct work* w, const off_t offset, const size_t len, char* buf)
+{
+  /* adjacent in both the file and memory: just extend the last piece. */
+  if(w->n > 0) {
+    struct seg* last = &w->segs[w->n-1];
+    if(last->offset + (off_t)last->len == offset &&
+       last->buf + last->len == buf) {
+      last->len += len;
+      return 0;
+    }
+  }
+  if(w->n == w->cap) {
+    const size_t cap = w->cap == 0 ? 8 : w->cap*2;
+    struct seg* segs = realloc(w->segs, sizeof(struct seg)*cap);
+    if(segs == NULL) { return ENOMEM; }
+    w->segs = segs;
+    w->cap = cap;
+  }
+  w->segs[w->n].offset = offset;
+  w->segs[w->n].len = len;
+  w->segs[w->n].buf = buf;
+  w->n++;
+  return 0;
+}
+
+static void*
+worker(void* arg)
+{
+  struct work* w = (struct work*) arg;
+  for(size_t i=0; i < w->n && w->err == 0; ++i) {
+    w->err = fullio(w->fd, w->writing, w->segs[i].offset, w->segs[i].len,
+                    w->segs[i].buf);
+  }
+  return NULL;
+}
+
+/* splits the request up per file, then runs one thread per busy file.  The
+ * calling thread does the last file's share itself. */
+static int
+stripe_io(void* fd, const struct ookiov* iov, const size_t n, bool writing)
+{
+  const struct stripe* s = (const struct stripe*) fd;
+  struct work* w = calloc(s->n, sizeof(struct work));
+  if(w == NULL) { return ENOMEM; }
+  int err = 0;
+  for(size_t i=0; i < n && err == 0; ++i) {
+    off_t offset = iov[i].offset;
+    size_t len = iov[i].len;
+    char* buf = (char*) iov[i].buf;
+    while(len > 0 && err == 0) {
+      size_t file;
+      off_t foff;
+      uint64_t avail;
+      locate(s, offset, &file, &foff, &avail);
+      const size_t piece = avail < len ? (size_t)avail : len;
+      err = addseg(&w[file], foff, piece, buf);
+      offset += piece; buf += piece; len -= piece;
+    }
+  }
+
+  pthread_t* threads = calloc(s->n, sizeof(pthread_t));
+  bool* started = calloc(s->n, sizeof(bool));
+  if(err == 0 && (threads == NULL || started == NULL)) { err = ENOMEM; }
+  size_t mine = s->n; /* the file this thread will handle. */
+  for(size_t f=0; f < s->n && err == 0; ++f) {
+    w[f].fd = s->fds[f];
+    w[f].writing = writing;
+    if(w[f].n == 0) { continue; }
+    if(mine == s->n) { mine = f; continue; }
+    /* if we can't get a thread, just do the work ourselves. */
+    started[f] = pthread_create(&threads[f], NULL, worker, &w[f]) == 0;
+    if(!started[f]) { worker(&w[f]); }
+  }
+  if(err == 0 && mine < s->n) { worker(&w[mine]); }
+  for(size_t f=0; f < s->n; ++f) {
+    if(started != NULL && started[f]) { pthread_join(threads[f], NULL); }
+    if(err == 0) { err = w[f].err; }
+    free(w[f].segs);
+  }
+  free(started);
+  free(threads);
+  free(w);
+  return err;
+}
+
+static int
+stripe_vread(void* fd, const struct ookiov* iov, const size_t n)
+{
+  return stripe_io(fd, iov, n, false);
+}
+
+static int
+stripe_vwrite(void* fd, const struct ookiov* iov, const size_t n)
+{
+  return stripe_io(fd, iov, n, true);
+}
+
+static int
+stripe_read(void* fd, const off_t offset, const size_t len, void* buf)
+{
+  const struct ookiov iov = { offset, len, buf };
+  return stripe_io(fd, &iov, 1, false);
+}
+
+static int
+stripe_write(void* fd, const off_t offset, const size_t len, const void* buf)
+{
+  const struct ookiov iov = { offset, len, (void*)buf };
+  return stripe_io(fd, &iov, 1, true);
+}
+
+static int
+stripe_close(void* fd)
+{
+  struct stripe* s = (struct stripe*) fd;
+  int err = 0;
+  for(size_t i=0; i < s->n; ++i) {
+    if(s->fds[i] != -1 && close(s->fds[i]) != 0 && err == 0) { err = errno; }
+  }
+  free(s->fds);
+  free(s->start);
+  free(s);
+  return err;
+}
+
+static void*
+stripe_open(const char* fn, const enum OOKMODE mode, const void* state)
+{
+  (void) fn;
+  const struct ookstripe* cfg = (const struct ookstripe*) state;
+  if(cfg == NULL || cfg->n == 0 || cfg->files == NULL ||
+     (cfg->stripe == 0 && cfg->chunk == 0 && mode == OOK_RDWR)) {
+    errno = EINVAL;
+    return NULL;
+  }
+  struct stripe* s = calloc(1, sizeof(struct stripe));
+  if(s == NULL) { errno = ENOMEM; return NULL; }
+  s->n = cfg->n;
+  s->unit = cfg->stripe;
+  s->fds = malloc(sizeof(int)*s->n);
+  s->start = calloc(s->n, sizeof(off_t));
+  if(s->fds == NULL || s->start == NULL) {
+    free(s->fds); free(s->start); free(s);
+    errno = ENOMEM;
+    return NULL;
+  }
+  for(size_t i=0; i < s->n; ++i) { s->fds[i] = -1; }
+  int flags = O_RDONLY;
+  if(mode == OOK_RDWR) { flags = O_RDWR | O_CREAT | O_TRUNC; }
+  if(mode == OOK_UPDATE) { flags = O_RDWR; }
+  for(size_t i=0; i < s->n; ++i) {
+    s->fds[i] = open(cfg->files[i], flags, 0666);
+    if(s->fds[i] == -1) { goto fail; }
+    if(i+1 == s->n) { break; }
+    uint64_t size = cfg->chunk;
+    if(size == 0) {
+      struct stat st;
+      if(fstat(s->fds[i], &st) != 0) { goto fail; }
+      size = (uint64_t)st.st_size;
+    }
+    s->start[i+1] = s->start[i] + (off_t)size;
+  }
+  return s;
+
+fail:;
+  const int err = errno;
+  stripe_close(s);
+  errno = err;
+  return NULL;
+}
+
+/* gives each file its share of 'len' bytes. */
+static void
+stripe_prealloc(void* fd, off_t len)
+{
+  const struct stripe* s = (const struct stripe*) fd;
+  for(size_t f=0; f < s->n; ++f) {
+    off_t flen;
+    if(s->unit > 0) {
+      /* whole units go round-robin; a partial one goes to the next file. */
+      const uint64_t units = (uint64_t)len / s->unit;
+      const uint64_t rem = (uint64_t)len % s->unit;
+      flen = (off_t)((units / s->n + (f < units % s->n ? 1 : 0)) * s->unit);
+      if(f == units % s->n) { flen += (off_t)rem; }
+    } else {
+      const off_t end = f+1 < s->n ? s->start[f+1] : len;
+      flen = len < end ? len - s->start[f] : end - s->start[f];
+    }
+#if defined(_POSIX_ADVISORY_INFO) && _POSIX_ADVISORY_INFO > 0
+    if(flen > 0) { (void) posix_fallocate(s->fds[f], 0, flen); }
+#else
+    (void) flen; /* no portable way to reserve space; it's only a hint. */
+#endif
+  }
+}
+
+struct io StripeIO = {
+  .open = stripe_open,
+  .read = stripe_read,
+  .write = stripe_write,
+  .close = stripe_close,
+  .preallocate = stripe_prealloc,
+  .punch = NULL,
+  .hole = NULL,
+  .vread = stripe_vread,
+  .vwrite = stripe_vwrite,
+  .state = NULL
+};
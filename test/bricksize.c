@@ -1,77 +1,131 @@
+#include <errno.h>
 #include <check.h>
 #include "ook.h"
 
-/* type is opaque; make it transparent. */
-struct oofile {
-  void* blank_;
-  struct io op;
-  size_t bricksize[3];
-  uint64_t volsize[3];
-  enum FAKE { F_ONE, F_TWO } f;
-  size_t blank2_;
-};
+/* brick sizes don't depend on the data, so any file will do. */
+static struct ookfile*
+geometry(const uint64_t vol, const size_t bsize)
+{
+  const uint64_t voxels[3] = { vol, vol, vol };
+  const size_t bs[3] = { bsize, bsize, bsize };
+  struct ookfile* of = ookread(StdCIO, "/dev/zero", voxels, bs, OOK_U8, 1);
+  ck_assert(of != NULL);
+  return of;
+}
 
 /* verifies brick sizes when the divisor is even */
 START_TEST(test_bsize_even)
 {
-	struct oofile of;
-	of.volsize[0] = of.volsize[1] = of.volsize[2] = 1000;
-	of.bricksize[0] = of.bricksize[1] = of.bricksize[2] = 100;
+	struct ookfile* of = geometry(1000, 100);
+	ck_assert_int_eq(ookbricks(of), 10*10*10);
 	size_t bs[3];
 	for(size_t i=0; i < 10*10*10; ++i) {
-		ookbricksize((struct ookfile*)&of, i, bs);
+		ookbricksize(of, i, bs);
     ck_assert_int_eq(bs[0], 100);
     ck_assert_int_eq(bs[1], 100);
     ck_assert_int_eq(bs[2], 100);
 	}
+	ck_assert_int_eq(ookclose(of), 0);
 }
 END_TEST
 
 START_TEST(test_bsize_uneven)
 {
-	struct oofile of;
-	of.volsize[0] = of.volsize[1] = of.volsize[2] = 40;
-	of.bricksize[0] = of.bricksize[1] = of.bricksize[2] = 16;
+	struct ookfile* of = geometry(40, 16);
+	ck_assert_int_eq(ookbricks(of), 3*3*3);
 	size_t bs[3];
-	ookbricksize((struct ookfile*)&of, 0, bs);
+	ookbricksize(of, 0, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 1, bs);
+	ookbricksize(of, 1, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 2, bs);
+	ookbricksize(of, 2, bs);
 	ck_assert(bs[0] == 8 && bs[1] == 16 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 3, bs);
+	ookbricksize(of, 3, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 4, bs);
+	ookbricksize(of, 4, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 5, bs);
+	ookbricksize(of, 5, bs);
 	ck_assert(bs[0] == 8 && bs[1] == 16 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 6, bs);
+	ookbricksize(of, 6, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 8 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 7, bs);
+	ookbricksize(of, 7, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 8 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 8, bs);
+	ookbricksize(of, 8, bs);
 	ck_assert(bs[0] == 8 && bs[1] == 8 && bs[2] == 16);
 
-	ookbricksize((struct ookfile*)&of, 17, bs);
+	ookbricksize(of, 17, bs);
 	ck_assert(bs[0] == 8 && bs[1] == 8 && bs[2] == 16);
-	ookbricksize((struct ookfile*)&of, 18, bs);
+	ookbricksize(of, 18, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 19, bs);
+	ookbricksize(of, 19, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 20, bs);
+	ookbricksize(of, 20, bs);
 	ck_assert(bs[0] == 8 && bs[1] == 16 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 21, bs);
+	ookbricksize(of, 21, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 22, bs);
+	ookbricksize(of, 22, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 16 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 23, bs);
+	ookbricksize(of, 23, bs);
 	ck_assert(bs[0] == 8 && bs[1] == 16 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 24, bs);
+	ookbricksize(of, 24, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 8 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 25, bs);
+	ookbricksize(of, 25, bs);
 	ck_assert(bs[0] == 16 && bs[1] == 8 && bs[2] == 8);
-	ookbricksize((struct ookfile*)&of, 26, bs);
+	ookbricksize(of, 26, bs);
 	ck_assert(bs[0] == 8 && bs[1] == 8 && bs[2] == 8);
+	ck_assert_int_eq(ookclose(of), 0);
+}
+END_TEST
+
+/* layouts must be exact even when a double can't count the voxels. */
+START_TEST(test_bsize_huge)
+{
+  const uint64_t voxels[3] = { (UINT64_C(1) << 53) + 1, 1, 1 };
+  const size_t bs[3] = { (size_t)1 << 40, 1, 1 };
+  struct ookfile* of = ookread(StdCIO, "/dev/zero", voxels, bs, OOK_U8, 1);
+  ck_assert(of != NULL);
+  size_t layout[3];
+  ooklayout(of, layout);
+  ck_assert_int_eq(layout[0], (1U << 13) + 1);
+  size_t last[3];
+  ookbricksize(of, layout[0]-1, last);
+  ck_assert_int_eq(last[0], 1);
+  ck_assert_int_eq(ookclose(of), 0);
+}
+END_TEST
+
+/* a divisible volume with explicit constraints gets an even split. */
+START_TEST(test_autobsize_even)
+{
+  const uint64_t dims[3] = { 1000, 1000, 1000 };
+  const struct ookconstraints cons = {
+    .cache = 1024*1024, .memory = 1024*1024, .iosize = 4096, .scanline = 100
+  };
+  size_t bs[3];
+  ck_assert_int_eq(ookautobricksize(dims, OOK_U8, 1, &cons, bs), 0);
+  ck_assert_int_eq(bs[0], 100);
+  ck_assert_int_eq(bs[1], 100);
+  ck_assert_int_eq(bs[2], 100);
+}
+END_TEST
+
+/* whatever the defaults are, the result must be usable for the volume. */
+START_TEST(test_autobsize_defaults)
+{
+  const uint64_t dims[][3] = {
+    { 15, 2, 1 }, { 2025, 1600, 400 }, { 40, 40, 40 }, { 100000, 3, 3 }
+  };
+  for(size_t i=0; i < sizeof(dims)/sizeof(dims[0]); ++i) {
+    size_t bs[3];
+    ck_assert_int_eq(ookautobricksize(dims[i], OOK_U16, 2, NULL, bs), 0);
+    for(size_t j=0; j < 3; ++j) {
+      ck_assert(bs[j] > 0);
+      ck_assert(bs[j] <= dims[i][j]);
+    }
+  }
+  size_t bs[3];
+  const uint64_t empty[3] = { 0, 10, 10 };
+  ck_assert_int_eq(ookautobricksize(empty, OOK_U8, 1, NULL, bs), EINVAL);
 }
 END_TEST
 
@@ -82,6 +136,9 @@ bricksize_suite()
   TCase* tc = tcase_create("bsize-case");
   tcase_add_test(tc, test_bsize_even);
   tcase_add_test(tc, test_bsize_uneven);
+  tcase_add_test(tc, test_bsize_huge);
+  tcase_add_test(tc, test_autobsize_even);
+  tcase_add_test(tc, test_autobsize_defaults);
   suite_add_tcase(s, tc);
   return s;
 }
@@ -3,6 +3,8 @@
 
 extern Suite* bricksize_suite();
 extern Suite* rwop_suite();
+extern Suite* collective_suite();
+extern Suite* ookd_suite();
 
 int
 main(void)
@@ -12,6 +14,8 @@ main(void)
   SRunner* sr = srunner_create(s);
   srunner_add_suite(sr, bricksize_suite());
   srunner_add_suite(sr, rwop_suite());
+  srunner_add_suite(sr, collective_suite());
+  srunner_add_suite(sr, ookd_suite());
   srunner_run_all(sr, CK_NORMAL);
   failed = srunner_ntests_failed(sr);
   srunner_free(sr);
@@ -0,0 +1,168 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <check.h>
+#include "ook.h"
+
+static const char* collfile = ".collective-test";
+static const uint64_t vol[3] = { 40, 24, 20 };
+static const size_t bsize[3] = { 16, 8, 8 };
+#define NRANKS 4
+
+static uint16_t
+voxel(size_t x, size_t y, size_t z)
+{
+  return (uint16_t)(x + y*vol[0] + z*vol[0]*vol[1]);
+}
+
+/* fills (or checks) brick 'id' with values from its global coordinates.
+ * @return true if all values matched. */
+static bool
+brickfill(const struct ookfile* f, size_t id, uint16_t* data, bool verify)
+{
+  size_t layout[3], bs[3];
+  ooklayout(f, layout);
+  ookbricksize(f, id, bs);
+  const size_t origin[3] = {
+    (id % layout[0]) * bsize[0],
+    ((id / layout[0]) % layout[1]) * bsize[1],
+    (id / (layout[0]*layout[1])) * bsize[2]
+  };
+  for(size_t z=0; z < bs[2]; ++z) {
+    for(size_t y=0; y < bs[1]; ++y) {
+      for(size_t x=0; x < bs[0]; ++x) {
+        const size_t i = (z*bs[1] + y)*bs[0] + x;
+        const uint16_t v = voxel(origin[0]+x, origin[1]+y, origin[2]+z);
+        if(verify && data[i] != v) { return false; }
+        data[i] = v;
+      }
+    }
+  }
+  return true;
+}
+
+/* every rank's share is balanced and they cover everything, once. */
+START_TEST(partition_balanced)
+{
+  ck_assert(ookinit());
+  struct ookfile* f = ookread(StdCIO, "/dev/zero", vol, bsize, OOK_U16, 1);
+  ck_assert(f != NULL);
+  size_t next = 0;
+  uint64_t most = 0, least = UINT64_MAX;
+  for(size_t r=0; r < NRANKS; ++r) {
+    size_t range[2];
+    ck_assert_int_eq(ookpartition(f, r, NRANKS, range), 0);
+    ck_assert_int_eq(range[0], next);
+    uint64_t voxels = 0;
+    for(size_t b=range[0]; b < range[1]; ++b) {
+      size_t bs[3];
+      ookbricksize(f, b, bs);
+      voxels += bs[0]*bs[1]*bs[2];
+    }
+    if(voxels > most) { most = voxels; }
+    if(voxels < least) { least = voxels; }
+    next = range[1];
+  }
+  ck_assert_int_eq(next, ookbricks(f));
+  /* no rank is off by more than a brick. */
+  ck_assert(most - least <= bsize[0]*bsize[1]*bsize[2]);
+  size_t range[2];
+  ck_assert_int_eq(ookpartition(f, NRANKS, NRANKS, range), EINVAL);
+  ck_assert_int_eq(ookclose(f), 0);
+}
+END_TEST
+
+/* what one forked rank does: write (or read and check) its bricks.
+ * @return the exit status for the process. */
+static int
+rank_main(struct ookcollective* coll, size_t rank, bool writing)
+{
+  struct ookfile* f = ookupdate(StdCIO, collfile, vol, bsize, OOK_U16, 1);
+  if(f == NULL) { return 2; }
+  size_t range[2];
+  size_t rounds = 0;
+  for(size_t r=0; r < NRANKS; ++r) {
+    if(ookpartition(f, r, NRANKS, range) != 0) { return 3; }
+    if(range[1] - range[0] > rounds) { rounds = range[1] - range[0]; }
+  }
+  ookpartition(f, rank, NRANKS, range);
+  uint16_t* data = malloc(sizeof(uint16_t)*bsize[0]*bsize[1]*bsize[2]);
+  int status = 0;
+  for(size_t i=0; i < rounds; ++i) {
+    const size_t id = range[0]+i < range[1] ? range[0]+i : OOK_NOBRICK;
+    if(writing) {
+      if(id != OOK_NOBRICK) { brickfill(f, id, data, false); }
+      if(ookcollwrite(coll, f, rank, id, data) != 0) { status = 4; }
+    } else {
+      if(ookcollread(coll, f, rank, id, data) != 0) { status = 5; }
+      if(id != OOK_NOBRICK && !brickfill(f, id, data, true)) { status = 6; }
+    }
+  }
+  free(data);
+  if(ookclose(f) != 0) { status = 7; }
+  return status;
+}
+
+static void
+run_ranks(struct ookcollective* coll, bool writing)
+{
+  pid_t pids[NRANKS];
+  for(size_t r=0; r < NRANKS; ++r) {
+    pids[r] = fork();
+    ck_assert(pids[r] != -1);
+    if(pids[r] == 0) { _exit(rank_main(coll, r, writing)); }
+  }
+  for(size_t r=0; r < NRANKS; ++r) {
+    int status;
+    ck_assert(waitpid(pids[r], &status, 0) == pids[r]);
+    ck_assert(WIFEXITED(status));
+    ck_assert_int_eq(WEXITSTATUS(status), 0);
+  }
+}
+
+/* four processes write the volume through two aggregators, then read it
+ * back.  The buffer is small, so each round takes several windows. */
+START_TEST(collective_roundtrip)
+{
+  ck_assert(ookinit());
+  struct ookfile* f = ookcreate(StdCIO, collfile, vol, bsize, OOK_U16, 1);
+  ck_assert(f != NULL);
+  ck_assert_int_eq(ookclose(f), 0);
+
+  struct ookcollective* coll = ookcollective(NRANKS, 2, 3000);
+  ck_assert(coll != NULL);
+  run_ranks(coll, true);
+
+  f = ookread(StdCIO, collfile, vol, bsize, OOK_U16, 1);
+  ck_assert(f != NULL);
+  uint16_t* data = malloc(sizeof(uint16_t)*bsize[0]*bsize[1]*bsize[2]);
+  for(size_t b=0; b < ookbricks(f); ++b) {
+    ck_assert_int_eq(ookbrick(f, b, data), 0);
+    ck_assert(brickfill(f, b, data, true));
+  }
+  free(data);
+  ck_assert_int_eq(ookclose(f), 0);
+
+  run_ranks(coll, false);
+  ck_assert_int_eq(ookcollective_destroy(coll), 0);
+  ck_assert(ookcollective(2, 3, 4096) == NULL);
+  remove(collfile);
+}
+END_TEST
+
+Suite*
+collective_suite()
+{
+  Suite* s = suite_create("collective");
+  TCase* tc = tcase_create("collective-case");
+  tcase_add_test(tc, partition_balanced);
+  tcase_add_test(tc, collective_roundtrip);
+  suite_add_tcase(s, tc);
+  return s;
+}
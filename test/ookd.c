@@ -0,0 +1,147 @@
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <check.h>
+#include "ook.h"
+#include "contrib/ookdio.h"
+
+#if CHECK_MINOR_VERSION == 9 && CHECK_MICRO_VERSION >= 10
+# define tjf_ck_ptr_eq(a,b) ck_assert_ptr_eq(a,b)
+# define tjf_ck_ptr_ne(a,b) ck_assert_ptr_ne(a,b)
+#else
+# define tjf_ck_ptr_eq(a,b) ck_assert_int_eq(a,b)
+# define tjf_ck_ptr_ne(a,b) ck_assert_int_ne(a,b)
+#endif
+
+static const char* ookdfile = ".ookd-test";
+static const char* ookdsock = ".ookd-test.sock";
+static const uint64_t vol[3] = { 40, 24, 20 };
+static const size_t bsize[3] = { 16, 8, 8 };
+
+/* fills (or checks) brick 'id' with 'base' plus the brick's position. */
+static void
+brickfill(const struct ookfile* f, size_t id, uint16_t* data, uint16_t base,
+          bool verify)
+{
+  size_t bs[3];
+  ookbricksize(f, id, bs);
+  for(size_t i=0; i < bs[0]*bs[1]*bs[2]; ++i) {
+    const uint16_t v = (uint16_t)(base + id*1000 + i);
+    if(verify) {
+      ck_assert_int_eq(data[i], v);
+    } else {
+      data[i] = v;
+    }
+  }
+}
+
+/* @return true if a server is accepting connections on 'ookdsock'. */
+static bool
+listening()
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, ookdsock);
+  const int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+  ck_assert(sock != -1);
+  const bool up = connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+  close(sock);
+  return up;
+}
+
+/* starts a server with a small cache, and waits until it's listening. */
+static pid_t
+serve()
+{
+  remove(ookdsock);
+  const pid_t pid = fork();
+  ck_assert(pid != -1);
+  if(pid == 0) {
+    /* if a check fails, nobody stops the server; it stops itself. */
+    alarm(60);
+    execl("../contrib/ookd", "ookd", "-s", ookdsock, "-c", "1", (char*)NULL);
+    _exit(127);
+  }
+  const struct timespec wait = { 0, 10*1000*1000 };
+  for(size_t i=0; i < 500 && !listening(); ++i) {
+    nanosleep(&wait, NULL);
+  }
+  ck_assert(listening());
+  return pid;
+}
+
+START_TEST(ookd_roundtrip)
+{
+  ck_assert(ookinit());
+  const pid_t server = serve();
+  struct io io = OokdIO;
+  io.state = (void*)ookdsock;
+
+  struct ookfile* f = ookcreate(io, ookdfile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  const size_t n = bsize[0]*bsize[1]*bsize[2];
+  uint16_t* data = malloc(sizeof(uint16_t)*n);
+  for(size_t id=0; id < ookbricks(f); ++id) {
+    brickfill(f, id, data, 0, false);
+    errno = 0;
+    ookwrite(f, id, data);
+    ck_assert_int_eq(errno, 0);
+  }
+  ck_assert_int_eq(ookclose(f), 0);
+
+  f = ookread(io, ookdfile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  /* twice: the second time, from the server's cache. */
+  for(size_t pass=0; pass < 2; ++pass) {
+    for(size_t id=0; id < ookbricks(f); ++id) {
+      memset(data, 0, sizeof(uint16_t)*n);
+      ck_assert_int_eq(ookbrick(f, id, data), 0);
+      brickfill(f, id, data, 0, true);
+    }
+  }
+
+  /* nobody may truncate the file while we read it.. */
+  errno = 0;
+  tjf_ck_ptr_eq(ookcreate(io, ookdfile, vol, bsize, OOK_U16, 1), NULL);
+  ck_assert_int_eq(errno, EBUSY);
+  /* .. but it may be updated, and we then see the new data. */
+  struct ookfile* up = ookupdate(io, ookdfile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(up, NULL);
+  brickfill(up, 1, data, 7, false);
+  errno = 0;
+  ookwrite(up, 1, data);
+  ck_assert_int_eq(errno, 0);
+  ck_assert_int_eq(ookclose(up), 0);
+  ck_assert_int_eq(ookbrick(f, 1, data), 0);
+  brickfill(f, 1, data, 7, true);
+  ck_assert_int_eq(ookclose(f), 0);
+  free(data);
+
+  ck_assert_int_eq(kill(server, SIGTERM), 0);
+  int status;
+  ck_assert_int_eq(waitpid(server, &status, 0), server);
+  ck_assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  remove(ookdfile);
+}
+END_TEST
+
+Suite*
+ookd_suite()
+{
+  Suite* s = suite_create("ookd");
+  TCase* tc = tcase_create("ookd-case");
+  tcase_add_test(tc, ookd_roundtrip);
+  suite_add_tcase(s, tc);
+  return s;
+}
@@ -1,7 +1,10 @@
 #include <assert.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "ook.h"
 
@@ -162,6 +165,49 @@ START_TEST(multicomp_read)
 }
 END_TEST
 
+/* just the second component, then both components as separate planes. */
+START_TEST(multicomp_select)
+{
+  size_t bsize[3];
+  ookmaxbricksize(of, bsize);
+  const size_t nvox = bsize[0]*bsize[1]*bsize[2];
+  uint16_t* data = malloc(sizeof(uint16_t) * 2 * nvox);
+  /* brick 1 starts at x=2; see 'setup_multicomp' for the file's values. */
+  const size_t bid[3] = { 1, 0, 0 };
+  const size_t id = 1;
+
+  memset(data, 0xff, sizeof(uint16_t) * 2 * nvox);
+  ck_assert_int_eq(ookbrick_components(of, id, 0x2, OOK_INTERLEAVED, data), 0);
+  for(size_t z=0; z < bsize[2]; ++z) {
+    for(size_t y=0; y < bsize[1]; ++y) {
+      for(size_t x=0; x < bsize[0]; ++x) {
+        const size_t gx = (bid[0]*bsize[0] + x) * 2;
+        ck_assert_int_eq(data[(z*bsize[1] + y)*bsize[0] + x],
+                         value(gx,y,z) % 16);
+      }
+    }
+  }
+  /* nothing past the one component we asked for was touched. */
+  ck_assert_int_eq(data[nvox], 0xffff);
+
+  ck_assert_int_eq(ookbrick_components(of, id, 0x3, OOK_PLANAR, data), 0);
+  for(size_t z=0; z < bsize[2]; ++z) {
+    for(size_t y=0; y < bsize[1]; ++y) {
+      for(size_t x=0; x < bsize[0]; ++x) {
+        const size_t gx = (bid[0]*bsize[0] + x) * 2;
+        const size_t v = (z*bsize[1] + y)*bsize[0] + x;
+        ck_assert_int_eq(data[v], value(gx,y,z));
+        ck_assert_int_eq(data[nvox + v], value(gx,y,z) % 16);
+      }
+    }
+  }
+  ck_assert_int_eq(ookbrick_components(of, id, 0x4, OOK_PLANAR, data),
+                   EINVAL);
+  ck_assert_int_eq(ookbrick_components(of, id, 0, OOK_PLANAR, data), EINVAL);
+  free(data);
+}
+END_TEST
+
 static void
 setup_zero()
 {
@@ -305,6 +351,151 @@ START_TEST(simple_layout)
 }
 END_TEST
 
+START_TEST(simple_stats)
+{
+  size_t bsize[3];
+  ookmaxbricksize(of, bsize);
+  struct ookstats st;
+  ck_assert_int_eq(ookstats(of, &st), 0);
+  ck_assert_int_eq(st.bricks_read, 0);
+
+  uint32_t* data = malloc(sizeof(uint32_t) * bsize[0]*bsize[1]*bsize[2]);
+  ck_assert_int_eq(ookbrick(of, 1, data), 0);
+  free(data);
+
+  ck_assert_int_eq(ookstats(of, &st), 0);
+  ck_assert_int_eq(st.bricks_read, 1);
+  ck_assert_int_eq(st.bricks_written, 0);
+  /* one call per scanline. */
+  ck_assert_int_eq(st.read_calls, bsize[1]*bsize[2]);
+  ck_assert_int_eq(st.bytes_read, sizeof(uint32_t)*bsize[0]*bsize[1]*bsize[2]);
+  ck_assert_int_eq(st.bytes_read, st.brick_bytes_read);
+  uint64_t calls = 0, bricks = 0;
+  for(size_t i=0; i < OOK_HISTBUCKETS; ++i) {
+    calls += st.latency[OOK_OP_READ][i];
+    bricks += st.latency[OOK_OP_BRICK][i];
+  }
+  ck_assert_int_eq(calls, st.read_calls);
+  ck_assert_int_eq(bricks, 1);
+
+  FILE* fp = tmpfile();
+  tjf_ck_ptr_ne(fp, NULL);
+  ck_assert_int_eq(ookstats_json(of, fp), 0);
+  char json[4096] = {0};
+  rewind(fp);
+  ck_assert(fread(json, 1, sizeof(json)-1, fp) > 0);
+  fclose(fp);
+  ck_assert(strstr(json, "\"bricks_read\": 1,") != NULL);
+  ck_assert(strstr(json, "\"read_amplification\": 1.0000") != NULL);
+}
+END_TEST
+
+START_TEST(simple_trace)
+{
+  const char* tracefile = ".trace-test.json";
+  const uint64_t sz[3] = { 16, 16, 16 };
+  const size_t bsize[3] = { 8, 8, 16 };
+  struct ookfile* f = ookread(StdCIO, simplefile, sz, bsize, OOK_U32, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ooktrace(f, tracefile), 0);
+  ck_assert_int_eq(ooktrace(f, tracefile), EBUSY);
+  uint32_t* data = malloc(sizeof(uint32_t) * bsize[0]*bsize[1]*bsize[2]);
+  ck_assert_int_eq(ookbrick(f, 1, data), 0);
+  free(data);
+  ck_assert_int_eq(ookclose(f), 0);
+
+  FILE* fp = fopen(tracefile, "r");
+  tjf_ck_ptr_ne(fp, NULL);
+  char json[16384] = {0};
+  ck_assert(fread(json, 1, sizeof(json)-1, fp) > 0);
+  fclose(fp);
+  remove(tracefile);
+  ck_assert(strstr(json, "\"traceEvents\"") != NULL);
+  ck_assert(strstr(json, "{\"name\":\"ookbrick\",\"ph\":\"X\"") != NULL);
+  ck_assert(strstr(json, "\"args\":{\"brick\":1}") != NULL);
+  ck_assert(strstr(json, "{\"name\":\"srcop\"") != NULL);
+  ck_assert(strstr(json, "{\"name\":\"read\"") != NULL);
+}
+END_TEST
+
+/* four bricks tile the whole file, so in file order their scanlines make one
+ * contiguous run: however they are asked for, that is a single read. */
+START_TEST(simple_batch)
+{
+  const size_t n = 8*8*16;
+  uint32_t* data = malloc(sizeof(uint32_t)*n*5);
+  uint32_t* expect = malloc(sizeof(uint32_t)*n);
+  const size_t ids[5] = { 3, 1, 2, 0, 1 };
+  void* bufs[5];
+  for(size_t i=0; i < 5; ++i) { bufs[i] = data + i*n; }
+  memset(data, 0, sizeof(uint32_t)*n*5);
+  ck_assert_int_eq(ookbricks_read(of, ids, 5, bufs), 0);
+  struct ookstats st;
+  ck_assert_int_eq(ookstats(of, &st), 0);
+  ck_assert_int_eq(st.read_calls, 1);
+  ck_assert_int_eq(st.bytes_read, 16*16*16*sizeof(uint32_t));
+  ck_assert_int_eq(st.bricks_read, 5);
+  /* the batch is timed as one operation. */
+  uint64_t samples = 0;
+  for(size_t i=0; i < OOK_HISTBUCKETS; ++i) {
+    samples += st.latency[OOK_OP_BRICK][i];
+  }
+  ck_assert_int_eq(samples, 1);
+  ck_assert(st.nanoseconds[OOK_OP_BRICK] > 0);
+  for(size_t i=0; i < 5; ++i) {
+    ck_assert_int_eq(ookbrick(of, ids[i], expect), 0);
+    ck_assert(memcmp(bufs[i], expect, sizeof(uint32_t)*n) == 0);
+  }
+  const size_t bad[2] = { 0, 4 };
+  ck_assert_int_eq(ookbricks_read(of, bad, 2, bufs), EINVAL);
+  ck_assert_int_eq(ookbricks_read(of, NULL, 0, NULL), 0);
+  free(expect);
+  free(data);
+}
+END_TEST
+
+/* a second handle on the same file sees what the first put in the cache,
+ * including bricks which were written after both attached. */
+START_TEST(simple_shmcache)
+{
+  const char* cache = "/ook-test-cache";
+  ookshmcache_unlink(cache);
+  const uint64_t sz[3] = { 16, 16, 16 };
+  const size_t bsize[3] = { 8, 8, 16 };
+  const size_t n = bsize[0]*bsize[1]*bsize[2];
+  struct ookfile* f = ookupdate(StdCIO, simplefile, sz, bsize, OOK_U32, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ookshmcache(of, cache, 1U << 20), 0);
+  ck_assert_int_eq(ookshmcache(of, cache, 1U << 20), EBUSY);
+  ck_assert_int_eq(ookshmcache(f, cache, 1U << 20), 0);
+
+  uint32_t* data = malloc(sizeof(uint32_t)*n);
+  ck_assert_int_eq(ookbrick(of, 1, data), 0);
+  memset(data, 0, sizeof(uint32_t)*n);
+  ck_assert_int_eq(ookbrick(f, 1, data), 0);
+  ck_assert_int_eq(data[0], value(8,0,0));
+  struct ookstats st;
+  ck_assert_int_eq(ookstats(f, &st), 0);
+  ck_assert_int_eq(st.cache_hits, 1);
+  ck_assert_int_eq(st.read_calls, 0);
+
+  for(size_t i=0; i < n; ++i) { data[i] = 42; }
+  errno = 0;
+  ookwrite(f, 1, data);
+  ck_assert_int_eq(errno, 0);
+  memset(data, 0, sizeof(uint32_t)*n);
+  ck_assert_int_eq(ookbrick(of, 1, data), 0);
+  ck_assert_int_eq(data[0], 42);
+  ck_assert_int_eq(data[n-1], 42);
+  ck_assert_int_eq(ookstats(of, &st), 0);
+  ck_assert_int_eq(st.cache_hits, 1);
+  ck_assert_int_eq(st.cache_misses, 1);
+  free(data);
+  ck_assert_int_eq(ookclose(f), 0);
+  ck_assert_int_eq(ookshmcache_unlink(cache), 0);
+}
+END_TEST
+
 static void
 setup_writer()
 {
@@ -481,6 +672,638 @@ START_TEST(lbrick_size)
 }
 END_TEST
 
+/* fills (or, if 'verify', checks) a brick with values that depend on the
+ * global coordinates of each voxel. */
+static void
+brickvalues(const struct ookfile* f, size_t id, uint16_t* data, bool verify)
+{
+  size_t layout[3], bsize[3], mbs[3];
+  ooklayout(f, layout);
+  ookbricksize(f, id, bsize);
+  ookmaxbricksize(f, mbs);
+  const size_t origin[3] = {
+    (id % layout[0]) * mbs[0],
+    ((id / layout[0]) % layout[1]) * mbs[1],
+    (id / (layout[0]*layout[1])) * mbs[2]
+  };
+  for(size_t z=0; z < bsize[2]; ++z) {
+    for(size_t y=0; y < bsize[1]; ++y) {
+      for(size_t x=0; x < bsize[0]; ++x) {
+        const size_t i = z*bsize[1]*bsize[0] + y*bsize[0] + x;
+        const uint16_t v = (uint16_t)value(origin[0]+x, origin[1]+y,
+                                           16*(origin[2]+z));
+        if(verify) {
+          ck_assert_int_eq(data[i], v);
+        } else {
+          data[i] = v;
+        }
+      }
+    }
+  }
+}
+
+/* the points in a round trip at which a test can set up or check a handle. */
+enum rtstage { RT_CREATED, RT_WRITTEN, RT_REOPENED };
+typedef void (rthook)(struct ookfile*, enum rtstage);
+typedef void (rtfill)(const struct ookfile*, size_t id, uint16_t*, bool);
+
+/* creates 'fn' through 'io', writes every brick with 'fill' (brickvalues if
+ * NULL), closes it, reopens it for reading and checks every brick the same
+ * way.  'hook', if any, sees each handle right after it is opened, and the
+ * new file just before it is closed.  @return the reopened file. */
+static struct ookfile*
+roundtrip(struct io io, const char* fn, const uint64_t vol[3],
+          const size_t bsize[3], rthook* hook, rtfill* fill)
+{
+  if(fill == NULL) { fill = brickvalues; }
+  struct ookfile* f = ookcreate(io, fn, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  if(hook) { hook(f, RT_CREATED); }
+  /* suitably aligned for any layout the hook picks. */
+  uint16_t* data = ookalloc(f);
+  tjf_ck_ptr_ne(data, NULL);
+  for(size_t b=0; b < ookbricks(f); ++b) {
+    fill(f, b, data, false);
+    errno = 0;
+    ookwrite(f, b, data);
+    ck_assert_int_eq(errno, 0);
+  }
+  if(hook) { hook(f, RT_WRITTEN); }
+  ck_assert_int_eq(ookclose(f), 0);
+
+  f = ookread(io, fn, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  if(hook) { hook(f, RT_REOPENED); }
+  for(size_t b=0; b < ookbricks(f); ++b) {
+    memset(data, 0xff, sizeof(uint16_t)*bsize[0]*bsize[1]*bsize[2]);
+    ck_assert_int_eq(ookbrick(f, b, data), 0);
+    fill(f, b, data, true);
+  }
+  ookfree(data);
+  return f;
+}
+
+static const char* alignedfile = ".aligned-writetest";
+
+static void
+padded(struct ookfile* f, enum rtstage stage)
+{
+  if(stage == RT_CREATED) { ck_assert_int_eq(ookalign(f, 3), EINVAL); }
+  if(stage != RT_WRITTEN) { ck_assert_int_eq(ookalign(f, 512), 0); }
+}
+
+/* padded layout through DirectIO: write everything, then read it back. */
+START_TEST(aligned_roundtrip)
+{
+  ck_assert(ookinit());
+  const uint64_t vol[3] = { 12, 8, 6 };
+  const size_t bsize[3] = { 8, 4, 3 };
+  struct ookfile* f = roundtrip(DirectIO, alignedfile, vol, bsize, padded,
+                                NULL);
+  ck_assert_int_eq(ookclose(f), 0);
+  /* each row is two bricks wide, and each brick scanline is one block. */
+  ck_assert_int_eq(filesize(alignedfile), vol[1]*vol[2] * 2 * 512);
+  remove(alignedfile);
+}
+END_TEST
+
+/* several handles writing bricks which share blocks, without 'ookalign':
+ * every write is then a read-modify-write of its blocks. */
+struct dwriter {
+  size_t first; /* writes bricks first, first+stride, ... */
+  size_t stride;
+  int err;
+};
+static const uint64_t dvol[3] = { 30, 16, 8 };
+static const size_t dbsize[3] = { 5, 8, 4 };
+
+static void*
+dwrite(void* arg)
+{
+  struct dwriter* w = (struct dwriter*) arg;
+  struct ookfile* f = ookupdate(DirectIO, alignedfile, dvol, dbsize, OOK_U16,
+                                1);
+  if(f == NULL) { w->err = errno; return NULL; }
+  uint16_t* data = malloc(sizeof(uint16_t)*dbsize[0]*dbsize[1]*dbsize[2]);
+  for(size_t b=w->first; b < ookbricks(f) && w->err == 0; b += w->stride) {
+    brickvalues(f, b, data, false);
+    errno = 0;
+    ookwrite(f, b, data);
+    w->err = errno;
+  }
+  free(data);
+  const int err = ookclose(f);
+  if(w->err == 0) { w->err = err; }
+  return NULL;
+}
+
+START_TEST(aligned_sharedwrite)
+{
+  ck_assert(ookinit());
+  struct ookfile* f = ookcreate(DirectIO, alignedfile, dvol, dbsize, OOK_U16,
+                                1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ookclose(f), 0);
+#define NWRITERS 4
+  pthread_t thr[NWRITERS];
+  struct dwriter w[NWRITERS];
+  for(size_t i=0; i < NWRITERS; ++i) {
+    w[i].first = i;
+    w[i].stride = NWRITERS;
+    w[i].err = 0;
+    ck_assert_int_eq(pthread_create(&thr[i], NULL, dwrite, &w[i]), 0);
+  }
+  for(size_t i=0; i < NWRITERS; ++i) {
+    pthread_join(thr[i], NULL);
+    ck_assert_int_eq(w[i].err, 0);
+  }
+#undef NWRITERS
+  f = ookread(DirectIO, alignedfile, dvol, dbsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  uint16_t* data = malloc(sizeof(uint16_t)*dbsize[0]*dbsize[1]*dbsize[2]);
+  for(size_t b=0; b < ookbricks(f); ++b) {
+    ck_assert_int_eq(ookbrick(f, b, data), 0);
+    brickvalues(f, b, data, true);
+  }
+  free(data);
+  ck_assert_int_eq(ookclose(f), 0);
+  remove(alignedfile);
+}
+END_TEST
+
+/* several threads reading through one padded handle: every scanline bounces,
+ * and no thread may see another's. */
+struct dreader {
+  struct ookfile* f;
+  size_t first; /* reads bricks first, first+stride, ... */
+  size_t stride;
+  bool ok;
+};
+
+static void*
+dread(void* arg)
+{
+  struct dreader* r = (struct dreader*) arg;
+  const size_t n = dbsize[0]*dbsize[1]*dbsize[2];
+  uint16_t* data = malloc(sizeof(uint16_t)*n);
+  uint16_t* expect = malloc(sizeof(uint16_t)*n);
+  r->ok = true;
+  for(size_t pass=0; pass < 20 && r->ok; ++pass) {
+    for(size_t b=r->first; b < ookbricks(r->f) && r->ok; b += r->stride) {
+      brickvalues(r->f, b, expect, false);
+      r->ok = ookbrick(r->f, b, data) == 0 &&
+              memcmp(data, expect, sizeof(uint16_t)*n) == 0;
+    }
+  }
+  free(expect);
+  free(data);
+  return NULL;
+}
+
+START_TEST(aligned_sharedread)
+{
+  ck_assert(ookinit());
+  struct ookfile* f = roundtrip(DirectIO, alignedfile, dvol, dbsize, padded,
+                                NULL);
+#define NREADERS 4
+  pthread_t thr[NREADERS];
+  struct dreader r[NREADERS];
+  for(size_t i=0; i < NREADERS; ++i) {
+    r[i].f = f;
+    r[i].first = i;
+    r[i].stride = 1; /* everyone reads everything, at staggered starts. */
+    ck_assert_int_eq(pthread_create(&thr[i], NULL, dread, &r[i]), 0);
+  }
+  for(size_t i=0; i < NREADERS; ++i) {
+    pthread_join(thr[i], NULL);
+    ck_assert(r[i].ok);
+  }
+#undef NREADERS
+  ck_assert_int_eq(ookclose(f), 0);
+  remove(alignedfile);
+}
+END_TEST
+
+static const char* endianfile = ".endian-test";
+
+/* writing big-endian data and reading it back either way. */
+START_TEST(endian_roundtrip)
+{
+  ck_assert(ookinit());
+  const uint64_t vol[3] = { 13, 5, 3 };
+  const size_t bsize[3] = { 7, 5, 2 };
+  struct ookfile* f = ookcreate(StdCIO, endianfile, vol, bsize, OOK_U32, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ookendian(f, OOK_BIG), 0);
+  const size_t n = bsize[0]*bsize[1]*bsize[2];
+  uint32_t* data = malloc(sizeof(uint32_t)*n);
+  for(size_t b=0; b < ookbricks(f); ++b) {
+    for(size_t i=0; i < n; ++i) { data[i] = 0x01020304 + b*n + i; }
+    errno = 0;
+    ookwrite(f, b, data);
+    ck_assert_int_eq(errno, 0);
+    /* the caller's buffer must be left alone. */
+    ck_assert_int_eq(data[0], 0x01020304 + b*n);
+  }
+  ck_assert_int_eq(ookclose(f), 0);
+
+  /* the file holds big-endian values, whatever this host is. */
+  FILE* fp = fopen(endianfile, "rb");
+  tjf_ck_ptr_ne(fp, NULL);
+  unsigned char bytes[4];
+  ck_assert_int_eq(fread(bytes, 1, 4, fp), 4);
+  fclose(fp);
+  ck_assert_int_eq(bytes[0], 0x01);
+  ck_assert_int_eq(bytes[3], 0x04);
+
+  f = ookread(StdCIO, endianfile, vol, bsize, OOK_U32, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ookendian(f, OOK_BIG), 0);
+  for(size_t b=0; b < ookbricks(f); ++b) {
+    size_t bs[3];
+    ookbricksize(f, b, bs);
+    ck_assert_int_eq(ookbrick(f, b, data), 0);
+    for(size_t i=0; i < bs[0]*bs[1]*bs[2]; ++i) {
+      ck_assert_int_eq(data[i], 0x01020304 + b*n + i);
+    }
+  }
+  ck_assert_int_eq(ookendian(f, (enum OOKENDIAN)42), EINVAL);
+  ck_assert_int_eq(ookclose(f), 0);
+  free(data);
+  remove(endianfile);
+}
+END_TEST
+
+/* stores/loads value 'i' of a 'w'-byte wide array, in host order. */
+static void
+putvalue(void* data, size_t i, size_t w, uint64_t v)
+{
+  switch(w) {
+    case 2: ((uint16_t*)data)[i] = (uint16_t)v; break;
+    case 4: ((uint32_t*)data)[i] = (uint32_t)v; break;
+    default: ((uint64_t*)data)[i] = v; break;
+  }
+}
+static uint64_t
+getvalue(const void* data, size_t i, size_t w)
+{
+  switch(w) {
+    case 2: return ((const uint16_t*)data)[i];
+    case 4: return ((const uint32_t*)data)[i];
+    default: return ((const uint64_t*)data)[i];
+  }
+}
+
+/* every swappable width, with bricks long enough for the vector path and a
+ * few values left over at the end of each. */
+START_TEST(endian_widths)
+{
+  ck_assert(ookinit());
+  const uint64_t vol[3] = { 13, 5, 3 };
+  const size_t bsize[3] = { 7, 5, 1 }; /* 35 values: odd for every width. */
+  const enum OOKTYPE types[] = { OOK_U16, OOK_U32, OOK_U64 };
+  const size_t widths[] = { 2, 4, 8 };
+  const uint64_t base = 0x0102030405060708ULL;
+  const size_t n = bsize[0]*bsize[1]*bsize[2];
+  uint64_t* data = malloc(sizeof(uint64_t)*n);
+  for(size_t t=0; t < sizeof(types)/sizeof(types[0]); ++t) {
+    const size_t w = widths[t];
+    struct ookfile* f = ookcreate(StdCIO, endianfile, vol, bsize, types[t], 1);
+    tjf_ck_ptr_ne(f, NULL);
+    ck_assert_int_eq(ookendian(f, OOK_BIG), 0);
+    for(size_t b=0; b < ookbricks(f); ++b) {
+      for(size_t i=0; i < n; ++i) {
+        putvalue(data, i, w, base + b*n + i);
+      }
+      errno = 0;
+      ookwrite(f, b, data);
+      ck_assert_int_eq(errno, 0);
+    }
+    ck_assert_int_eq(ookclose(f), 0);
+
+    FILE* fp = fopen(endianfile, "rb");
+    tjf_ck_ptr_ne(fp, NULL);
+    unsigned char first[8];
+    ck_assert_int_eq(fread(first, 1, w, fp), w);
+    fclose(fp);
+    for(size_t k=0; k < w; ++k) {
+      ck_assert_int_eq(first[k], (base >> 8*(w-1-k)) & 0xff);
+    }
+
+    f = ookread(StdCIO, endianfile, vol, bsize, types[t], 1);
+    tjf_ck_ptr_ne(f, NULL);
+    ck_assert_int_eq(ookendian(f, OOK_BIG), 0);
+    for(size_t b=0; b < ookbricks(f); ++b) {
+      size_t bs[3];
+      ookbricksize(f, b, bs);
+      ck_assert_int_eq(ookbrick(f, b, data), 0);
+      for(size_t i=0; i < bs[0]*bs[1]*bs[2]; ++i) {
+        const uint64_t mask = w == 8 ? ~0ULL : (1ULL << 8*w) - 1;
+        ck_assert(getvalue(data, i, w) == ((base + b*n + i) & mask));
+      }
+    }
+    ck_assert_int_eq(ookclose(f), 0);
+  }
+  free(data);
+  remove(endianfile);
+}
+END_TEST
+
+static const char* updatefile = ".update-test";
+
+/* rewrites one brick of an existing file, in place, through 'io'. */
+static void
+update_volume(struct io io, rthook* hook)
+{
+  const uint64_t vol[3] = { 32, 32, 32 };
+  const size_t bsize[3] = { 16, 16, 16 };
+  struct ookfile* f = roundtrip(io, updatefile, vol, bsize, hook, NULL);
+  ck_assert_int_eq(ookclose(f), 0);
+  const uint64_t size = filesize(updatefile);
+
+  f = ookupdate(io, updatefile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  if(hook) { hook(f, RT_REOPENED); }
+  uint16_t* data = ookalloc(f);
+  const size_t n = bsize[0]*bsize[1]*bsize[2];
+  /* reads and writes interleaved on the one handle. */
+  ck_assert_int_eq(ookbrick(f, 5, data), 0);
+  brickvalues(f, 5, data, true);
+  for(size_t i=0; i < n; ++i) { data[i] = 42; }
+  errno = 0;
+  ookwrite(f, 5, data);
+  ck_assert_int_eq(errno, 0);
+  memset(data, 0, sizeof(uint16_t)*n);
+  ck_assert_int_eq(ookbrick(f, 5, data), 0);
+  ck_assert_int_eq(data[0], 42);
+  ck_assert_int_eq(data[n-1], 42);
+  ck_assert_int_eq(ookclose(f), 0);
+  ck_assert_int_eq(filesize(updatefile), size);
+
+  f = ookread(io, updatefile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  if(hook) { hook(f, RT_REOPENED); }
+  for(size_t b=0; b < ookbricks(f); ++b) {
+    ck_assert_int_eq(ookbrick(f, b, data), 0);
+    if(b == 5) {
+      ck_assert_int_eq(data[n/2], 42);
+    } else {
+      brickvalues(f, b, data, true);
+    }
+  }
+  ck_assert_int_eq(ookclose(f), 0);
+  ookfree(data);
+  remove(updatefile);
+}
+
+START_TEST(update_inplace)
+{
+  ck_assert(ookinit());
+  update_volume(StdCIO, NULL);
+  update_volume(DirectIO, padded);
+  const uint64_t vol[3] = { 32, 32, 32 };
+  const size_t bsize[3] = { 16, 16, 16 };
+  /* updates never create files. */
+  ck_assert(ookupdate(StdCIO, updatefile, vol, bsize, OOK_U16, 1) == NULL);
+}
+END_TEST
+
+static const char* stripefiles[] = {
+  ".stripe-test0", ".stripe-test1", ".stripe-test2"
+};
+
+/* writes every brick through 'io', then reads them all back. */
+static void
+stripe_volume(struct io io)
+{
+  const uint64_t vol[3] = { 32, 32, 32 };
+  const size_t bsize[3] = { 16, 16, 16 };
+  struct ookfile* f = roundtrip(io, "unused", vol, bsize, NULL, NULL);
+  struct ookstats st;
+  ck_assert_int_eq(ookstats(f, &st), 0);
+  /* whole bricks go down as single vectored calls. */
+  ck_assert_int_eq(st.read_calls, ookbricks(f));
+  ck_assert_int_eq(ookclose(f), 0);
+}
+
+/* the same volume, striped and then split into slabs across three files. */
+START_TEST(stripe_roundtrip)
+{
+  ck_assert(ookinit());
+  struct ookstripe cfg = { stripefiles, 3, 0, 100 };
+  struct io io = StripeIO;
+  io.state = &cfg;
+  stripe_volume(io);
+  const uint64_t total = 32*32*32*sizeof(uint16_t);
+  ck_assert_int_eq(filesize(stripefiles[0]) + filesize(stripefiles[1]) +
+                   filesize(stripefiles[2]), total);
+
+  /* two Z slices in each of the first files; the last gets the rest. */
+  cfg.stripe = 0;
+  cfg.chunk = 32*32*2*sizeof(uint16_t);
+  stripe_volume(io);
+  ck_assert_int_eq(filesize(stripefiles[0]), cfg.chunk);
+  ck_assert_int_eq(filesize(stripefiles[2]), total - 2*cfg.chunk);
+  /* a reader can take the slab sizes from the files themselves. */
+  cfg.chunk = 0;
+  const uint64_t vol[3] = { 32, 32, 32 };
+  const size_t bsize[3] = { 32, 32, 32 };
+  struct ookfile* f = ookread(io, "unused", vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  uint16_t* data = malloc(total);
+  ck_assert_int_eq(ookbrick(f, 0, data), 0);
+  brickvalues(f, 0, data, true);
+  free(data);
+  ck_assert_int_eq(ookclose(f), 0);
+  /* .. but a writer must be told. */
+  ck_assert(ookcreate(io, "unused", vol, bsize, OOK_U16, 1) == NULL);
+  for(size_t i=0; i < 3; ++i) { remove(stripefiles[i]); }
+}
+END_TEST
+
+static const char* sparsefile = ".sparse-writetest";
+
+/* every third brick is all zeroes. */
+static void
+sparsevalues(const struct ookfile* f, size_t id, uint16_t* data, bool verify)
+{
+  if(id % 3 != 0) {
+    brickvalues(f, id, data, verify);
+    return;
+  }
+  size_t bs[3];
+  ookbricksize(f, id, bs);
+  for(size_t i=0; i < bs[0]*bs[1]*bs[2]; ++i) {
+    if(verify) {
+      ck_assert_int_eq(data[i], 0);
+    } else {
+      data[i] = 0;
+    }
+  }
+}
+
+static void
+sparse(struct ookfile* f, enum rtstage stage)
+{
+  if(stage == RT_CREATED) {
+    ck_assert_int_eq(ooksparse(f, true), 0);
+    /* brick 0 has data before it is punched. */
+    uint16_t* data = ookalloc(f);
+    brickvalues(f, 0, data, false);
+    ookwrite(f, 0, data);
+    ookfree(data);
+  } else if(stage == RT_WRITTEN) {
+    /* turning it on again must not punch out what we just wrote. */
+    ck_assert_int_eq(ooksparse(f, false), 0);
+    ck_assert_int_eq(ooksparse(f, true), 0);
+  } else {
+    ck_assert_int_eq(ooksparse(f, true), 0);
+  }
+}
+
+/* zero bricks are punched rather than written, including a brick which was
+ * previously written with data. */
+START_TEST(sparse_roundtrip)
+{
+  ck_assert(ookinit());
+  const uint64_t vol[3] = { 32, 32, 32 };
+  const size_t bsize[3] = { 16, 16, 16 };
+  struct ookfile* f = roundtrip(StdCIO, sparsefile, vol, bsize, sparse,
+                                sparsevalues);
+  ck_assert_int_eq(ookclose(f), 0);
+  ck_assert_int_eq(filesize(sparsefile), vol[0]*vol[1]*vol[2]*sizeof(uint16_t));
+
+  /* too late to give the preallocation back once bricks are written. */
+  f = ookcreate(StdCIO, sparsefile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  uint16_t* data = ookalloc(f);
+  brickvalues(f, 0, data, false);
+  ookwrite(f, 0, data);
+  ookfree(data);
+  ck_assert_int_eq(ooksparse(f, true), EBUSY);
+  ck_assert_int_eq(ookclose(f), 0);
+  remove(sparsefile);
+}
+END_TEST
+
+static const char* sievefile = ".sieve-writetest";
+
+/* bricks 8 voxels wide: every scanline is 16 bytes, 128 bytes from the next.
+ * Sieved, each brick is read with one call; writes rewrite the neighbouring
+ * bricks' data, and mustn't change it. */
+static void
+sieved(struct ookfile* f, enum rtstage stage)
+{
+  if(stage != RT_WRITTEN) { ck_assert_int_eq(ooksieve(f, 128, 0), 0); }
+}
+
+START_TEST(sieve_roundtrip)
+{
+  ck_assert(ookinit());
+  const uint64_t vol[3] = { 64, 16, 8 };
+  const size_t bsize[3] = { 8, 16, 8 };
+  struct ookfile* f = roundtrip(StdCIO, sievefile, vol, bsize, sieved, NULL);
+  struct ookstats st;
+  ck_assert_int_eq(ookstats(f, &st), 0);
+  ck_assert_int_eq(st.read_calls, ookbricks(f));
+  ck_assert(st.bytes_read > st.brick_bytes_read);
+  /* a gap smaller than the one between scanlines changes nothing. */
+  ck_assert_int_eq(ooksieve(f, 64, 0), 0);
+  uint16_t* data = malloc(sizeof(uint16_t)*bsize[0]*bsize[1]*bsize[2]);
+  ck_assert_int_eq(ookbrick(f, 0, data), 0);
+  brickvalues(f, 0, data, true);
+  ck_assert_int_eq(ookstats(f, &st), 0);
+  ck_assert_int_eq(st.read_calls, ookbricks(f) + bsize[1]*bsize[2]);
+  free(data);
+  ck_assert_int_eq(ookclose(f), 0);
+  remove(sievefile);
+}
+END_TEST
+
+static const char* rebrickfile = ".rebrick-raw";
+static const char* brickedfile = ".rebrick-bricked";
+static const char* brickedfile2 = ".rebrick-bricked2";
+
+/* reads a whole (small) file into memory; caller frees. */
+static char*
+slurp(const char* fn, long* len)
+{
+  FILE* fp = fopen(fn, "rb");
+  tjf_ck_ptr_ne(fp, NULL);
+  ck_assert_int_eq(fseek(fp, 0, SEEK_END), 0);
+  *len = ftell(fp);
+  rewind(fp);
+  char* mem = malloc((size_t)*len);
+  ck_assert_int_eq(fread(mem, 1, (size_t)*len, fp), (size_t)*len);
+  fclose(fp);
+  return mem;
+}
+
+START_TEST(rebrick_roundtrip)
+{
+  ck_assert(ookinit());
+  /* bricks which don't divide the volume, so edge bricks are smaller. */
+  const uint64_t vol[3] = { 30, 20, 10 };
+  const size_t bsize[3] = { 8, 8, 4 };
+  struct ookfile* f = roundtrip(StdCIO, rebrickfile, vol, bsize, NULL, NULL);
+  const size_t n = bsize[0]*bsize[1]*bsize[2];
+  uint16_t* data = malloc(sizeof(uint16_t)*n);
+  /* room for two bricks at a time: rows are done in pieces. */
+  ck_assert_int_eq(ookrebrick(f, StdCIO, brickedfile, 2*n*sizeof(uint16_t)),
+                   0);
+  /* .. and whole rows at once, which must give the same file. */
+  ck_assert_int_eq(ookrebrick(f, StdCIO, brickedfile2, 0), 0);
+  ck_assert_int_eq(ookclose(f), 0);
+  long len, len2;
+  char* a = slurp(brickedfile, &len);
+  char* b = slurp(brickedfile2, &len2);
+  ck_assert_int_eq(len, 4096 + vol[0]*vol[1]*vol[2]*sizeof(uint16_t));
+  ck_assert_int_eq(len, len2);
+  ck_assert(memcmp(a, b, (size_t)len) == 0);
+  free(b);
+  free(a);
+
+  f = ookread(StdCIO, brickedfile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ookbrickmajor(f), 0);
+  for(size_t id=0; id < ookbricks(f); ++id) {
+    memset(data, 0, sizeof(uint16_t)*n);
+    ck_assert_int_eq(ookbrick(f, id, data), 0);
+    brickvalues(f, id, data, true);
+  }
+  struct ookstats st;
+  ck_assert_int_eq(ookstats(f, &st), 0);
+  ck_assert_int_eq(st.read_calls, ookbricks(f));
+  /* a batch of consecutive bricks is one contiguous piece. */
+  const size_t ids[3] = { 5, 3, 4 };
+  void* bufs[3];
+  for(size_t i=0; i < 3; ++i) { bufs[i] = malloc(sizeof(uint16_t)*n); }
+  ck_assert_int_eq(ookbricks_read(f, ids, 3, bufs), 0);
+  for(size_t i=0; i < 3; ++i) {
+    brickvalues(f, ids[i], bufs[i], true);
+    free(bufs[i]);
+  }
+  ck_assert_int_eq(ookclose(f), 0);
+
+  /* a header which doesn't match what we are told is an error.. */
+  const size_t other[3] = { 8, 8, 8 };
+  f = ookread(StdCIO, brickedfile, vol, other, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ookbrickmajor(f), EINVAL);
+  ck_assert_int_eq(ookclose(f), 0);
+  /* .. and so is no header at all. */
+  f = ookread(StdCIO, rebrickfile, vol, bsize, OOK_U16, 1);
+  tjf_ck_ptr_ne(f, NULL);
+  ck_assert_int_eq(ookbrickmajor(f), EINVAL);
+  ck_assert_int_eq(ookclose(f), 0);
+
+  free(data);
+  remove(brickedfile2);
+  remove(brickedfile);
+  remove(rebrickfile);
+}
+END_TEST
+
 Suite*
 rwop_suite()
 {
@@ -492,14 +1315,36 @@ rwop_suite()
   TCase* simple = tcase_create("simple");
   tcase_add_test(simple, simple_verify);
   tcase_add_test(simple, simple_layout);
+  tcase_add_test(simple, simple_stats);
+  tcase_add_test(simple, simple_trace);
+  tcase_add_test(simple, simple_shmcache);
+  tcase_add_test(simple, simple_batch);
   TCase* writer = tcase_create("writer");
   tcase_add_test(writer, writer_nothing);
   tcase_add_test(writer, writer_basic);
   tcase_add_test(writer, writer_threshold);
   TCase* multicomp = tcase_create("multicomp");
   tcase_add_test(multicomp, multicomp_read);
+  tcase_add_test(multicomp, multicomp_select);
   TCase* lastbrick = tcase_create("lastbrick");
   tcase_add_test(lastbrick, lbrick_size);
+  TCase* aligned = tcase_create("aligned");
+  tcase_add_test(aligned, aligned_roundtrip);
+  tcase_add_test(aligned, aligned_sharedwrite);
+  tcase_add_test(aligned, aligned_sharedread);
+  TCase* sparse = tcase_create("sparse");
+  tcase_add_test(sparse, sparse_roundtrip);
+  TCase* update = tcase_create("update");
+  tcase_add_test(update, update_inplace);
+  TCase* endian = tcase_create("endian");
+  tcase_add_test(endian, endian_roundtrip);
+  tcase_add_test(endian, endian_widths);
+  TCase* stripe = tcase_create("stripe");
+  tcase_add_test(stripe, stripe_roundtrip);
+  TCase* sieve = tcase_create("sieve");
+  tcase_add_test(sieve, sieve_roundtrip);
+  TCase* rebrick = tcase_create("rebrick");
+  tcase_add_test(rebrick, rebrick_roundtrip);
 
   tcase_add_checked_fixture(zero, setup_zero, teardown_zero);
   tcase_add_checked_fixture(simple, setup_simple, teardown_simple);
@@ -511,5 +1356,12 @@ rwop_suite()
   suite_add_tcase(s, multicomp);
   suite_add_tcase(s, writer);
   suite_add_tcase(s, lastbrick);
+  suite_add_tcase(s, aligned);
+  suite_add_tcase(s, sparse);
+  suite_add_tcase(s, update);
+  suite_add_tcase(s, endian);
+  suite_add_tcase(s, stripe);
+  suite_add_tcase(s, sieve);
+  suite_add_tcase(s, rebrick);
   return s;
 }
@@ -0,0 +1,159 @@
+#define _POSIX_C_SOURCE 200112L
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "trace.h"
+
+/* the maximum number of distinct threads we will record events from.
+ * Events from any further threads are silently dropped. */
+#define TRACE_THREADS 64
+
+#ifdef __GNUC__
+#  define LOAD(var) __atomic_load_n(&(var), __ATOMIC_ACQUIRE)
+#  define STORE(var, v) __atomic_store_n(&(var), (v), __ATOMIC_RELEASE)
+#  define CAS(var, expect, v) \
+     __atomic_compare_exchange_n(&(var), &(expect), (v), false, \
+                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#  define THREADLOCAL __thread
+#else
+#  define LOAD(var) (var)
+#  define STORE(var, v) ((var) = (v))
+#  define CAS(var, expect, v) ((var) == (expect) ? ((var) = (v), true) : false)
+#  define THREADLOCAL /* unavailable; we'll just search every time. */
+#endif
+
+struct event {
+  const char* name;
+  const char* argname;
+  uint64_t start;
+  uint64_t end;
+  uint64_t arg;
+};
+
+enum RINGSTATE { RING_FREE=0, RING_CLAIMING, RING_OWNED };
+
+/* only the owning thread ever writes to a ring (after claiming it). */
+struct ring {
+  int state;
+  pthread_t owner;
+  uint64_t count; /* number of events ever recorded. */
+  struct event* events;
+};
+
+struct ooktrace {
+  uint64_t id; /* unique to this trace; see 'lastid'. */
+  size_t capacity;
+  struct ring rings[TRACE_THREADS];
+};
+
+/* the ring this thread used last, to skip the search in the common case.
+ * We remember the trace by ID rather than address, since a trace could be
+ * freed and another allocated in its place. */
+static THREADLOCAL struct ring* lastring = NULL;
+static THREADLOCAL uint64_t lastid = 0;
+static uint64_t nextid = 1;
+
+struct ooktrace*
+trace_create(size_t capacity)
+{
+  if(capacity == 0) { errno = EINVAL; return NULL; }
+  struct ooktrace* tr = calloc(1, sizeof(struct ooktrace));
+  if(tr == NULL) { errno = ENOMEM; return NULL; }
+  tr->capacity = capacity;
+#ifdef __GNUC__
+  tr->id = __atomic_fetch_add(&nextid, 1, __ATOMIC_RELAXED);
+#else
+  tr->id = nextid++;
+#endif
+  return tr;
+}
+
+/* finds this thread's ring, claiming a free one if it doesn't have one. */
+static struct ring*
+myring(struct ooktrace* tr)
+{
+  if(lastid == tr->id) { return lastring; }
+  const pthread_t self = pthread_self();
+  for(size_t i=0; i < TRACE_THREADS; ++i) {
+    struct ring* r = &tr->rings[i];
+    if(LOAD(r->state) == RING_OWNED && pthread_equal(r->owner, self)) {
+      lastid = tr->id;
+      lastring = r;
+      return r;
+    }
+  }
+  for(size_t i=0; i < TRACE_THREADS; ++i) {
+    struct ring* r = &tr->rings[i];
+    int expect = RING_FREE;
+    if(CAS(r->state, expect, RING_CLAIMING)) {
+      r->owner = self;
+      r->events = calloc(tr->capacity, sizeof(struct event));
+      STORE(r->state, RING_OWNED);
+      lastid = tr->id;
+      lastring = r;
+      return r;
+    }
+  }
+  return NULL;
+}
+
+void
+trace_event(struct ooktrace* tr, const char* name, uint64_t start,
+            uint64_t end, const char* argname, uint64_t arg)
+{
+  struct ring* r = myring(tr);
+  if(r == NULL || r->events == NULL) { return; }
+  struct event* ev = &r->events[r->count % tr->capacity];
+  ev->name = name;
+  ev->argname = argname;
+  ev->start = start;
+  ev->end = end;
+  ev->arg = arg;
+  r->count++;
+}
+
+int
+trace_flush(const struct ooktrace* tr, FILE* fp)
+{
+  const long pid = (long)getpid();
+  bool first = true;
+  fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  for(size_t i=0; i < TRACE_THREADS; ++i) {
+    const struct ring* r = &tr->rings[i];
+    if(LOAD(r->state) != RING_OWNED || r->events == NULL) { continue; }
+    fprintf(fp, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%ld,"
+            "\"tid\":%zu,\"args\":{\"name\":\"thread %zu\"}}",
+            first ? "" : ",\n", pid, i, i);
+    first = false;
+    /* oldest first; if we wrapped, the oldest is the one we'd write next. */
+    const uint64_t n = r->count < tr->capacity ? r->count : tr->capacity;
+    const uint64_t begin = r->count - n;
+    for(uint64_t e=begin; e < r->count; ++e) {
+      const struct event* ev = &r->events[e % tr->capacity];
+      fprintf(fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%ld,\"tid\":%zu,"
+              "\"ts\":%.3f,\"dur\":%.3f", ev->name, pid, i,
+              ev->start / 1000.0, (ev->end - ev->start) / 1000.0);
+      if(ev->argname != NULL) {
+        fprintf(fp, ",\"args\":{\"%s\":%" PRIu64 "}", ev->argname, ev->arg);
+      }
+      fprintf(fp, "}");
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  return ferror(fp) ? EIO : 0;
+}
+
+void
+trace_destroy(struct ooktrace* tr)
+{
+  if(tr == NULL) { return; }
+  for(size_t i=0; i < TRACE_THREADS; ++i) {
+    free(tr->rings[i].events);
+  }
+  free(tr);
+}
@@ -0,0 +1,27 @@
+#ifndef OOK_TRACE_H
+#define OOK_TRACE_H
+/* Internal to ook: a recorder for timeline events.  Each thread appends to a
+ * ring buffer of its own, so recording takes no locks.  Once every thread is
+ * done, the events can be written out in the trace-event JSON format that
+ * chrome://tracing and Perfetto understand. */
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+struct ooktrace;
+
+/** @param capacity the number of events each thread keeps.  When a thread
+ * records more than this, its oldest events are dropped. */
+struct ooktrace* trace_create(size_t capacity);
+/** records an event which began at 'start' and ended at 'end' (in
+ * nanoseconds).  'name' must be a string literal, or otherwise outlive the
+ * trace.  'arg' is reported along with the event; its meaning depends on the
+ * event, as given by 'argname'. */
+void trace_event(struct ooktrace*, const char* name, uint64_t start,
+                 uint64_t end, const char* argname, uint64_t arg);
+/** writes everything recorded as trace-event JSON.
+ * @returns 0 on success, an error code on error. */
+int trace_flush(const struct ooktrace*, FILE*);
+void trace_destroy(struct ooktrace*);
+
+#endif